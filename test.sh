@@ -22,17 +22,51 @@ function get_similarity {
 
 # Regular tests share single uprintf implementation, but option tests need their own.
 function uses_shared_implementation {
-    if   [ "$1" = "depth_option" ];       then echo false;
-    elif [ "$1" = "indentation_option" ]; then echo false;
-    elif [ "$1" = "stdio_file" ];         then echo false;
-    elif [ "$1" = "string_truncation" ];  then echo false;
+    if   [ "$1" = "allocator_option" ];    then echo false;
+    elif [ "$1" = "compressed_sections" ]; then echo false;
+    elif [ "$1" = "ctf" ];                 then echo false;
+    elif [ "$1" = "debug_names" ];         then echo false;
+    elif [ "$1" = "depth_option" ];        then echo false;
+    elif [ "$1" = "indentation_option" ];  then echo false;
+    elif [ "$1" = "init_threads_option" ]; then echo false;
+    elif [ "$1" = "max_memory_option" ];   then echo false;
+    elif [ "$1" = "repeated_calls" ];      then echo false;
+    elif [ "$1" = "separate_debug_file" ]; then echo false;
+    elif [ "$1" = "shared_library" ];      then echo false;
+    elif [ "$1" = "split_dwarf" ];         then echo false;
+    elif [ "$1" = "split_type_units" ];    then echo false;
+    elif [ "$1" = "stdio_file" ];          then echo false;
+    elif [ "$1" = "string_truncation" ];   then echo false;
+    elif [ "$1" = "type_units" ];          then echo false;
     else echo true; fi
 }
 
+# Some tests check how uprintf handles executables built with specific flags.
+function get_flags {
+    if   [ "$1" = "compressed_sections" ]; then echo "-gz=zlib";
+    elif [ "$1" = "ctf" ];                 then echo "-gctf";
+    elif [ "$1" = "debug_names" ];         then echo "-gdwarf-5 -gpubnames -fdebug-types-section";
+    elif [ "$1" = "shared_library" ];      then echo "-rdynamic -ldl";
+    elif [ "$1" = "split_dwarf" ];         then echo "-gsplit-dwarf";
+    elif [ "$1" = "split_type_units" ];    then echo "-gdwarf-5 -gsplit-dwarf -fdebug-types-section";
+    elif [ "$1" = "type_units" ];          then echo "-fdebug-types-section"; fi
+}
+
+# CTF can only be generated by gcc.
+if [ "$1" = "ctf" ] && [ "$2" != "gcc" ]; then
+    echo "[TEST SKIPPED] $output_file: $2 doesn't support CTF"
+    exit 0
+fi
+
 # Compiling
 mkdir -p $dir
-if [ $(uses_shared_implementation $1) = false ]; then
-    $2 $CFLAGS -Werror -$3 -$4 -o $bin $input > $log 2>&1
+if [ "$1" = "split_type_units" ]; then
+    # Second unit is compiled from the same file, so that it gets a .dwo file of its own.
+    $2 $CFLAGS -Werror -$3 -$4 -DSECOND_UNIT -c -o $bin-second.o $input $(get_flags $1) > $log 2>&1 \
+        && $2 $CFLAGS -Werror -$3 -$4 -o $bin $input $bin-second.o $(get_flags $1) >> $log 2>&1
+    ret=$?
+elif [ $(uses_shared_implementation $1) = false ]; then
+    $2 $CFLAGS -Werror -$3 -$4 -o $bin $input $(get_flags $1) > $log 2>&1
     ret=$?
 else
     object="$bin.o"
@@ -43,11 +77,35 @@ else
     $2 $CFLAGS -Werror -$3 -$4 -o $bin $object $implementation >> $log 2>&1
 fi
 
+# The library is loaded from the executable's path, and uses the implementation exported by the executable.
+if [ $ret -eq 0 ] && [ "$1" = "shared_library" ]; then
+    $2 $CFLAGS -Werror -$3 -$4 -DSHARED_LIBRARY -shared -fPIC -o $bin.so $input >> $log 2>&1
+    ret=$?
+fi
+
+# Debugging information is moved to a file next to the executable, which is found through .gnu_debuglink.
+if [ $ret -eq 0 ] && [ "$1" = "separate_debug_file" ]; then
+    objcopy --only-keep-debug $bin $bin.debug >> $log 2>&1 && objcopy --strip-debug --add-gnu-debuglink=$bin.debug $bin >> $log 2>&1
+    ret=$?
+fi
+
+# DWARF is stripped, so that only CTF is left.
+if [ $ret -eq 0 ] && [ "$1" = "ctf" ]; then
+    objcopy --strip-debug $bin >> $log 2>&1
+    ret=$?
+fi
+
 if [ $ret -ne 0 ]; then
     echo "[COMPILATION FAILED] Log: $log. Rerun test: make $bin"
     exit 1
 fi
 
+# Not every compiler emits .debug_names, e.g. gcc only emits .debug_pubnames, without which the index isn't tested.
+if [ "$1" = "debug_names" ] && ! readelf -S $bin | grep -q "\.debug_names"; then
+    echo "[TEST SKIPPED] $output_file: $2 doesn't emit .debug_names"
+    exit 0
+fi
+
 # Running
 ./$bin > $output 2>&1
 if [ $? -ne 0 ]; then
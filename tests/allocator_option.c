@@ -0,0 +1,59 @@
+#include <stdlib.h>
+
+static size_t allocations = 0;
+static size_t reallocations = 0;
+static size_t frees = 0;
+static size_t largest_allocation = 0;
+
+static void *counting_malloc(size_t size) {
+    allocations++;
+    if (size > largest_allocation) largest_allocation = size;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *ptr, size_t size) {
+    reallocations++;
+    return realloc(ptr, size);
+}
+
+static void counting_free(void *ptr) {
+    if (ptr != NULL) frees++;
+    free(ptr);
+}
+
+#define UPRINTF_MALLOC counting_malloc
+#define UPRINTF_REALLOC counting_realloc
+#define UPRINTF_FREE counting_free
+#define UPRINTF_IMPLEMENTATION
+#include <stdio.h>
+#include "uprintf.h"
+
+#define LARGE_REGION_SIZE (4 << 20)
+
+int main(void) {
+    int numbers[3] = {1, 2, 3};
+    uprintf("Numbers: %S\n", &numbers);
+
+    printf("Allocations go through UPRINTF_MALLOC: %s\n", allocations > 0 ? "true" : "false");
+    // Most of the vectors grow in place, so little of the allocated memory is left unused.
+    printf("Arenas waste less than a quarter: %s\n", _upf_get_memory_waste() * 4 < _upf_get_memory_usage() ? "true" : "false");
+
+    // Output buffer is the only memory which is reallocated, once the output doesn't fit into it.
+    int squares[128];
+    for (int i = 0; i < 128; i++) squares[i] = i * i;
+    printf("Short output isn't reallocated: %s\n", reallocations == 0 ? "true" : "false");
+    uprintf("Squares: %S\n", &squares);
+    printf("Long output is reallocated with UPRINTF_REALLOC: %s\n", reallocations > 0 ? "true" : "false");
+
+    // Regions of this size would be mapped with the default allocator.
+    _upf_arena arena;
+    _upf_arena_init(&arena, LARGE_REGION_SIZE);
+    bool is_allocated = !arena.head->is_mapped && largest_allocation >= LARGE_REGION_SIZE;
+    printf("Large regions are allocated with UPRINTF_MALLOC: %s\n", is_allocated ? "true" : "false");
+    _upf_arena_free(&arena);
+
+    uprintf_trim();
+    printf("Memory is freed with UPRINTF_FREE: %s\n", frees > 0 ? "true" : "false");
+
+    return _upf_test_status;
+}
@@ -0,0 +1,97 @@
+#define _DEFAULT_SOURCE
+#include <dirent.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uprintf.h"
+
+typedef struct Node {
+    int value;
+    struct Node *next;
+    int (*get)(const struct Node *node);
+} Node;
+
+__attribute__((noinline)) static int get(const Node *node) { return node->value; }
+
+static void print(void) {
+    Node tail = {
+        .value = 2,
+        .next = NULL,
+        .get = get,
+    };
+    Node head = {
+        .value = 1,
+        .next = &tail,
+        .get = get,
+    };
+
+    uprintf("head: %S\n", &head);
+    {
+        double head = 1.5;
+        uprintf("double head: %S\n", &head);
+    }
+    uprintf("cast: %S\n", (Node *) &tail);
+    uprintf("head.next->get: %S\n", &head.next->get);
+}
+
+static bool has_cache_file(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return false;
+
+    bool has_cache = false;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t length = strlen(entry->d_name);
+        if (length > 6 && strcmp(entry->d_name + length - 6, ".cache") == 0) has_cache = true;
+    }
+    closedir(dir);
+    return has_cache;
+}
+
+static void remove_dir(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    char entry_path[4096];
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') continue;
+        snprintf(entry_path, sizeof(entry_path), "%s/%s", path, entry->d_name);
+        remove(entry_path);
+    }
+    closedir(dir);
+    rmdir(path);
+}
+
+int main(void) {
+    char dir[] = "/tmp/uprintf_cache_XXXXXX";
+    if (mkdtemp(dir) == NULL) return EXIT_FAILURE;
+    setenv("UPRINTF_CACHE_DIR", dir, 1);
+
+    // The first process parses debugging information and saves it to the
+    // cache, while the second one loads it from there.
+    pid_t pid = fork();
+    if (pid == -1) return EXIT_FAILURE;
+    if (pid == 0) {
+        if (freopen("/dev/null", "w", stdout) == NULL) return EXIT_FAILURE;
+        print();
+        return _upf_test_status;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        remove_dir(dir);
+        return EXIT_FAILURE;
+    }
+
+    printf("Cache is written: %s\n", has_cache_file(dir) ? "true" : "false");
+
+    print();
+    printf("Cache is loaded: %s\n", _upf_test_cache_loads > 0 ? "true" : "false");
+
+    remove_dir(dir);
+    return _upf_test_status;
+}
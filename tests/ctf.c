@@ -0,0 +1,70 @@
+#define UPRINTF_IMPLEMENTATION
+#include <stdbool.h>
+#include <stdint.h>
+#include "uprintf.h"
+
+// The executable only has CTF, thus all the arguments are casts to typenames.
+
+enum Direction { LEFT = -1, NONE, RIGHT };
+
+typedef struct {
+    uint16_t bit_field1 : 5;
+    int : 0;
+    uint8_t bit_field2 : 6;
+    bool bit_field3 : 1;
+    int byte_field;
+} BitFields;
+
+union Number {
+    int i;
+    float f;
+};
+
+struct Node {
+    const char *name;
+    enum Direction direction;
+    double matrix[2][3];
+    union Number number;
+    BitFields fields;
+    void (*callback)(int, char);
+    const volatile void *data;
+    struct Node *next;
+};
+
+static void callback(int a, char b) {
+    (void) a;
+    (void) b;
+}
+
+int main(void) {
+    struct Node tail = {
+        .name = "tail",
+        .direction = LEFT,
+        .matrix = {{1, 2, 3}, {4, 5, 6}},
+        .number = {.i = 7},
+        .fields = {31, 63, 1, -100},
+        .callback = NULL,
+        .data = NULL,
+        .next = NULL,
+    };
+    struct Node head = {
+        .name = "head",
+        .direction = RIGHT,
+        .matrix = {{0}},
+        .number = {.f = 1.5f},
+        .fields = {0, 0, 0, 0},
+        .callback = callback,
+        .data = &tail,
+        .next = &tail,
+    };
+    int8_t small = -5;
+
+    uprintf("List: %S\n", (struct Node *) &head);
+    uprintf("Bit fields: %S\n", (BitFields *) &tail.fields);
+    uprintf("Enum: %S\n", (enum Direction *) &head.direction);
+    uprintf("Union: %S\n", (union Number *) &tail.number);
+    uprintf("Name: %S\n", (const char **) &head.name);
+    uprintf("int8_t: %S\n", (int8_t *) &small);
+
+    return _upf_test_status;
+}
@@ -0,0 +1,28 @@
+#define UPRINTF_IMPLEMENTATION
+#include "uprintf.h"
+
+// Clang indexes the types in .debug_names, including the ones from type units,
+// whose entries reference them instead of the CU.
+struct Point {
+    int x;
+    int y;
+};
+
+typedef struct {
+    struct Point from;
+    struct Point to;
+} Segment;
+
+int main(void) {
+    Segment segment = {
+        .from = {1, 2},
+        .to = {3, 4},
+    };
+
+    // Casts come first, so that the types are looked up in the index before the unit is parsed.
+    uprintf("Point: %S\n", (struct Point *) &segment.to);
+    uprintf("Segment: %S\n", (Segment *) &segment);
+    uprintf("Variable: %S\n", &segment);
+
+    return _upf_test_status;
+}
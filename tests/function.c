@@ -1,3 +1,5 @@
+#include <stdint.h>
+
 #include "uprintf.h"
 
 typedef int *(*fun0_t)(void);
@@ -82,5 +84,8 @@ int main(void) {
     uprintf("&(*functions.fp)()().f0: %S\n", &(*functions.fp)()()->f0);
     uprintf("(*functions.fp)()().f0()(): %S\n", (*functions.fp)()()->f0());
 
+    fun0_t fun0_middle = (fun0_t) ((uintptr_t) fun0 + 4);
+    uprintf("&fun0_middle: %S\n", &fun0_middle);
+
     return _upf_test_status;
 }
@@ -0,0 +1,3 @@
+#define UPRINTF_INIT_THREADS 4
+#define UPRINTF_IMPLEMENTATION
+#include "scopes.c"
@@ -0,0 +1,30 @@
+#define UPRINTF_MAX_MEMORY (1 << 20)
+#define UPRINTF_IMPLEMENTATION
+#include <stdio.h>
+#include "uprintf.h"
+
+static size_t max_usage = 0;
+
+static void update_max_usage(void) {
+    size_t usage = _upf_get_memory_usage();
+    if (usage > max_usage) max_usage = usage;
+}
+
+int main(void) {
+    int numbers[3] = {1, 2, 3};
+    double weights[3] = {0.5, 1.5, 2.5};
+
+    uprintf("Numbers: %S\n", &numbers);
+    update_max_usage();
+    uprintf("Weights: %S\n", &weights);
+    update_max_usage();
+    printf("Memory stays within the limit: %s\n", max_usage <= UPRINTF_MAX_MEMORY ? "true" : "false");
+
+    size_t usage = _upf_get_memory_usage();
+    uprintf_trim();
+    printf("Trimming releases memory: %s\n", _upf_get_memory_usage() < usage ? "true" : "false");
+
+    uprintf("Weights after trimming: %S\n", &weights);
+
+    return _upf_test_status;
+}
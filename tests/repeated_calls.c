@@ -0,0 +1,43 @@
+#define UPRINTF_IMPLEMENTATION
+#include <fcntl.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "uprintf.h"
+
+#define WARMUP_CALLS 10
+#define CALLS 10000
+
+typedef struct Table {
+    const char *name;
+    int rows[2][3];
+    const struct Table *self;
+} Table;
+
+// Pointers to the row and to the name have no type in DWARF, so they are created on each call.
+static void print_table(const Table *table) { uprintf("%S %S %S\n", table, &table->rows[1], &table->name); }
+
+int main(void) {
+    Table table = {
+        .name = "table",
+        .rows = {{1, 2, 3}, {4, 5, 6}},
+    };
+    table.self = &table;
+
+    // Output of the repeated calls is discarded, only the memory usage is checked.
+    int stdout_fd = dup(STDOUT_FILENO);
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (stdout_fd == -1 || null_fd == -1 || dup2(null_fd, STDOUT_FILENO) == -1) return 1;
+
+    for (int i = 0; i < WARMUP_CALLS; i++) print_table(&table);
+    size_t usage = _upf_get_memory_usage();
+    for (int i = 0; i < CALLS; i++) print_table(&table);
+    bool grows = _upf_get_memory_usage() != usage;
+
+    if (dup2(stdout_fd, STDOUT_FILENO) == -1) return 1;
+    close(stdout_fd);
+    close(null_fd);
+    print_table(&table);
+    printf("Memory usage doesn't grow with calls: %s\n", grows ? "false" : "true");
+
+    return _upf_test_status;
+}
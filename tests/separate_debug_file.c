@@ -0,0 +1,2 @@
+#define UPRINTF_IMPLEMENTATION
+#include "function.c"
@@ -0,0 +1,92 @@
+// Built twice: as a shared library with -DSHARED_LIBRARY, and as the executable
+// which loads it with dlopen after the first call to uprintf (see test.sh).
+
+#ifdef SHARED_LIBRARY
+
+#include "uprintf.h"
+
+typedef struct {
+    int id;
+    const char *name;
+    float weights[3];
+} Plugin;
+
+typedef struct {
+    int (*get_id)(const Plugin *plugin);
+    const Plugin *plugin;
+} PluginHandle;
+
+__attribute__((noinline)) static int get_id(const Plugin *plugin) { return plugin->id; }
+
+static Plugin plugin = {
+    .id = 7,
+    .name = "plugin",
+    .weights = {0.5f, 0.25f, 0.125f},
+};
+
+void plugin_print(void) {
+    PluginHandle handle = {
+        .get_id = get_id,
+        .plugin = &plugin,
+    };
+
+    uprintf("plugin: %S\n", &plugin);
+    uprintf("handle: %S\n", &handle);
+}
+
+int plugin_get_version(void) { return 3; }
+
+#else
+
+#define _DEFAULT_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define UPRINTF_IMPLEMENTATION
+#include "uprintf.h"
+
+typedef struct {
+    void (*print)(void);
+    int (*get_version)(void);
+} Library;
+
+int main(void) {
+    char path[1024];
+    ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - sizeof(".so"));
+    if (length == -1) return EXIT_FAILURE;
+    memcpy(path + length, ".so", sizeof(".so"));
+
+    Library library = {0};
+    uprintf("before dlopen: %S\n", &library);
+
+    void *handle = dlopen(path, RTLD_NOW);
+    if (handle == NULL) return EXIT_FAILURE;
+    // Function pointers can't be assigned from void * in ISO C.
+    *(void **) (&library.print) = dlsym(handle, "plugin_print");
+    *(void **) (&library.get_version) = dlsym(handle, "plugin_get_version");
+    if (library.print == NULL || library.get_version == NULL) return EXIT_FAILURE;
+
+    uprintf("after dlopen: %S\n", &library);
+    library.print();
+    size_t modules_count = _upf_state.modules.length;
+
+    // Library is freed by the next call once it is unloaded, and parsed again once it is reloaded.
+    dlclose(handle);
+    library = (Library) {0};
+    uprintf("after dlclose: %S\n", &library);
+    printf("Unloaded library is freed: %s\n", _upf_state.modules.length < modules_count ? "true" : "false");
+
+    handle = dlopen(path, RTLD_NOW);
+    if (handle == NULL) return EXIT_FAILURE;
+    *(void **) (&library.print) = dlsym(handle, "plugin_print");
+    if (library.print == NULL) return EXIT_FAILURE;
+    library.print();
+
+    dlclose(handle);
+    return _upf_test_status;
+}
+
+#endif
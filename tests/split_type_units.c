@@ -0,0 +1,70 @@
+// Built twice: as the second unit with -DSECOND_UNIT, and as the executable
+// which links it (see test.sh). Each unit has a .dwo file of its own, whose
+// type units are only added once the unit is needed.
+
+#define CONCAT(a, b) CONCAT_(a, b)
+#define CONCAT_(a, b) a##b
+
+// Types of each unit are used by its variables, so that they get type units.
+#define DEFINE_TYPE(prefix, n)                                          \
+    typedef struct CONCAT(prefix, n) {                                  \
+        int id;                                                         \
+        const char *name;                                               \
+    } CONCAT(prefix, n);                                                \
+    CONCAT(prefix, n) CONCAT(CONCAT(prefix, Value), n) = {n, #prefix};
+#define DEFINE_10_TYPES(prefix, n)  \
+    DEFINE_TYPE(prefix, CONCAT(n, 0)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 1)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 2)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 3)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 4)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 5)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 6)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 7)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 8)) \
+    DEFINE_TYPE(prefix, CONCAT(n, 9))
+#define DEFINE_100_TYPES(prefix, n)     \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 0)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 1)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 2)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 3)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 4)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 5)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 6)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 7)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 8)) \
+    DEFINE_10_TYPES(prefix, CONCAT(n, 9))
+
+#ifdef SECOND_UNIT
+
+#include "uprintf.h"
+
+// More types than the first unit has, so that the list of type units grows
+// elsewhere once they are added, after the first unit's types were parsed.
+DEFINE_100_TYPES(Second, 1)
+DEFINE_100_TYPES(Second, 2)
+
+void print_second(void) { uprintf("Second: %S\n", &SecondValue100); }
+
+#else
+
+#define UPRINTF_IMPLEMENTATION
+#include "uprintf.h"
+
+DEFINE_100_TYPES(First, 1)
+
+void print_second(void);
+
+int main(void) {
+    uprintf("First: %S\n", &FirstValue100);
+    print_second();
+
+    // Type units which were parsed before the list grew are freed and parsed again.
+    uprintf_trim();
+    uprintf("First after trimming: %S\n", &FirstValue100);
+    print_second();
+
+    return _upf_test_status;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#define UPRINTF_IMPLEMENTATION
+#include "uprintf.h"
+
+enum Color { RED, GREEN, BLUE };
+
+// Both structures and the enum are defined in type units, while the unit only
+// references them by signatures.
+struct Point {
+    int x;
+    int y;
+};
+
+struct Shape {
+    enum Color color;
+    struct Point points[2];
+    struct Shape *next;
+};
+
+int main(void) {
+    struct Shape line = {
+        .color = BLUE,
+        .points = {{1, 2}, {3, 4}},
+        .next = NULL,
+    };
+    struct Shape point = {
+        .color = RED,
+        .points = {{5, 6}, {0, 0}},
+        .next = &line,
+    };
+
+    uprintf("Shapes: %S\n", &point);
+    uprintf("Point: %S\n", &line.points[1]);
+    uprintf("Cast: %S\n", (struct Point *) &point.points[0]);
+    uprintf("Enum cast: %S\n", (enum Color *) &line.color);
+
+    return _upf_test_status;
+}
@@ -42,6 +42,10 @@
 
 void _upf_uprintf(const char *file, int line, const char *fmt, const char *args, ...);
 
+// Releases the memory which isn't needed for the next call: parsed compilation
+// units, types and the output buffer, which are rebuilt on demand.
+void uprintf_trim(void);
+
 // If variadic arguments were to be stringified directly, the arguments which
 // use macros would stringify to the macro name instead of being expanded, but
 // by calling another macro the argument-macros will be expanded and stringified
@@ -60,6 +64,7 @@ void _upf_uprintf(const char *file, int line, const char *fmt, const char *args,
 
 #ifdef UPRINTF_TEST
 extern int _upf_test_status;
+extern int _upf_test_cache_loads;
 #endif
 
 #endif  // UPRINTF_H
@@ -90,6 +95,30 @@ extern int _upf_test_status;
 #define UPRINTF_MAX_STRING_LENGTH 200
 #endif
 
+#ifndef UPRINTF_INIT_THREADS
+#define UPRINTF_INIT_THREADS 0
+#endif
+
+#ifndef UPRINTF_MAX_MEMORY
+#define UPRINTF_MAX_MEMORY 0
+#endif
+
+#ifndef UPRINTF_HUGE_PAGES
+#define UPRINTF_HUGE_PAGES false
+#endif
+
+#if defined(UPRINTF_MALLOC) || defined(UPRINTF_REALLOC) || defined(UPRINTF_FREE)
+#if !defined(UPRINTF_MALLOC) || !defined(UPRINTF_REALLOC) || !defined(UPRINTF_FREE)
+#error [ERROR] UPRINTF_MALLOC, UPRINTF_REALLOC and UPRINTF_FREE must be defined together
+#endif
+#define _UPF_HAS_CUSTOM_ALLOCATOR true
+#else
+#define UPRINTF_MALLOC malloc
+#define UPRINTF_REALLOC realloc
+#define UPRINTF_FREE free
+#define _UPF_HAS_CUSTOM_ALLOCATOR false
+#endif
+
 // ===================== INCLUDES =========================
 
 #ifndef __USE_XOPEN_EXTENDED
@@ -99,6 +128,9 @@ extern int _upf_test_status;
 #include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
+#if UPRINTF_INIT_THREADS > 1
+#include <pthread.h>
+#endif
 #include <setjmp.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -116,8 +148,49 @@ extern int _upf_test_status;
 // been included before this one and thus expanded without the macro, so the
 // functions must be declared here.
 
-ssize_t readlink(const char *path, char *buf, size_t bufsiz);
+char *realpath(const char *path, char *resolved_path);
+
+// dl_iterate_phdr and its structure are only declared with _GNU_SOURCE. The
+// structure is a prefix of struct dl_phdr_info.
+struct dl_phdr_info;
+struct _upf_dl_phdr_info {
+    Elf64_Addr addr;
+    const char *name;
+    const Elf64_Phdr *phdr;
+    Elf64_Half phnum;
+    unsigned long long adds;
+    unsigned long long subs;
+};
+int dl_iterate_phdr(int (*callback)(struct dl_phdr_info *info, size_t size, void *data), void *data);
 ssize_t getline(char **lineptr, size_t *n, FILE *stream);
+int madvise(void *addr, size_t length, int advice);
+
+// MAP_ANONYMOUS isn't part of POSIX, so strict modes hide it. Its value is fixed on x86-64 Linux.
+#ifdef MAP_ANONYMOUS
+#define _UPF_MAP_ANONYMOUS MAP_ANONYMOUS
+#else
+#define _UPF_MAP_ANONYMOUS 0x20
+#endif
+
+// Same for madvise's advice, unlike posix_madvise's, whose POSIX_MADV_DONTNEED does nothing on Linux.
+#ifdef MADV_DONTNEED
+#define _UPF_MADV_RANDOM MADV_RANDOM
+#define _UPF_MADV_SEQUENTIAL MADV_SEQUENTIAL
+#define _UPF_MADV_WILLNEED MADV_WILLNEED
+#define _UPF_MADV_DONTNEED MADV_DONTNEED
+#else
+#define _UPF_MADV_RANDOM 1
+#define _UPF_MADV_SEQUENTIAL 2
+#define _UPF_MADV_WILLNEED 3
+#define _UPF_MADV_DONTNEED 4
+#endif
+
+// MADV_HUGEPAGE is Linux-specific, so it is hidden even by some of the modes which have the rest.
+#ifdef MADV_HUGEPAGE
+#define _UPF_MADV_HUGEPAGE MADV_HUGEPAGE
+#else
+#define _UPF_MADV_HUGEPAGE 14
+#endif
 
 // ===================== dwarf.h ==========================
 
@@ -129,6 +202,11 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 // include the real dwarf.h
 
 #define _UPF_DW_UT_compile 0x01
+#define _UPF_DW_UT_type 0x02
+#define _UPF_DW_UT_partial 0x03
+#define _UPF_DW_UT_skeleton 0x04
+#define _UPF_DW_UT_split_compile 0x05
+#define _UPF_DW_UT_split_type 0x06
 
 #define _UPF_DW_TAG_array_type 0x01
 #define _UPF_DW_TAG_enumeration_type 0x04
@@ -151,9 +229,12 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 #define _UPF_DW_TAG_variable 0x34
 #define _UPF_DW_TAG_volatile_type 0x35
 #define _UPF_DW_TAG_restrict_type 0x37
+#define _UPF_DW_TAG_partial_unit 0x3c
+#define _UPF_DW_TAG_type_unit 0x41
 #define _UPF_DW_TAG_atomic_type 0x47
 #define _UPF_DW_TAG_call_site 0x48
 #define _UPF_DW_TAG_call_site_parameter 0x49
+#define _UPF_DW_TAG_skeleton_unit 0x4a
 
 #define _UPF_DW_FORM_addr 0x01
 #define _UPF_DW_FORM_block2 0x03
@@ -198,7 +279,10 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 #define _UPF_DW_FORM_addrx2 0x2a
 #define _UPF_DW_FORM_addrx3 0x2b
 #define _UPF_DW_FORM_addrx4 0x2c
+#define _UPF_DW_FORM_GNU_ref_alt 0x1f20
+#define _UPF_DW_FORM_GNU_strp_alt 0x1f21
 
+#define _UPF_DW_AT_sibling 0x01
 #define _UPF_DW_AT_name 0x03
 #define _UPF_DW_AT_byte_size 0x0b
 #define _UPF_DW_AT_bit_offset 0x0c
@@ -206,6 +290,7 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 #define _UPF_DW_AT_low_pc 0x11
 #define _UPF_DW_AT_high_pc 0x12
 #define _UPF_DW_AT_language 0x13
+#define _UPF_DW_AT_comp_dir 0x1b
 #define _UPF_DW_AT_const_value 0x1c
 #define _UPF_DW_AT_upper_bound 0x2f
 #define _UPF_DW_AT_abstract_origin 0x31
@@ -214,10 +299,12 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 #define _UPF_DW_AT_encoding 0x3e
 #define _UPF_DW_AT_type 0x49
 #define _UPF_DW_AT_ranges 0x55
+#define _UPF_DW_AT_signature 0x69
 #define _UPF_DW_AT_data_bit_offset 0x6b
 #define _UPF_DW_AT_str_offsets_base 0x72
 #define _UPF_DW_AT_addr_base 0x73
 #define _UPF_DW_AT_rnglists_base 0x74
+#define _UPF_DW_AT_dwo_name 0x76
 
 #define _UPF_DW_ATE_address 0x01
 #define _UPF_DW_ATE_boolean 0x02
@@ -238,6 +325,15 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 #define _UPF_DW_ATE_UCS 0x11
 #define _UPF_DW_ATE_ASCII 0x12
 
+#define _UPF_DW_IDX_compile_unit 0x01
+#define _UPF_DW_IDX_type_unit 0x02
+#define _UPF_DW_IDX_die_offset 0x03
+
+#define _UPF_DW_SECT_info 1
+#define _UPF_DW_SECT_abbrev 3
+#define _UPF_DW_SECT_str_offsets 6
+#define _UPF_DW_SECT_rnglists 8
+
 #define _UPF_DW_RLE_end_of_list 0x00
 #define _UPF_DW_RLE_base_addressx 0x01
 #define _UPF_DW_RLE_startx_endx 0x02
@@ -257,16 +353,29 @@ ssize_t getline(char **lineptr, size_t *n, FILE *stream);
 
 #ifdef UPRINTF_TEST
 int _upf_test_status = EXIT_SUCCESS;
+// Number of modules which were loaded from the cache instead of being parsed.
+int _upf_test_cache_loads = 0;
 
 #define _UPF_SET_TEST_STATUS(status) _upf_test_status = status
+#define _UPF_COUNT_TEST_CACHE_LOAD() _upf_test_cache_loads++
 #else
 #define _UPF_SET_TEST_STATUS(status) (void) status
+#define _UPF_COUNT_TEST_CACHE_LOAD()
 #endif
 
 // ====================== ERRORS ==========================
 
 #define _UPF_INVALID -1UL
 
+#if UPRINTF_INIT_THREADS > 1
+// Worker threads must not jump into uprintf's stack frame, so errors in them
+// jump to the buffer of the thread instead.
+static __thread jmp_buf *_upf_thread_jmp_buf = NULL;
+#define _UPF_JMP_BUF (_upf_thread_jmp_buf == NULL ? _upf_state.jmp_buf : *_upf_thread_jmp_buf)
+#else
+#define _UPF_JMP_BUF _upf_state.jmp_buf
+#endif
+
 #define _UPF_LOG(type, ...)                       \
     do {                                          \
         fprintf(stderr, "(uprintf) [%s] ", type); \
@@ -278,7 +387,7 @@ int _upf_test_status = EXIT_SUCCESS;
     do {                                           \
         _UPF_LOG("ERROR", __VA_ARGS__);            \
         _UPF_SET_TEST_STATUS(EXIT_FAILURE);        \
-        longjmp(_upf_state.jmp_buf, EXIT_FAILURE); \
+        longjmp(_UPF_JMP_BUF, EXIT_FAILURE);       \
     } while (0)
 
 #define _UPF_WARN(...)                      \
@@ -298,6 +407,8 @@ int _upf_test_status = EXIT_SUCCESS;
 // ====================== VECTOR ==========================
 
 #define _UPF_INITIAL_VECTOR_CAPACITY 4
+// Capacity is stored in 32 bits, so it can't double past this.
+#define _UPF_MAX_VECTOR_CAPACITY (1U << 31)
 
 #define _UPF_VECTOR_TYPEDEF(name, type) \
     typedef struct {                    \
@@ -323,30 +434,48 @@ int _upf_test_status = EXIT_SUCCESS;
         (vec)->data = NULL;      \
     } while (0)
 
-#define _UPF_VECTOR_PUSH(vec, element)                                     \
-    do {                                                                   \
-        if ((vec)->capacity == 0) {                                        \
-            (vec)->capacity = _UPF_INITIAL_VECTOR_CAPACITY;                \
-            uint32_t size = (vec)->capacity * sizeof(*(vec)->data);        \
-            (vec)->data = _upf_arena_alloc((vec)->arena, size);            \
-        } else if ((vec)->capacity == (vec)->length) {                     \
-            uint32_t old_size = (vec)->capacity * sizeof(*(vec)->data);    \
-            (vec)->capacity *= 2;                                          \
-            void *new_data = _upf_arena_alloc((vec)->arena, old_size * 2); \
-            memcpy(new_data, (vec)->data, old_size);                       \
-            (vec)->data = new_data;                                        \
-        }                                                                  \
-        (vec)->data[(vec)->length++] = (element);                          \
+#define _UPF_VECTOR_PUSH(vec, element)                                                                                 \
+    do {                                                                                                               \
+        if ((vec)->capacity == 0) {                                                                                    \
+            (vec)->capacity = _UPF_INITIAL_VECTOR_CAPACITY;                                                            \
+            size_t size = (vec)->capacity * sizeof(*(vec)->data);                                                      \
+            (vec)->data = _upf_arena_alloc((vec)->arena, size);                                                        \
+        } else if ((vec)->capacity == (vec)->length) {                                                                 \
+            if ((vec)->capacity >= _UPF_MAX_VECTOR_CAPACITY) _UPF_ERROR("Vector can't hold more than 2^31 elements."); \
+            size_t old_size = (size_t) (vec)->capacity * sizeof(*(vec)->data);                                         \
+            (vec)->capacity *= 2;                                                                                      \
+            if (!_upf_arena_try_extend((vec)->arena, (vec)->data, old_size, old_size * 2)) {                           \
+                void *new_data = _upf_arena_alloc((vec)->arena, old_size * 2);                                         \
+                memcpy(new_data, (vec)->data, old_size);                                                               \
+                (vec)->data = new_data;                                                                                \
+                (vec)->arena->abandoned += old_size;                                                                   \
+            }                                                                                                          \
+        }                                                                                                              \
+        (vec)->data[(vec)->length++] = (element);                                                                      \
+    } while (0)
+
+#define _UPF_VECTOR_COPY(dst, src)                                     \
+    do {                                                               \
+        (dst)->arena = (src)->arena;                                   \
+        (dst)->capacity = (src)->length;                               \
+        (dst)->length = (src)->length;                                 \
+        size_t size = (size_t) (dst)->capacity * sizeof(*(dst)->data); \
+        (dst)->data = _upf_arena_alloc((dst)->arena, size);            \
+        memcpy((dst)->data, (src)->data, size);                        \
     } while (0)
 
-#define _UPF_VECTOR_COPY(dst, src)                              \
-    do {                                                        \
-        (dst)->arena = (src)->arena;                            \
-        (dst)->capacity = (src)->length;                        \
-        (dst)->length = (src)->length;                          \
-        uint32_t size = (dst)->capacity * sizeof(*(dst)->data); \
-        (dst)->data = _upf_arena_alloc((dst)->arena, size);     \
-        memcpy((dst)->data, (src)->data, size);                 \
+// Allocates space for the elements at once, when their number is known upfront.
+#define _UPF_VECTOR_RESERVE(vec, n)                                                                              \
+    do {                                                                                                         \
+        if ((vec)->capacity < (n)) {                                                                             \
+            if ((n) > _UPF_MAX_VECTOR_CAPACITY) _UPF_ERROR("Vector can't hold more than 2^31 elements.");        \
+            size_t old_size = (size_t) (vec)->capacity * sizeof(*(vec)->data);                                   \
+            void *new_data = _upf_arena_alloc((vec)->arena, (size_t) (n) * sizeof(*(vec)->data));                \
+            if ((vec)->length > 0) memcpy(new_data, (vec)->data, (size_t) (vec)->length * sizeof(*(vec)->data)); \
+            (vec)->arena->abandoned += old_size;                                                                 \
+            (vec)->capacity = (n);                                                                               \
+            (vec)->data = new_data;                                                                              \
+        }                                                                                                        \
     } while (0)
 
 #define _UPF_VECTOR_TOP(vec) (vec)->data[(vec)->length - 1]
@@ -359,21 +488,57 @@ typedef struct _upf_arena_region {
     uint8_t *data;
     size_t capacity;
     size_t length;
+    bool is_mapped;
     struct _upf_arena_region *next;
 } _upf_arena_region;
 
 typedef struct {
     _upf_arena_region *tail;
     _upf_arena_region *head;
+    // Bytes of the old buffers of the vectors and maps which were copied elsewhere to grow.
+    size_t abandoned;
+    // Position of the last mark, below which allocations aren't extended in place,
+    // since the rollback would hand out their memory again.
+    _upf_arena_region *floor_region;
+    size_t floor_length;
 } _upf_arena;
 
+// Position in the arena, to which it can be rolled back.
+typedef struct {
+    _upf_arena_region *region;
+    size_t length;
+    size_t abandoned;
+    // Floor of the arena before the mark, which is restored by the rollback.
+    _upf_arena_region *floor_region;
+    size_t floor_length;
+} _upf_arena_mark;
+
 _UPF_VECTOR_TYPEDEF(_upf_size_t_vec, size_t);
+_UPF_VECTOR_TYPEDEF(_upf_uint32_t_vec, uint32_t);
 _UPF_VECTOR_TYPEDEF(_upf_cstr_vec, const char *);
 
+typedef struct {
+    uint64_t key;
+    uint64_t value;
+} _upf_map_entry;
+
+// Open addressing hash map with linear probing. Key 0 is reserved for empty entries.
+typedef struct {
+    _upf_arena *arena;
+    uint32_t capacity;
+    uint32_t length;
+    _upf_map_entry *entries;
+} _upf_map;
+
 typedef struct {
     uint64_t name;
     uint64_t form;
     int64_t implicit_const;
+    // Size of the value if it doesn't depend on the DIE, otherwise _UPF_INVALID.
+    size_t size;
+    // Offset of the value from the first attribute if all the preceding values
+    // have fixed size, otherwise _UPF_INVALID.
+    size_t offset;
 } _upf_attr;
 
 _UPF_VECTOR_TYPEDEF(_upf_attr_vec, _upf_attr);
@@ -383,10 +548,23 @@ typedef struct {
     uint64_t tag;
     bool has_children;
     _upf_attr_vec attrs;
+    // Total size of the attributes if all of them have fixed size, otherwise _UPF_INVALID.
+    size_t size;
+    // Index of the first attribute whose value has variable size, i.e. the last
+    // one with known offset, or the number of attributes if there is none.
+    size_t first_variable_attr;
 } _upf_abbrev;
 
 _UPF_VECTOR_TYPEDEF(_upf_abbrev_vec, _upf_abbrev);
 
+typedef struct {
+    _upf_abbrev_vec abbrevs;
+    // Codes are usually consecutive and start from 1, in which case they are
+    // used as indices, otherwise code to index map is used.
+    bool is_dense;
+    _upf_map code_to_idx;
+} _upf_abbrev_table;
+
 enum _upf_type_kind {
     _UPF_TK_STRUCT,
     _UPF_TK_UNION,
@@ -412,17 +590,20 @@ enum _upf_type_kind {
 };
 
 typedef struct {
-    const char *name;
-    size_t type;
-    size_t offset;
+    // Offset in _upf_state.names.
+    uint32_t name;
+    uint32_t type;
+    // Offset in bits for bit fields, otherwise in bytes.
+    uint32_t offset;
     int bit_size;
 } _upf_member;
 
 _UPF_VECTOR_TYPEDEF(_upf_member_vec, _upf_member);
 
 typedef struct {
-    const char *name;
     int64_t value;
+    // Offset in _upf_state.names.
+    uint32_t name;
 } _upf_enum;
 
 _UPF_VECTOR_TYPEDEF(_upf_enum_vec, _upf_enum);
@@ -432,33 +613,29 @@ _UPF_VECTOR_TYPEDEF(_upf_enum_vec, _upf_enum);
 #define _UPF_MOD_RESTRICT 1 << 2
 #define _UPF_MOD_ATOMIC 1 << 3
 
+#define _UPF_NO_TYPE UINT32_MAX
+
+// There may be tens of thousands of types, so instead of pointers and vectors
+// they use 32-bit indices and offsets, while members, enumerators, array lengths
+// and argument types are stored in the pools in _upf_state. Fields which are
+// needed the most are at the front.
 typedef struct {
-    const char *name;
-    enum _upf_type_kind kind;
-    int modifiers;
+    uint8_t kind;  // enum _upf_type_kind
+    uint8_t modifiers;
+    // Range of the pool: members of the struct or union, enumerators of the enum,
+    // lengths of the array, or argument types of the function.
+    uint32_t first;
     size_t size;
-    union {
-        struct {
-            _upf_member_vec members;
-        } cstruct;
-        struct {
-            size_t underlying_type;
-            _upf_enum_vec enums;
-        } cenum;
-        struct {
-            size_t element_type;
-            _upf_size_t_vec lengths;
-        } array;
-        struct {
-            size_t type;
-        } pointer;
-        struct {
-            size_t return_type;
-            _upf_size_t_vec arg_types;
-        } function;
-    } as;
+    uint32_t count;
+    // Pointed type, underlying type of the enum, element type of the array or
+    // return type of the function.
+    uint32_t type;
+    // Offset in _upf_state.names, or 0 if the type is unnamed.
+    uint32_t name;
 } _upf_type;
 
+_UPF_VECTOR_TYPEDEF(_upf_type_vec, _upf_type);
+
 typedef struct {
     uint64_t start;
     uint64_t end;
@@ -483,6 +660,15 @@ typedef struct {
 
 _UPF_VECTOR_TYPEDEF(_upf_function_vec, _upf_function);
 
+// Address range of the function's code.
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    size_t function_idx;
+} _upf_function_range;
+
+_UPF_VECTOR_TYPEDEF(_upf_function_range_vec, _upf_function_range);
+
 typedef struct {
     const void *data;
     const _upf_type *type;
@@ -508,6 +694,29 @@ typedef struct {
 
 _UPF_VECTOR_TYPEDEF(_upf_scope_stack, _upf_scope_stack_entry);
 
+#define _UPF_NO_PARENT UINT32_MAX
+
+// Scope from the tree with a link to its parent.
+typedef struct {
+    const _upf_scope *scope;
+    uint32_t parent;
+    // Index of the first variable with the name by the hash of its name, only
+    // present in scopes with many variables.
+    _upf_map *var_names;
+} _upf_scope_node;
+
+_UPF_VECTOR_TYPEDEF(_upf_scope_node_vec, _upf_scope_node);
+
+// Address interval in which the node is the innermost scope.
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint32_t node_idx;
+    uint32_t depth;
+} _upf_scope_interval;
+
+_UPF_VECTOR_TYPEDEF(_upf_scope_interval_vec, _upf_scope_interval);
+
 enum _upf_token_kind {
     _UPF_TOK_NONE,
     _UPF_TOK_NUMBER,
@@ -563,58 +772,400 @@ typedef struct {
     _upf_cstr_vec members;
 } _upf_parser_state;
 
+// Debug section which is decompressed the first time it is needed if it is
+// compressed, see _upf_get_section.
 typedef struct {
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+    // Header of the section while its data is still compressed, otherwise NULL.
+    // In that case the data points to the compressed contents.
+    const Elf64_Shdr *compressed;
+} _upf_section;
+
+typedef struct {
+    void *data;
+    size_t size;
+} _upf_mapping;
+
+_UPF_VECTOR_TYPEDEF(_upf_mapping_vec, _upf_mapping);
+
+// Hash table which maps signatures of units in .dwp package to rows of their
+// contributions to the sections, see _upf_find_dwp_row.
+typedef struct {
+    uint32_t columns_count;
+    uint32_t units_count;
+    uint32_t slots_count;
+    const uint8_t *signatures;
+    const uint8_t *rows;
+    const uint8_t *section_ids;
+    const uint8_t *offsets;
+    const uint8_t *sizes;
+} _upf_dwp_index;
+
+// .dwo file or .dwp package with the split units of -gsplit-dwarf.
+typedef struct {
+    const uint8_t *die;
+    size_t die_size;
+    const uint8_t *abbrev;
+    const char *str;
+    const uint8_t *str_offsets;
+    const uint8_t *rnglists;
+    // Indexes of the units in the package, empty for .dwo files.
+    _upf_dwp_index cu_index;
+    _upf_dwp_index tu_index;
+} _upf_dwo_file;
+
+// Sections of a split unit, which are in its .dwo file rather than in the module.
+typedef struct {
+    const char *str;
+    // Contributions of the unit to the sections.
+    const uint8_t *str_offsets;
+    const uint8_t *rnglists;
+} _upf_dwo;
+
+// Supplementary file of dwz (.gnu_debugaltlink or .debug_sup), with the
+// partial units and strings shared by several modules.
+typedef struct {
+    const uint8_t *die;
+    size_t die_size;
+    const uint8_t *abbrev;
+    const char *str;
+} _upf_sup_file;
+
+typedef struct {
+    // Path of the separate debug file, or NULL if the module itself has debugging information.
+    const char *path;
     uint8_t *file;
     off_t file_size;
+    // Anonymous mappings with the decompressed sections, and mapped .dwo and supplementary files.
+    _upf_mapping_vec mappings;
 
     bool is64bit;
     uint8_t offset_size;
     uint8_t address_size;
 
+    // Sections which are always needed, thus decompressed right away.
     const uint8_t *die;
     size_t die_size;
     const uint8_t *abbrev;
     const char *str;
-    const char *line_str;
-    const uint8_t *str_offsets;
-    const uint8_t *addr;
-    const uint8_t *rnglists;
+
+    _upf_section line_str;
+    _upf_section str_offsets;
+    _upf_section addr;
+    _upf_section rnglists;
+    _upf_section names;
+    _upf_section aranges;
+    const uint8_t *build_id;
+    size_t build_id_size;
+
+    // Split units are in other files, see _upf_load_split_unit.
+    bool has_skeleton_units;
+    // Package with the split units of all the CUs, see _upf_get_dwp.
+    const _upf_dwo_file *dwp;
+    bool is_dwp_attempted;
+    // Supplementary file named by the module, see _upf_load_sup_file. The file is
+    // NULL if it wasn't found, in which case references to it are errors.
+    const char *sup_name;
+    const _upf_sup_file *sup;
 } _upf_dwarf;
 
-typedef struct {
-    const uint8_t *die;
-    _upf_type type;
-} _upf_type_map_entry;
+_UPF_VECTOR_TYPEDEF(_upf_ctf_record_vec, const uint8_t *);
 
-_UPF_VECTOR_TYPEDEF(_upf_type_map_vec, _upf_type_map_entry);
+// Dictionary of CTF types, either the only one in .ctf, or one of the archive's
+// dictionaries: the parent with the types shared by all the units, and a child
+// for each unit whose types conflict with the ones from other units.
+typedef struct _upf_ctf_dict {
+    const char *str;
+    size_t str_size;
+    // External string table (.dynstr or .strtab) which names with the high bit refer to.
+    const char *ext_str;
+    size_t ext_str_size;
+    // Type records by their IDs without the child flag. ID 0 isn't used.
+    _upf_ctf_record_vec records;
+    // Parent dictionary of the child, or NULL if this is the parent.
+    const struct _upf_ctf_dict *parent;
+} _upf_ctf_dict;
+
+_UPF_VECTOR_TYPEDEF(_upf_ctf_dict_vec, _upf_ctf_dict *);
+
+// Compact Type Format (-gctf), which only has the types, see _upf_parse_ctf.
+typedef struct {
+    _upf_section section;
+    // Dictionaries with the parent first.
+    _upf_ctf_dict_vec dicts;
+    // Dictionary index and ID ((index << 32) | ID) of the type by the hash of its name.
+    _upf_map names;
+    // GCC before 14 nests dimensions of multidimensional arrays in reverse order.
+    bool is_array_reversed;
+} _upf_ctf;
 
 typedef struct {
     const uint8_t *base;
+    const uint8_t *end;
+    // Is the unit from the supplementary file, whose sections are used instead of the module's.
+    bool is_sup;
+    // Arena of the thread that parsed the unit.
+    _upf_arena *arena;
 
-    _upf_abbrev_vec abbrevs;
+    const _upf_abbrev_table *abbrevs;
     _upf_named_type_vec types;
     _upf_function_vec functions;
+    // Index of the first type/function with the name by the hash of its name.
+    _upf_map type_names;
+    _upf_map function_names;
+    // Code ranges of the functions sorted by address.
+    _upf_function_range_vec function_ranges;
 
     uint64_t addr_base;
     uint64_t str_offsets_base;
     uint64_t rnglists_base;
+    // Sections of the split unit, or NULL if the unit isn't split.
+    const _upf_dwo *dwo;
 
     _upf_scope scope;
+    // Flattened scope tree, in which the innermost scope of a PC is found by
+    // binary search over sorted disjoint intervals.
+    _upf_scope_node_vec scope_nodes;
+    _upf_scope_interval_vec scope_intervals;
 } _upf_cu;
 
-_UPF_VECTOR_TYPEDEF(_upf_cu_vec, _upf_cu);
+// Layout of the cache file. All the structures consist of 8-byte fields so
+// that they stay aligned when read directly from the mapped file.
+
+#define _UPF_CACHE_VERSION 2
+#define _UPF_CACHE_MAX_BUILD_ID_SIZE 64
+// Marks references to the strings stored in the cache rather than in the executable.
+#define _UPF_CACHE_STRING_FLAG (1ULL << 63)
+
+typedef struct {
+    uint64_t offset;
+    uint64_t length;
+} _upf_cache_array;
+
+typedef struct {
+    char magic[8];
+    uint64_t version;
+    uint64_t size;
+
+    // Executable for which the cache was created.
+    uint64_t build_id_size;
+    uint8_t build_id[_UPF_CACHE_MAX_BUILD_ID_SIZE];
+    uint64_t file_size;
+    uint64_t die_offset;
+    uint64_t die_size;
+    uint64_t abbrev_offset;
+    uint64_t str_offset;
+
+    uint64_t offset_size;
+    uint64_t address_size;
+    _upf_cache_array units;
+    _upf_cache_array unit_ranges;
+    _upf_cache_array inferred_unit_ranges;
+    _upf_cache_array strings;
+} _upf_cache_header;
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    uint64_t idx;
+} _upf_cache_range;
+
+typedef struct {
+    uint64_t die;
+    uint64_t name;
+} _upf_cache_named_type;
+
+typedef struct {
+    uint64_t name;
+    uint64_t return_type;
+    _upf_cache_array args;
+    uint64_t is_variadic;
+    uint64_t low_pc;
+} _upf_cache_function;
+
+typedef struct {
+    uint64_t parent;
+    _upf_cache_array vars;
+} _upf_cache_scope_node;
+
+typedef struct {
+    uint64_t addr_base;
+    uint64_t str_offsets_base;
+    uint64_t rnglists_base;
+    _upf_cache_array ranges;
+    _upf_cache_array types;
+    _upf_cache_array functions;
+    _upf_cache_array function_ranges;
+    _upf_cache_array scope_nodes;
+    _upf_cache_array scope_intervals;
+} _upf_cache_cu;
+
+typedef struct {
+    uint64_t base;
+    uint64_t die;
+    uint64_t end;
+    uint64_t abbrev;
+    // Offset of the _upf_cache_cu, or 0 if the unit isn't written in C.
+    uint64_t cu;
+} _upf_cache_unit;
+
+_UPF_VECTOR_TYPEDEF(_upf_char_vec, char);
+
+typedef struct {
+    FILE *file;
+    uint64_t size;
+    bool is_failed;
+    // Strings which aren't in the executable, written at the end of the cache.
+    _upf_char_vec strings;
+} _upf_cache_writer;
+
+typedef struct {
+    uint8_t type;
+    const uint8_t *die;
+    const uint8_t *end;
+    uint64_t abbrev_offset;
+    // Identifier which pairs skeleton unit with its split unit.
+    uint64_t dwo_id;
+    // Type units' signature and offset of the type's DIE from the start of the unit.
+    uint64_t type_signature;
+    uint64_t type_offset;
+} _upf_unit_header;
+
+// Unit from .debug_info which is only parsed once it is needed, i.e. when
+// some PC lands in its address ranges.
+typedef struct _upf_unit {
+    const uint8_t *base;
+    const uint8_t *die;
+    const uint8_t *end;
+    const uint8_t *abbrev;
+
+    // Skeleton units of -gsplit-dwarf only have the address ranges, while the
+    // rest is in the split unit from the .dwo file (see _upf_load_split_unit).
+    bool is_skeleton;
+    uint64_t dwo_id;
+    struct _upf_unit *split;
+    // Sections of the split unit, or NULL if the unit isn't split.
+    const _upf_dwo *dwo;
+    // Partial units of dwz can be in the supplementary file.
+    bool is_sup;
+
+    bool is_parsed;
+    _upf_cu *cu;
+    // Parsed unit from the cache file, if there is one.
+    const _upf_cache_cu *cached_cu;
+    // Arena of the CU which is parsed on demand, so that it can be evicted (see _upf_evict_units).
+    _upf_arena arena;
+    // Value of _upf_state.epoch when the CU was last used.
+    uint64_t last_use;
+} _upf_unit;
+
+_UPF_VECTOR_TYPEDEF(_upf_unit_vec, _upf_unit);
+_UPF_VECTOR_TYPEDEF(_upf_unit_ref_vec, _upf_unit *);
+
+typedef struct {
+    uint64_t start;
+    uint64_t end;
+    size_t unit_idx;
+} _upf_unit_range;
+
+_UPF_VECTOR_TYPEDEF(_upf_unit_range_vec, _upf_unit_range);
+
+// Executable or shared library loaded into the process. Its debugging
+// information is parsed once some PC lands in its segments.
+typedef struct {
+    // Path of the file, or "/proc/self/exe" for the executable itself.
+    const char *path;
+    // Difference between the addresses in memory and the ones in the file, i.e. in DWARF.
+    uint8_t *base;
+    // Addresses of the loaded segments.
+    uint64_t start;
+    uint64_t end;
+
+    bool is_init;
+    bool is_init_attempted;
+    _upf_dwarf dwarf;
+    _upf_ctf ctf;
+    _upf_unit_vec units;
+    // Sorted, non-overlapping ranges, which are binary searched for the unit of a PC.
+    _upf_unit_range_vec unit_ranges;
+    // Ranges of the units without low or high PC, which were inferred to extend to the start
+    // or the end of the address space. They overlap other ranges, so they are only scanned
+    // once the PC isn't in any of unit_ranges.
+    _upf_unit_range_vec inferred_unit_ranges;
+    _upf_map abbrev_tables;
+    // Type units (-fdebug-types-section), which aren't parsed as units on their own, but are
+    // referenced by signatures from other units (see _upf_get_ref_die). Units are allocated
+    // one by one, since more of them are added once split units are loaded, while the list
+    // of parsed units points to them.
+    _upf_unit_ref_vec type_units;
+    // Type's DIE by the signature of its type unit.
+    _upf_map type_signatures;
+    // Index of the type unit by its type's DIE.
+    _upf_map type_unit_dies;
+    // Partial units of dwz from the module and the supplementary file, sorted by
+    // their address. Like type units, they are parsed once other units reference them.
+    _upf_unit_vec partial_units;
+#if UPRINTF_INIT_THREADS > 1
+    _upf_arena *thread_arenas;
+#endif
+
+    const uint8_t *cache;
+    size_t cache_size;
+
+    // Arena of everything parsed from the module, including the module itself,
+    // so that all of it is freed at once when the module is unloaded.
+    _upf_arena arena;
+} _upf_module;
+
+_UPF_VECTOR_TYPEDEF(_upf_module_vec, _upf_module *);
 
 // =================== GLOBAL STATE =======================
 
 struct _upf_state {
     bool is_init;
+    bool is_init_attempted;
     _upf_arena arena;
-    _upf_dwarf dwarf;
+    // Arena of the types, which is dropped when memory is trimmed, since they can be rebuilt.
+    _upf_arena types_arena;
+    // Arena of the data of the current call, which is rolled back to the mark at its end.
+    _upf_arena scratch_arena;
+    _upf_arena_mark scratch_mark;
+    // Number of the current call, by which the least recently used CUs are evicted.
+    uint64_t epoch;
+    // Units whose CUs have arenas of their own, i.e. can be evicted.
+    _upf_unit_ref_vec parsed_units;
+
+    // Modules which haven't been freed yet, i.e. weren't unloaded before the last update.
+    _upf_module_vec modules;
+    // Currently loaded modules sorted by their addresses.
+    _upf_module_vec loaded_modules;
+    // Module whose debugging information is being used.
+    _upf_module *module;
+    // Counters of dl_iterate_phdr at the time modules were last updated.
+    unsigned long long modules_adds;
+    unsigned long long modules_subs;
 
     int circular_id;
     _upf_range_vec addresses;
-    _upf_type_map_vec type_map;
-    _upf_cu_vec cus;
+    _upf_type_vec types;
+    // Index of the type in types by its DIE or CTF record.
+    _upf_map type_idxs;
+    // Pools of the types' data, see _upf_type.
+    _upf_member_vec members;
+    _upf_enum_vec enums;
+    _upf_size_t_vec lengths;
+    _upf_uint32_t_vec arg_types;
+    // Members and argument types of the types that are still being parsed, which are
+    // moved to the pools once complete, since nested types would interleave with them.
+    _upf_member_vec member_stack;
+    _upf_uint32_t_vec arg_type_stack;
+    // Names of the types, members and enumerators, which are referenced by offsets.
+    _upf_char_vec names;
+    // Types which aren't from the debugging information and their names, by their hashes.
+    _upf_map synthetic_types;
+    _upf_map synthetic_names;
 
     jmp_buf jmp_buf;
     const char *file;
@@ -624,10 +1175,6 @@ struct _upf_state {
     size_t size;
     char *ptr;
     size_t free;
-
-    _upf_range_vec uprintf_ranges;
-    bool init_pc;
-    uint8_t *pc_base;
 };
 
 static struct _upf_state _upf_state = {0};
@@ -635,24 +1182,74 @@ static struct _upf_state _upf_state = {0};
 // ====================== ARENA ===========================
 
 #define _UPF_INITIAL_ARENA_SIZE 65535
+// Most of the CUs are much smaller than the main arena.
+#define _UPF_INITIAL_UNIT_ARENA_SIZE 4096
+// Most of the modules are never printed from, so their arenas only hold the module itself.
+#define _UPF_INITIAL_MODULE_ARENA_SIZE 4096
+
+// Regions of at least this size are mapped instead of being allocated with malloc,
+// so that their memory is returned to the system as soon as they are freed, and
+// so that they can be backed by huge pages.
+#define _UPF_MAPPED_REGION_SIZE (2 << 20)
+#define _UPF_HUGE_PAGE_SIZE (2 << 20)
+// Regions stop doubling at this size, so that the last region of a big arena isn't mostly empty.
+#define _UPF_MAX_REGION_SIZE (32 << 20)
+
+static uint8_t *_upf_arena_map(size_t capacity) {
+    if (!UPRINTF_HUGE_PAGES) {
+        void *data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | _UPF_MAP_ANONYMOUS, -1, 0);
+        return data == MAP_FAILED ? NULL : (uint8_t *) data;
+    }
+
+    // Huge pages must be aligned, so a larger range is mapped and its unaligned ends are unmapped.
+    uint8_t *mapping = (uint8_t *) mmap(NULL, capacity + _UPF_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                        MAP_PRIVATE | _UPF_MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) return NULL;
+
+    uint8_t *data = (uint8_t *) (((uintptr_t) mapping + _UPF_HUGE_PAGE_SIZE - 1) & ~((uintptr_t) _UPF_HUGE_PAGE_SIZE - 1));
+    if (data > mapping) munmap(mapping, data - mapping);
+    munmap(data + capacity, mapping + _UPF_HUGE_PAGE_SIZE - data);
+    // Advice is only a hint, so it doesn't matter if it fails, e.g. if transparent huge pages are disabled.
+    madvise(data, capacity, _UPF_MADV_HUGEPAGE);
+    return data;
+}
 
 static _upf_arena_region *_upf_arena_alloc_region(size_t capacity) {
-    _upf_arena_region *region = (_upf_arena_region *) malloc(sizeof(*region));
+    _upf_arena_region *region = (_upf_arena_region *) UPRINTF_MALLOC(sizeof(*region));
     if (region == NULL) _UPF_OUT_OF_MEMORY();
-    region->capacity = capacity;
-    region->data = (uint8_t *) malloc(region->capacity * sizeof(*region->data));
+    // Custom allocator gets all of the memory.
+    region->is_mapped = !_UPF_HAS_CUSTOM_ALLOCATOR && capacity >= _UPF_MAPPED_REGION_SIZE;
+    if (region->is_mapped) {
+        size_t page_size = UPRINTF_HUGE_PAGES ? _UPF_HUGE_PAGE_SIZE : (size_t) sysconf(_SC_PAGESIZE);
+        capacity = (capacity + page_size - 1) & ~(page_size - 1);
+        region->data = _upf_arena_map(capacity);
+    } else {
+        region->data = (uint8_t *) UPRINTF_MALLOC(capacity * sizeof(*region->data));
+    }
     if (region->data == NULL) _UPF_OUT_OF_MEMORY();
+    region->capacity = capacity;
     region->length = 0;
     region->next = NULL;
     return region;
 }
 
-static void _upf_arena_init(_upf_arena *a) {
+static void _upf_arena_free_region(_upf_arena_region *region) {
+    _UPF_ASSERT(region != NULL);
+
+    if (region->is_mapped) munmap(region->data, region->capacity);
+    else UPRINTF_FREE(region->data);
+    UPRINTF_FREE(region);
+}
+
+static void _upf_arena_init(_upf_arena *a, size_t capacity) {
     _UPF_ASSERT(a != NULL);
 
-    _upf_arena_region *region = _upf_arena_alloc_region(_UPF_INITIAL_ARENA_SIZE);
+    _upf_arena_region *region = _upf_arena_alloc_region(capacity);
     a->head = region;
     a->tail = region;
+    a->abandoned = 0;
+    a->floor_region = NULL;
+    a->floor_length = 0;
 }
 
 static void *_upf_arena_alloc(_upf_arena *a, size_t size) {
@@ -662,7 +1259,11 @@ static void *_upf_arena_alloc(_upf_arena *a, size_t size) {
     if (alignment > 0) alignment = sizeof(void *) - alignment;
 
     if (alignment + size > a->head->capacity - a->head->length) {
-        _upf_arena_region *region = _upf_arena_alloc_region(a->head->capacity * 2);
+        size_t capacity = a->head->capacity * 2;
+        if (capacity > _UPF_MAX_REGION_SIZE) capacity = _UPF_MAX_REGION_SIZE;
+        // Allocation which doesn't fit even into the doubled region gets one of its own size.
+        if (capacity < size) capacity = size;
+        _upf_arena_region *region = _upf_arena_alloc_region(capacity);
         a->head->next = region;
         a->head = region;
         alignment = 0;
@@ -673,23 +1274,99 @@ static void *_upf_arena_alloc(_upf_arena *a, size_t size) {
     return memory;
 }
 
+// Grows the allocation in place if it is the last one in the head region and the
+// region has enough space left, e.g. for a vector which is filled without other
+// allocations in between.
+static bool _upf_arena_try_extend(_upf_arena *a, void *data, size_t old_size, size_t new_size) {
+    _UPF_ASSERT(a != NULL && a->head != NULL && data != NULL && old_size <= new_size);
+
+    _upf_arena_region *head = a->head;
+    if ((uint8_t *) data + old_size != head->data + head->length) return false;
+    if (new_size - old_size > head->capacity - head->length) return false;
+    // Regions after the floor's one hold only allocations which were made after the mark.
+    if (head == a->floor_region && (uint8_t *) data < head->data + a->floor_length) return false;
+
+    head->length += new_size - old_size;
+    return true;
+}
+
 static void _upf_arena_free(_upf_arena *a) {
     if (a == NULL || a->head == NULL || a->tail == NULL) return;
 
     _upf_arena_region *region = a->tail;
     while (region != NULL) {
         _upf_arena_region *next = region->next;
-
-        free(region->data);
-        free(region);
-
+        _upf_arena_free_region(region);
         region = next;
     }
 
     a->head = NULL;
     a->tail = NULL;
+    a->abandoned = 0;
+    a->floor_region = NULL;
+    a->floor_length = 0;
+}
+
+// Marks the current position, which also becomes the floor of the arena until the rollback.
+static _upf_arena_mark _upf_arena_set_mark(_upf_arena *a) {
+    _UPF_ASSERT(a != NULL && a->head != NULL);
+
+    _upf_arena_mark mark = {
+        .region = a->head,
+        .length = a->head->length,
+        .abandoned = a->abandoned,
+        .floor_region = a->floor_region,
+        .floor_length = a->floor_length,
+    };
+    a->floor_region = a->head;
+    a->floor_length = a->head->length;
+    return mark;
+}
+
+// Frees everything that was allocated after the mark was taken. Vectors from
+// before the mark which grew after it were copied past it, so they must not
+// be used after the rollback.
+static void _upf_arena_rollback(_upf_arena *a, _upf_arena_mark mark) {
+    _UPF_ASSERT(a != NULL && mark.region != NULL && mark.length <= mark.region->length);
+
+    _upf_arena_region *region = mark.region->next;
+    while (region != NULL) {
+        _upf_arena_region *next = region->next;
+        _upf_arena_free_region(region);
+        region = next;
+    }
+
+    mark.region->next = NULL;
+    mark.region->length = mark.length;
+    a->head = mark.region;
+    a->abandoned = mark.abandoned;
+    a->floor_region = mark.floor_region;
+    a->floor_length = mark.floor_length;
+}
+
+// Returns the number of bytes allocated by the arena, including the unused ones.
+static size_t _upf_arena_size(const _upf_arena *a) {
+    _UPF_ASSERT(a != NULL);
+
+    size_t size = 0;
+    for (const _upf_arena_region *region = a->tail; region != NULL; region = region->next) size += region->capacity;
+    return size;
 }
 
+#ifdef UPRINTF_TEST
+// Returns the number of bytes of the arena which can't be used anymore: the
+// abandoned buffers and the space left at the ends of the filled regions.
+static size_t _upf_arena_waste(const _upf_arena *a) {
+    _UPF_ASSERT(a != NULL);
+
+    size_t waste = a->abandoned;
+    for (const _upf_arena_region *region = a->tail; region != NULL && region != a->head; region = region->next) {
+        waste += region->capacity - region->length;
+    }
+    return waste;
+}
+#endif
+
 // Copies [begin, end) to arena-allocated string
 static char *_upf_arena_string(_upf_arena *a, const char *begin, const char *end) {
     _UPF_ASSERT(a != NULL && begin != NULL && end != NULL);
@@ -737,8 +1414,108 @@ static char *_upf_arena_concat2(_upf_arena *a, ...) {
 
 #define _upf_arena_concat(a, ...) _upf_arena_concat2(a, __VA_ARGS__, NULL)
 
+// ===================== HASH MAP =========================
+
+#define _UPF_INITIAL_MAP_CAPACITY 16
+
+static void _upf_map_init(_upf_map *m, _upf_arena *a) {
+    _UPF_ASSERT(m != NULL && a != NULL);
+
+    m->arena = a;
+    m->capacity = 0;
+    m->length = 0;
+    m->entries = NULL;
+}
+
+static uint32_t _upf_map_hash(uint64_t key) {
+    // Fibonacci hashing, spreads pointers and small integers alike.
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+static bool _upf_map_get(const _upf_map *m, uint64_t key, uint64_t *value) {
+    _UPF_ASSERT(m != NULL && key != 0 && value != NULL);
+
+    if (m->capacity == 0) return false;
+
+    uint32_t mask = m->capacity - 1;
+    for (uint32_t i = _upf_map_hash(key) & mask;; i = (i + 1) & mask) {
+        if (m->entries[i].key == 0) return false;
+        if (m->entries[i].key == key) {
+            *value = m->entries[i].value;
+            return true;
+        }
+    }
+}
+
+static void _upf_map_insert(_upf_map_entry *entries, uint32_t capacity, uint64_t key, uint64_t value) {
+    uint32_t mask = capacity - 1;
+    uint32_t i = _upf_map_hash(key) & mask;
+    while (entries[i].key != 0 && entries[i].key != key) i = (i + 1) & mask;
+    entries[i].key = key;
+    entries[i].value = value;
+}
+
+// Sets the value of the key, overwriting the existing one.
+static void _upf_map_set(_upf_map *m, uint64_t key, uint64_t value) {
+    _UPF_ASSERT(m != NULL && key != 0);
+
+    // Keep load factor below 3/4.
+    if (4 * (m->length + 1) > 3 * m->capacity) {
+        uint32_t capacity = m->capacity == 0 ? _UPF_INITIAL_MAP_CAPACITY : m->capacity * 2;
+        _upf_map_entry *entries = (_upf_map_entry *) _upf_arena_alloc(m->arena, capacity * sizeof(*entries));
+        memset(entries, 0, capacity * sizeof(*entries));
+
+        for (uint32_t i = 0; i < m->capacity; i++) {
+            if (m->entries[i].key != 0) _upf_map_insert(entries, capacity, m->entries[i].key, m->entries[i].value);
+        }
+
+        m->arena->abandoned += m->capacity * sizeof(*m->entries);
+        m->capacity = capacity;
+        m->entries = entries;
+    }
+
+    uint64_t old_value;
+    if (!_upf_map_get(m, key, &old_value)) m->length++;
+    _upf_map_insert(m->entries, m->capacity, key, value);
+}
+
+// FNV-1a
+static uint64_t _upf_string_hash(const char *str) {
+    _UPF_ASSERT(str != NULL);
+
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while (*str != '\0') {
+        hash ^= (uint8_t) *str++;
+        hash *= 0x100000001b3ULL;
+    }
+
+    // 0 is reserved for empty entries.
+    return hash == 0 ? 1 : hash;
+}
+
+// Maps name to the index, unless there already is an index for it.
+static void _upf_add_name(_upf_map *names, const char *name, size_t idx) {
+    _UPF_ASSERT(names != NULL && name != NULL);
+
+    uint64_t hash = _upf_string_hash(name);
+    uint64_t old_idx;
+    if (!_upf_map_get(names, hash, &old_idx)) _upf_map_set(names, hash, idx);
+}
+
 // ====================== HELPERS =========================
 
+static const char *_upf_bytes_to_hex(_upf_arena *a, const uint8_t *bytes, size_t size) {
+    _UPF_ASSERT(a != NULL && bytes != NULL);
+
+    char *hex = (char *) _upf_arena_alloc(a, size * 2 + 1);
+    for (size_t i = 0; i < size; i++) {
+        hex[i * 2] = "0123456789abcdef"[bytes[i] >> 4];
+        hex[i * 2 + 1] = "0123456789abcdef"[bytes[i] & 0xf];
+    }
+    hex[size * 2] = '\0';
+    return hex;
+}
+
 // Converts unsigned LEB128 to uint64_t and returns the size of LEB in bytes
 static size_t _upf_uLEB_to_uint64(const uint8_t *leb, uint64_t *result) {
     _UPF_ASSERT(leb != NULL && result != NULL);
@@ -746,17 +1523,34 @@ static size_t _upf_uLEB_to_uint64(const uint8_t *leb, uint64_t *result) {
     static const uint8_t BITS_MASK = 0x7f;      // 01111111
     static const uint8_t CONTINUE_MASK = 0x80;  // 10000000
 
-    size_t i = 0;
-    int shift = 0;
+    // Almost all the values in DWARF, e.g. abbreviation codes, sizes and indexes,
+    // fit in one or two bytes, so these are decoded without entering the loop.
+    // Bytes are only read while the previous one has the continuation bit, thus
+    // it never reads past the end of the value.
+    uint8_t b = leb[0];
+    if ((b & CONTINUE_MASK) == 0) {
+        *result = b;
+        return 1;
+    }
+    uint64_t value = b & BITS_MASK;
 
-    *result = 0;
-    while (true) {
-        uint8_t b = leb[i++];
-        *result |= (((uint64_t) (b & BITS_MASK)) << shift);
-        if ((b & CONTINUE_MASK) == 0) break;
-        shift += 7;
+    b = leb[1];
+    value |= ((uint64_t) (b & BITS_MASK)) << 7;
+    if ((b & CONTINUE_MASK) == 0) {
+        *result = value;
+        return 2;
     }
 
+    size_t i = 2;
+    int shift = 14;
+    do {
+        b = leb[i++];
+        // Bits past the 64th can only come from overlong encodings, which are ignored.
+        if (shift < 64) value |= ((uint64_t) (b & BITS_MASK)) << shift;
+        shift += 7;
+    } while (b & CONTINUE_MASK);
+
+    *result = value;
     return i;
 }
 
@@ -768,40 +1562,102 @@ static size_t _upf_LEB_to_int64(const uint8_t *leb, int64_t *result) {
     static const uint8_t CONTINUE_MASK = 0x80;  // 10000000
     static const uint8_t SIGN_MASK = 0x40;      // 01000000
 
+    // Fast path for a single byte, see _upf_uLEB_to_uint64.
+    uint8_t b = leb[0];
+    if ((b & CONTINUE_MASK) == 0) {
+        *result = (int64_t) b - ((b & SIGN_MASK) << 1);
+        return 1;
+    }
+
     size_t i = 0;
-    uint8_t b = 0;
     size_t shift = 0;
-
-    *result = 0;
-    while (true) {
+    uint64_t value = 0;
+    do {
         b = leb[i++];
-        *result |= (((uint64_t) (b & BITS_MASK)) << shift);
+        if (shift < 64) value |= ((uint64_t) (b & BITS_MASK)) << shift;
         shift += 7;
-        if ((b & CONTINUE_MASK) == 0) break;
-    }
-    if ((shift < sizeof(*result) * 8) && (b & SIGN_MASK)) *result |= -(1 << shift);
+    } while (b & CONTINUE_MASK);
+    if (shift < 64 && (b & SIGN_MASK)) value |= UINT64_MAX << shift;
 
+    memcpy(result, &value, sizeof(*result));
     return i;
 }
 
 static const _upf_abbrev *_upf_get_abbrev(const _upf_cu *cu, size_t code) {
-    _UPF_ASSERT(cu != NULL && code > 0 && code - 1 < cu->abbrevs.length);
-    return &cu->abbrevs.data[code - 1];
+    _UPF_ASSERT(cu != NULL && code > 0);
+
+    const _upf_abbrev_table *table = cu->abbrevs;
+    if (table->is_dense) {
+        _UPF_ASSERT(code - 1 < table->abbrevs.length);
+        return &table->abbrevs.data[code - 1];
+    }
+
+    uint64_t idx;
+    if (!_upf_map_get(&table->code_to_idx, code, &idx)) _UPF_ERROR("Unable to find abbreviation with code %lu.", code);
+    return &table->abbrevs.data[idx];
 }
 
-static const _upf_type *_upf_get_type(size_t type_idx) {
-    _UPF_ASSERT(type_idx != _UPF_INVALID && type_idx < _upf_state.type_map.length);
-    return &_upf_state.type_map.data[type_idx].type;
+static const _upf_type *_upf_get_type(uint32_t type_idx) {
+    _UPF_ASSERT(type_idx < _upf_state.types.length);
+    return &_upf_state.types.data[type_idx];
 }
 
-static bool _upf_is_in_range(uint64_t pc, _upf_range_vec ranges) {
-    for (size_t i = 0; i < ranges.length; i++) {
-        if (ranges.data[i].start <= pc && pc < ranges.data[i].end) return true;
-    }
-    return false;
+static const char *_upf_get_name(uint32_t offset) {
+    _UPF_ASSERT(offset < _upf_state.names.length);
+    return offset == 0 ? NULL : &_upf_state.names.data[offset];
 }
 
-static bool _upf_is_primitive(const _upf_type *type) {
+// Names aren't deduplicated, since a map of them takes more memory than the
+// duplicates, most of which are avoided by copying offsets between types.
+static uint32_t _upf_add_type_name(const char *name) {
+    if (name == NULL) return 0;
+
+    uint32_t offset = _upf_state.names.length;
+    if (offset + strlen(name) >= _UPF_MAX_VECTOR_CAPACITY) _UPF_ERROR("Names of the types don't fit in 2 GiB.");
+    do {
+        _UPF_VECTOR_PUSH(&_upf_state.names, *name);
+    } while (*name++ != '\0');
+
+    return offset;
+}
+
+// Unlike the names from the debugging information, names of the types which are
+// created for each call are deduplicated, so that repeated calls don't add them again.
+static uint32_t _upf_intern_type_name(const char *name) {
+    if (name == NULL) return 0;
+
+    uint64_t hash = _upf_string_hash(name);
+    uint64_t offset;
+    bool is_found = _upf_map_get(&_upf_state.synthetic_names, hash, &offset);
+    if (is_found && strcmp(_upf_get_name(offset), name) == 0) return offset;
+
+    offset = _upf_add_type_name(name);
+    // On a collision the first name keeps the entry, and the second one is simply added each time.
+    if (!is_found) _upf_map_set(&_upf_state.synthetic_names, hash, offset);
+    return offset;
+}
+
+static const _upf_member *_upf_get_member(const _upf_type *type, uint32_t i) {
+    _UPF_ASSERT(type != NULL && (type->kind == _UPF_TK_STRUCT || type->kind == _UPF_TK_UNION) && i < type->count);
+    return &_upf_state.members.data[type->first + i];
+}
+
+static const _upf_enum *_upf_get_enum(const _upf_type *type, uint32_t i) {
+    _UPF_ASSERT(type != NULL && type->kind == _UPF_TK_ENUM && i < type->count);
+    return &_upf_state.enums.data[type->first + i];
+}
+
+static size_t _upf_get_length(const _upf_type *type, uint32_t i) {
+    _UPF_ASSERT(type != NULL && type->kind == _UPF_TK_ARRAY && i < type->count);
+    return _upf_state.lengths.data[type->first + i];
+}
+
+static uint32_t _upf_get_function_arg_type(const _upf_type *type, uint32_t i) {
+    _UPF_ASSERT(type != NULL && type->kind == _UPF_TK_FUNCTION && i < type->count);
+    return _upf_state.arg_types.data[type->first + i];
+}
+
+static bool _upf_is_primitive(const _upf_type *type) {
     _UPF_ASSERT(type != NULL);
 
     switch (type->kind) {
@@ -832,13 +1688,348 @@ static bool _upf_is_primitive(const _upf_type *type) {
     _UPF_UNREACHABLE();
 }
 
+// ===================== INFLATE ==========================
+
+// Decompressor of zlib streams (RFC 1950, RFC 1951) used for debug sections
+// compressed with -gz, see _upf_get_section. Codes are looked up by their first
+// _UPF_INFLATE_FAST_BITS bits, and the rare longer ones are decoded bit by bit.
+
+#define _UPF_INFLATE_FAST_BITS 9
+#define _UPF_INFLATE_MAX_BITS 15
+
+typedef struct {
+    // Number of codes of each length.
+    uint16_t counts[_UPF_INFLATE_MAX_BITS + 1];
+    // Symbols sorted by their codes.
+    uint16_t symbols[288];
+    // Symbol and length of the code (symbol << 4 | length) indexed by the next
+    // bits of the input, or 0 if the code is longer than _UPF_INFLATE_FAST_BITS.
+    uint16_t fast[1 << _UPF_INFLATE_FAST_BITS];
+} _upf_huffman;
+
+typedef struct {
+    const char *name;
+    const uint8_t *in;
+    const uint8_t *in_end;
+    // Bits of the input which have been read but not consumed yet, starting from the lowest one.
+    uint64_t bits;
+    int bits_count;
+    uint8_t *out;
+    size_t out_length;
+    size_t out_size;
+} _upf_inflater;
+
+#define _UPF_INFLATE_ERROR(inflater) _UPF_ERROR("Unable to decompress %s: invalid zlib stream.", (inflater)->name)
+
+static void _upf_inflate_refill(_upf_inflater *i) {
+    while (i->bits_count <= 56 && i->in < i->in_end) {
+        i->bits |= ((uint64_t) *i->in++) << i->bits_count;
+        i->bits_count += 8;
+    }
+}
+
+static uint32_t _upf_inflate_bits(_upf_inflater *i, int count) {
+    if (i->bits_count < count) {
+        _upf_inflate_refill(i);
+        if (i->bits_count < count) _UPF_INFLATE_ERROR(i);
+    }
+
+    uint32_t result = i->bits & ((1ULL << count) - 1);
+    i->bits >>= count;
+    i->bits_count -= count;
+    return result;
+}
+
+static void _upf_inflate_build(_upf_inflater *i, _upf_huffman *h, const uint8_t *lengths, size_t count) {
+    _UPF_ASSERT(i != NULL && h != NULL && lengths != NULL && count <= sizeof(h->symbols) / sizeof(*h->symbols));
+
+    memset(h->counts, 0, sizeof(h->counts));
+    for (size_t s = 0; s < count; s++) h->counts[lengths[s]]++;
+    h->counts[0] = 0;
+
+    // Incomplete codes are allowed, as long as the missing codes aren't used.
+    int left = 1;
+    for (int length = 1; length <= _UPF_INFLATE_MAX_BITS; length++) {
+        left = (left << 1) - h->counts[length];
+        if (left < 0) _UPF_INFLATE_ERROR(i);
+    }
+
+    uint16_t offsets[_UPF_INFLATE_MAX_BITS + 1];
+    offsets[1] = 0;
+    for (int length = 1; length < _UPF_INFLATE_MAX_BITS; length++) offsets[length + 1] = offsets[length] + h->counts[length];
+    for (size_t s = 0; s < count; s++) {
+        if (lengths[s] != 0) h->symbols[offsets[lengths[s]]++] = s;
+    }
+
+    // Codes are packed starting from their most significant bit, so the table
+    // is indexed by the reversed code.
+    memset(h->fast, 0, sizeof(h->fast));
+    uint32_t code = 0;
+    size_t idx = 0;
+    for (int length = 1; length <= _UPF_INFLATE_FAST_BITS; length++) {
+        for (uint16_t j = 0; j < h->counts[length]; j++) {
+            uint32_t reversed = 0;
+            for (int bit = 0; bit < length; bit++) reversed |= ((code >> bit) & 1) << (length - bit - 1);
+
+            uint16_t entry = (h->symbols[idx] << 4) | length;
+            for (uint32_t k = reversed; k < (1U << _UPF_INFLATE_FAST_BITS); k += 1U << length) h->fast[k] = entry;
+
+            code++;
+            idx++;
+        }
+        code <<= 1;
+    }
+}
+
+static uint32_t _upf_inflate_decode(_upf_inflater *i, const _upf_huffman *h) {
+    if (i->bits_count < _UPF_INFLATE_MAX_BITS) _upf_inflate_refill(i);
+
+    uint16_t entry = h->fast[i->bits & ((1U << _UPF_INFLATE_FAST_BITS) - 1)];
+    if (entry != 0) {
+        int length = entry & 0xf;
+        if (length > i->bits_count) _UPF_INFLATE_ERROR(i);
+        i->bits >>= length;
+        i->bits_count -= length;
+        return entry >> 4;
+    }
+
+    int code = 0;
+    int first = 0;
+    int idx = 0;
+    for (int length = 1; length <= _UPF_INFLATE_MAX_BITS; length++) {
+        code |= _upf_inflate_bits(i, 1);
+        int count = h->counts[length];
+        if (code < first + count) return h->symbols[idx + code - first];
+        idx += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+    _UPF_INFLATE_ERROR(i);
+}
+
+static void _upf_inflate_stored(_upf_inflater *i) {
+    _upf_inflate_bits(i, i->bits_count % 8);
+    uint32_t length = _upf_inflate_bits(i, 16);
+    uint32_t length_complement = _upf_inflate_bits(i, 16);
+    if (length != (~length_complement & 0xffff) || length > i->out_size - i->out_length) _UPF_INFLATE_ERROR(i);
+
+    // Bytes which have already been read into the bit buffer are consumed first.
+    while (length > 0 && i->bits_count > 0) {
+        i->out[i->out_length++] = _upf_inflate_bits(i, 8);
+        length--;
+    }
+
+    if (length > (size_t) (i->in_end - i->in)) _UPF_INFLATE_ERROR(i);
+    memcpy(i->out + i->out_length, i->in, length);
+    i->in += length;
+    i->out_length += length;
+}
+
+static void _upf_inflate_codes(_upf_inflater *i, const _upf_huffman *lengths, const _upf_huffman *distances) {
+    static const uint16_t LENGTH_BASE[] = {3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+                                           31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    static const uint8_t LENGTH_EXTRA[] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    static const uint16_t DISTANCE_BASE[] = {1,   2,   3,   4,   5,   7,    9,    13,   17,   25,   33,   49,   65,    97,    129,
+                                             193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    static const uint8_t DISTANCE_EXTRA[] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    while (true) {
+        uint32_t symbol = _upf_inflate_decode(i, lengths);
+        if (symbol < 256) {
+            if (i->out_length == i->out_size) _UPF_INFLATE_ERROR(i);
+            i->out[i->out_length++] = symbol;
+            continue;
+        }
+        if (symbol == 256) return;
+
+        symbol -= 257;
+        if (symbol >= sizeof(LENGTH_BASE) / sizeof(*LENGTH_BASE)) _UPF_INFLATE_ERROR(i);
+        size_t length = LENGTH_BASE[symbol] + _upf_inflate_bits(i, LENGTH_EXTRA[symbol]);
+
+        symbol = _upf_inflate_decode(i, distances);
+        if (symbol >= sizeof(DISTANCE_BASE) / sizeof(*DISTANCE_BASE)) _UPF_INFLATE_ERROR(i);
+        size_t distance = DISTANCE_BASE[symbol] + _upf_inflate_bits(i, DISTANCE_EXTRA[symbol]);
+
+        if (distance > i->out_length || length > i->out_size - i->out_length) _UPF_INFLATE_ERROR(i);
+        uint8_t *out = i->out + i->out_length;
+        if (distance >= length) {
+            memcpy(out, out - distance, length);
+        } else {
+            // Overlapping copy repeats the last distance bytes.
+            for (size_t j = 0; j < length; j++) out[j] = out[j - distance];
+        }
+        i->out_length += length;
+    }
+}
+
+static void _upf_inflate_fixed(_upf_inflater *i) {
+    uint8_t lengths[288];
+    _upf_huffman length_codes, distance_codes;
+
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 256 - 144);
+    memset(lengths + 256, 7, 280 - 256);
+    memset(lengths + 280, 8, 288 - 280);
+    _upf_inflate_build(i, &length_codes, lengths, 288);
+
+    memset(lengths, 5, 30);
+    _upf_inflate_build(i, &distance_codes, lengths, 30);
+
+    _upf_inflate_codes(i, &length_codes, &distance_codes);
+}
+
+static void _upf_inflate_dynamic(_upf_inflater *i) {
+    static const uint8_t ORDER[] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+    size_t lengths_count = _upf_inflate_bits(i, 5) + 257;
+    size_t distances_count = _upf_inflate_bits(i, 5) + 1;
+    size_t code_lengths_count = _upf_inflate_bits(i, 4) + 4;
+    if (lengths_count > 286 || distances_count > 30) _UPF_INFLATE_ERROR(i);
+
+    uint8_t lengths[286 + 30];
+    memset(lengths, 0, sizeof(ORDER));
+    for (size_t j = 0; j < code_lengths_count; j++) lengths[ORDER[j]] = _upf_inflate_bits(i, 3);
+
+    _upf_huffman length_codes, distance_codes;
+    _upf_inflate_build(i, &length_codes, lengths, sizeof(ORDER));
+
+    size_t count = lengths_count + distances_count;
+    size_t idx = 0;
+    while (idx < count) {
+        uint32_t symbol = _upf_inflate_decode(i, &length_codes);
+        if (symbol < 16) {
+            lengths[idx++] = symbol;
+            continue;
+        }
+
+        uint8_t length = 0;
+        size_t repeat;
+        if (symbol == 16) {
+            if (idx == 0) _UPF_INFLATE_ERROR(i);
+            length = lengths[idx - 1];
+            repeat = 3 + _upf_inflate_bits(i, 2);
+        } else if (symbol == 17) {
+            repeat = 3 + _upf_inflate_bits(i, 3);
+        } else {
+            repeat = 11 + _upf_inflate_bits(i, 7);
+        }
+        if (repeat > count - idx) _UPF_INFLATE_ERROR(i);
+        memset(lengths + idx, length, repeat);
+        idx += repeat;
+    }
+    // End of block must be encodable.
+    if (lengths[256] == 0) _UPF_INFLATE_ERROR(i);
+
+    _upf_inflate_build(i, &length_codes, lengths, lengths_count);
+    _upf_inflate_build(i, &distance_codes, lengths + lengths_count, distances_count);
+
+    _upf_inflate_codes(i, &length_codes, &distance_codes);
+}
+
+// Decompresses zlib stream into the buffer, which must be exactly the size of the uncompressed data.
+static void _upf_inflate(const char *name, const uint8_t *in, size_t in_size, uint8_t *out, size_t out_size) {
+    _UPF_ASSERT(name != NULL && in != NULL && out != NULL);
+
+    _upf_inflater i = {
+        .name = name,
+        .in = in,
+        .in_end = in + in_size,
+        .bits = 0,
+        .bits_count = 0,
+        .out = out,
+        .out_length = 0,
+        .out_size = out_size,
+    };
+
+    uint32_t method = _upf_inflate_bits(&i, 8);
+    uint32_t flags = _upf_inflate_bits(&i, 8);
+    // Only deflate without preset dictionary is allowed.
+    if ((method & 0xf) != 8 || (method >> 4) > 7 || ((method << 8) | flags) % 31 != 0 || (flags & 0x20)) _UPF_INFLATE_ERROR(&i);
+
+    bool is_last;
+    do {
+        is_last = _upf_inflate_bits(&i, 1);
+        switch (_upf_inflate_bits(&i, 2)) {
+            case 0:
+                _upf_inflate_stored(&i);
+                break;
+            case 1:
+                _upf_inflate_fixed(&i);
+                break;
+            case 2:
+                _upf_inflate_dynamic(&i);
+                break;
+            default:
+                _UPF_INFLATE_ERROR(&i);
+        }
+    } while (!is_last);
+
+    // Adler-32 checksum which follows the data isn't verified.
+    if (i.out_length != out_size) _UPF_INFLATE_ERROR(&i);
+}
+
+// Hints the kernel how the range of the mapped file is going to be read. The
+// range is extended to whole pages, except for MADV_DONTNEED, which only drops
+// the pages that lie inside of it. Since pages of the file are never written
+// to, dropped pages are read again if they are needed after all.
+static void _upf_advise(const void *data, size_t size, int advice) {
+    if (data == NULL || size == 0) return;
+
+    uintptr_t page_size = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t) data;
+    uintptr_t end = start + size;
+    if (advice == _UPF_MADV_DONTNEED) {
+        start = (start + page_size - 1) & ~(page_size - 1);
+        end &= ~(page_size - 1);
+    } else {
+        start &= ~(page_size - 1);
+        end = (end + page_size - 1) & ~(page_size - 1);
+    }
+    // Advice is only a hint, so it doesn't matter if it fails.
+    if (start < end) madvise((void *) start, end - start, advice);
+}
+
+// Returns data of the section, decompressing it on the first call. Returns NULL
+// if the executable doesn't have such section.
+static const uint8_t *_upf_get_section(_upf_section *section) {
+    _UPF_ASSERT(section != NULL);
+
+    if (section->compressed == NULL) return section->data;
+
+    const Elf64_Shdr *header = section->compressed;
+    const uint8_t *data = section->data;
+
+    Elf64_Chdr compression;
+    memcpy(&compression, data, sizeof(compression));
+    if (compression.ch_type != ELFCOMPRESS_ZLIB) {
+        _UPF_ERROR("Section %s uses unsupported compression. Only zlib is supported, i.e. -gz=zlib.", section->name);
+    }
+
+    // Decompressed sections are kept separately from the arena so that the large
+    // buffers are given back to the system as a whole in _upf_fini.
+    uint8_t *out = (uint8_t *) mmap(NULL, section->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | _UPF_MAP_ANONYMOUS, -1, 0);
+    if (out == MAP_FAILED) _UPF_OUT_OF_MEMORY();
+    _upf_mapping mapping = {
+        .data = out,
+        .size = section->size,
+    };
+    _UPF_VECTOR_PUSH(&_upf_state.module->dwarf.mappings, mapping);
+
+    _upf_inflate(section->name, data + sizeof(compression), header->sh_size - sizeof(compression), out, section->size);
+    _upf_advise(data, header->sh_size, _UPF_MADV_DONTNEED);
+
+    section->data = out;
+    section->compressed = NULL;
+    return section->data;
+}
+
 // ====================== DWARF ===========================
 
 static uint64_t _upf_offset_cast(const uint8_t *die) {
     _UPF_ASSERT(die != NULL);
 
     uint64_t offset = 0;
-    memcpy(&offset, die, _upf_state.dwarf.offset_size);
+    memcpy(&offset, die, _upf_state.module->dwarf.offset_size);
     return offset;
 }
 
@@ -846,16 +2037,15 @@ static uint64_t _upf_address_cast(const uint8_t *die) {
     _UPF_ASSERT(die != NULL);
 
     uint64_t address = 0;
-    memcpy(&address, die, _upf_state.dwarf.address_size);
+    memcpy(&address, die, _upf_state.module->dwarf.address_size);
     return address;
 }
 
-static size_t _upf_get_attr_size(const uint8_t *die, uint64_t form) {
-    _UPF_ASSERT(die != NULL);
-
+// Returns size of the value if it depends only on the form, otherwise _UPF_INVALID.
+static size_t _upf_get_fixed_attr_size(uint64_t form) {
     switch (form) {
         case _UPF_DW_FORM_addr:
-            return _upf_state.dwarf.address_size;
+            return _upf_state.module->dwarf.address_size;
         case _UPF_DW_FORM_strx1:
         case _UPF_DW_FORM_addrx1:
         case _UPF_DW_FORM_flag:
@@ -883,6 +2073,29 @@ static size_t _upf_get_attr_size(const uint8_t *die, uint64_t form) {
             return 8;
         case _UPF_DW_FORM_data16:
             return 16;
+        case _UPF_DW_FORM_line_strp:
+        case _UPF_DW_FORM_strp_sup:
+        case _UPF_DW_FORM_sec_offset:
+        case _UPF_DW_FORM_ref_addr:
+        case _UPF_DW_FORM_strp:
+        case _UPF_DW_FORM_GNU_ref_alt:
+        case _UPF_DW_FORM_GNU_strp_alt:
+            return _upf_state.module->dwarf.offset_size;
+        case _UPF_DW_FORM_flag_present:
+        case _UPF_DW_FORM_implicit_const:
+            return 0;
+        default:
+            return _UPF_INVALID;
+    }
+}
+
+static size_t _upf_get_attr_size(const uint8_t *die, uint64_t form) {
+    _UPF_ASSERT(die != NULL);
+
+    size_t fixed_size = _upf_get_fixed_attr_size(form);
+    if (fixed_size != _UPF_INVALID) return fixed_size;
+
+    switch (form) {
         case _UPF_DW_FORM_block1: {
             uint8_t length;
             memcpy(&length, die, sizeof(length));
@@ -919,24 +2132,42 @@ static size_t _upf_get_attr_size(const uint8_t *die, uint64_t form) {
             size_t leb_size = _upf_uLEB_to_uint64(die, &length);
             return leb_size + length;
         } break;
-        case _UPF_DW_FORM_line_strp:
-        case _UPF_DW_FORM_strp_sup:
-        case _UPF_DW_FORM_sec_offset:
-        case _UPF_DW_FORM_ref_addr:
-        case _UPF_DW_FORM_strp:
-            return _upf_state.dwarf.offset_size;
         case _UPF_DW_FORM_indirect: {
             uint64_t form;
             size_t offset = _upf_uLEB_to_uint64(die, &form);
-            return _upf_get_attr_size(die + offset, form);
+            return offset + _upf_get_attr_size(die + offset, form);
         } break;
-        case _UPF_DW_FORM_flag_present:
-        case _UPF_DW_FORM_implicit_const:
-            return 0;
     }
     _UPF_UNREACHABLE();
 }
 
+// Returns pointer to the value of the next attribute.
+static const uint8_t *_upf_skip_attr(const uint8_t *die, _upf_attr attr) {
+    _UPF_ASSERT(die != NULL);
+
+    if (attr.size != _UPF_INVALID) return die + attr.size;
+    return die + _upf_get_attr_size(die, attr.form);
+}
+
+// Finds the attribute by its name and returns pointer to its value, or NULL if
+// the DIE doesn't have it. `die` must point to the first attribute.
+static const uint8_t *_upf_find_attr(const uint8_t *die, const _upf_abbrev *abbrev, uint64_t name, _upf_attr *attr) {
+    _UPF_ASSERT(die != NULL && abbrev != NULL && attr != NULL);
+
+    for (size_t i = 0; i < abbrev->attrs.length; i++) {
+        if (abbrev->attrs.data[i].name != name) continue;
+
+        *attr = abbrev->attrs.data[i];
+        if (attr->offset != _UPF_INVALID) return die + attr->offset;
+
+        size_t j = abbrev->first_variable_attr;
+        die += abbrev->attrs.data[j].offset;
+        for (; j < i; j++) die = _upf_skip_attr(die, abbrev->attrs.data[j]);
+        return die;
+    }
+    return NULL;
+}
+
 static uint64_t _upf_get_x_offset(const uint8_t *die, uint64_t form) {
     _UPF_ASSERT(die != NULL);
 
@@ -966,15 +2197,30 @@ static uint64_t _upf_get_x_offset(const uint8_t *die, uint64_t form) {
     _UPF_UNREACHABLE();
 }
 
+static const _upf_sup_file *_upf_get_sup_file(void) {
+    const _upf_dwarf *dwarf = &_upf_state.module->dwarf;
+    if (dwarf->sup == NULL) {
+        _UPF_ERROR("Unable to find supplementary file \"%s\" of the executable created by dwz.",
+                   dwarf->sup_name == NULL ? "" : dwarf->sup_name);
+    }
+    return dwarf->sup;
+}
+
 static const char *_upf_get_str(const _upf_cu *cu, const uint8_t *die, uint64_t form) {
     _UPF_ASSERT(cu != NULL && die != NULL);
 
     switch (form) {
         case _UPF_DW_FORM_strp:
-            return _upf_state.dwarf.str + _upf_offset_cast(die);
-        case _UPF_DW_FORM_line_strp:
-            _UPF_ASSERT(_upf_state.dwarf.line_str != NULL);
-            return _upf_state.dwarf.line_str + _upf_offset_cast(die);
+            if (cu->is_sup) return _upf_get_sup_file()->str + _upf_offset_cast(die);
+            return _upf_state.module->dwarf.str + _upf_offset_cast(die);
+        case _UPF_DW_FORM_strp_sup:
+        case _UPF_DW_FORM_GNU_strp_alt:
+            return _upf_get_sup_file()->str + _upf_offset_cast(die);
+        case _UPF_DW_FORM_line_strp: {
+            const char *line_str = (const char *) _upf_get_section(&_upf_state.module->dwarf.line_str);
+            _UPF_ASSERT(line_str != NULL);
+            return line_str + _upf_offset_cast(die);
+        }
         case _UPF_DW_FORM_string:
             return (const char *) die;
         case _UPF_DW_FORM_strx:
@@ -982,9 +2228,17 @@ static const char *_upf_get_str(const _upf_cu *cu, const uint8_t *die, uint64_t
         case _UPF_DW_FORM_strx2:
         case _UPF_DW_FORM_strx3:
         case _UPF_DW_FORM_strx4: {
-            _UPF_ASSERT(_upf_state.dwarf.str_offsets != NULL && cu->str_offsets_base != _UPF_INVALID);
-            uint64_t offset = _upf_get_x_offset(die, form) * _upf_state.dwarf.offset_size;
-            return _upf_state.dwarf.str + _upf_offset_cast(_upf_state.dwarf.str_offsets + cu->str_offsets_base + offset);
+            const char *str = _upf_state.module->dwarf.str;
+            const uint8_t *str_offsets = NULL;
+            if (cu->dwo != NULL) {
+                str = cu->dwo->str;
+                str_offsets = cu->dwo->str_offsets;
+            } else {
+                str_offsets = _upf_get_section(&_upf_state.module->dwarf.str_offsets);
+            }
+            _UPF_ASSERT(str != NULL && str_offsets != NULL && cu->str_offsets_base != _UPF_INVALID);
+            uint64_t offset = _upf_get_x_offset(die, form) * _upf_state.module->dwarf.offset_size;
+            return str + _upf_offset_cast(str_offsets + cu->str_offsets_base + offset);
         }
     }
     _UPF_UNREACHABLE();
@@ -1005,7 +2259,78 @@ static uint64_t _upf_get_ref(const uint8_t *die, uint64_t form) {
             _upf_uLEB_to_uint64(die, &ref);
             return ref;
     }
-    _UPF_ERROR("Only references within single compilation unit are supported.");
+    _UPF_ERROR("Found unsupported reference form (0x%lx).", form);
+}
+
+// Returns the DIE which the reference points to: in the same unit, in the type
+// unit with the signature for DW_FORM_ref_sig8, or in any unit of the module or
+// its supplementary file for the references that dwz creates.
+static const uint8_t *_upf_get_ref_die(const _upf_cu *cu, const uint8_t *die, uint64_t form) {
+    _UPF_ASSERT(cu != NULL && die != NULL);
+
+    switch (form) {
+        case _UPF_DW_FORM_ref_sig8: {
+            uint64_t signature, type_die;
+            memcpy(&signature, die, sizeof(signature));
+            if (signature == 0 || !_upf_map_get(&_upf_state.module->type_signatures, signature, &type_die)) {
+                _UPF_ERROR("Unable to find type unit with signature 0x%016lx.", signature);
+            }
+            return (const uint8_t *) type_die;
+        }
+        case _UPF_DW_FORM_ref_addr:
+            if (cu->is_sup) return _upf_get_sup_file()->die + _upf_offset_cast(die);
+            return _upf_state.module->dwarf.die + _upf_offset_cast(die);
+        case _UPF_DW_FORM_GNU_ref_alt:
+            return _upf_get_sup_file()->die + _upf_offset_cast(die);
+        case _UPF_DW_FORM_ref_sup4: {
+            uint32_t offset;
+            memcpy(&offset, die, sizeof(offset));
+            return _upf_get_sup_file()->die + offset;
+        }
+        case _UPF_DW_FORM_ref_sup8: {
+            uint64_t offset;
+            memcpy(&offset, die, sizeof(offset));
+            return _upf_get_sup_file()->die + offset;
+        }
+    }
+    return cu->base + _upf_get_ref(die, form);
+}
+
+static const _upf_cu *_upf_get_cu_root(_upf_unit *unit);
+
+static _upf_unit *_upf_find_partial_unit(const uint8_t *die) {
+    _upf_unit_vec units = _upf_state.module->partial_units;
+
+    size_t low = 0, high = units.length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (units.data[mid].base <= die) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0 || die >= units.data[low - 1].end) return NULL;
+
+    return &units.data[low - 1];
+}
+
+// Returns CU of the unit with the DIE, which is another unit than the given one
+// if the DIE was referenced from there, e.g. a type from a type unit or a partial unit.
+static const _upf_cu *_upf_get_die_cu(const _upf_cu *cu, const uint8_t *die) {
+    _UPF_ASSERT(cu != NULL && die != NULL);
+
+    if (cu->base <= die && die < cu->end) return cu;
+
+    _upf_unit *unit = NULL;
+    uint64_t type_unit_idx;
+    if (_upf_map_get(&_upf_state.module->type_unit_dies, (uint64_t) die, &type_unit_idx)) {
+        unit = _upf_state.module->type_units.data[type_unit_idx];
+    } else {
+        unit = _upf_find_partial_unit(die);
+    }
+    if (unit == NULL) _UPF_ERROR("Unable to find unit of the referenced DIE. References between compilation units aren't supported.");
+
+    const _upf_cu *result = _upf_get_cu_root(unit);
+    if (result == NULL) _UPF_ERROR("Referenced unit isn't written in C.");
+    return result;
 }
 
 static bool _upf_is_data(uint64_t form) {
@@ -1079,9 +2404,10 @@ static uint64_t _upf_get_addr(const _upf_cu *cu, const uint8_t *die, uint64_t fo
         case _UPF_DW_FORM_addrx3:
         case _UPF_DW_FORM_addrx4:
         case _UPF_DW_FORM_addrx: {
-            _UPF_ASSERT(_upf_state.dwarf.addr != NULL);
-            uint64_t offset = cu->addr_base + _upf_get_x_offset(die, form) * _upf_state.dwarf.address_size;
-            return _upf_address_cast(_upf_state.dwarf.addr + offset);
+            const uint8_t *addr = _upf_get_section(&_upf_state.module->dwarf.addr);
+            _UPF_ASSERT(addr != NULL);
+            uint64_t offset = cu->addr_base + _upf_get_x_offset(die, form) * _upf_state.module->dwarf.address_size;
+            return _upf_address_cast(addr + offset);
         }
     }
     _UPF_UNREACHABLE();
@@ -1090,9 +2416,11 @@ static uint64_t _upf_get_addr(const _upf_cu *cu, const uint8_t *die, uint64_t fo
 static const uint8_t *_upf_skip_die(const uint8_t *die, const _upf_abbrev *abbrev) {
     _UPF_ASSERT(die != NULL && abbrev != NULL);
 
-    for (size_t i = 0; i < abbrev->attrs.length; i++) {
-        die += _upf_get_attr_size(die, abbrev->attrs.data[i].form);
-    }
+    if (abbrev->size != _UPF_INVALID) return die + abbrev->size;
+
+    size_t i = abbrev->first_variable_attr;
+    die += abbrev->attrs.data[i].offset;
+    for (; i < abbrev->attrs.length; i++) die = _upf_skip_attr(die, abbrev->attrs.data[i]);
 
     return die;
 }
@@ -1190,41 +2518,96 @@ static int _upf_get_type_modifier(uint64_t tag) {
     _UPF_UNREACHABLE();
 }
 
-static _upf_type _upf_get_subarray(const _upf_type *array, int count) {
-    _UPF_ASSERT(array != NULL);
+static _upf_type _upf_get_subarray(const _upf_type *array, uint32_t count) {
+    _UPF_ASSERT(array != NULL && array->kind == _UPF_TK_ARRAY && count <= array->count);
 
+    // Name is left to the caller, since printing doesn't need it.
     _upf_type subarray = *array;
-    if (array->name != NULL) {
-        subarray.name = _upf_arena_string(&_upf_state.arena, array->name, array->name + strlen(array->name) - 2 * count);
-    }
-    subarray.as.array.lengths.length -= count;
-    subarray.as.array.lengths.data += count;
+    subarray.first += count;
+    subarray.count -= count;
 
     return subarray;
 }
 
-static size_t _upf_add_type(const uint8_t *type_die, _upf_type type) {
+static uint64_t _upf_type_hash(const _upf_type *type) {
+    _UPF_ASSERT(type != NULL);
+
+    uint64_t fields[] = {type->kind, type->modifiers, type->first, type->size, type->count, type->type, type->name};
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < sizeof(fields) / sizeof(*fields); i++) {
+        hash ^= fields[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    // 0 is reserved for empty entries.
+    return hash == 0 ? 1 : hash;
+}
+
+static bool _upf_is_same_type(const _upf_type *a, const _upf_type *b) {
+    _UPF_ASSERT(a != NULL && b != NULL);
+    return a->kind == b->kind && a->modifiers == b->modifiers && a->first == b->first && a->size == b->size && a->count == b->count
+           && a->type == b->type && a->name == b->name;
+}
+
+// Types with a DIE are cached by it, while the ones without it, which are made
+// up for each call (pointers, subarrays, etc.), are interned by their fields.
+static uint32_t _upf_add_type(const uint8_t *type_die, _upf_type type) {
+    uint64_t type_idx;
+    if (type_die != NULL && _upf_map_get(&_upf_state.type_idxs, (uint64_t) type_die, &type_idx)) return type_idx;
+
+    uint64_t hash = 0;
+    bool is_found = false;
+    if (type_die == NULL) {
+        hash = _upf_type_hash(&type);
+        is_found = _upf_map_get(&_upf_state.synthetic_types, hash, &type_idx);
+        if (is_found && _upf_is_same_type(_upf_get_type(type_idx), &type)) return type_idx;
+    }
+
+    if (_upf_state.types.length == _UPF_NO_TYPE) _UPF_ERROR("Too many types.");
+    _UPF_VECTOR_PUSH(&_upf_state.types, type);
+
+    type_idx = _upf_state.types.length - 1;
     if (type_die != NULL) {
-        for (size_t i = 0; i < _upf_state.type_map.length; i++) {
-            if (_upf_state.type_map.data[i].die == type_die) return i;
-        }
+        _upf_map_set(&_upf_state.type_idxs, (uint64_t) type_die, type_idx);
+    } else if (!is_found) {
+        _upf_map_set(&_upf_state.synthetic_types, hash, type_idx);
     }
+    return type_idx;
+}
 
-    _upf_type_map_entry entry = {
-        .die = type_die,
-        .type = type,
-    };
-    _UPF_VECTOR_PUSH(&_upf_state.type_map, entry);
+// Moves the members which were pushed to the stack since start to the pool.
+static void _upf_pool_members(_upf_type *type, uint32_t start) {
+    _UPF_ASSERT(type != NULL && start <= _upf_state.member_stack.length);
 
-    return _upf_state.type_map.length - 1;
+    type->first = _upf_state.members.length;
+    type->count = _upf_state.member_stack.length - start;
+    for (uint32_t i = start; i < _upf_state.member_stack.length; i++) {
+        _UPF_VECTOR_PUSH(&_upf_state.members, _upf_state.member_stack.data[i]);
+    }
+    _upf_state.member_stack.length = start;
 }
 
-static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
-    _UPF_ASSERT(cu != NULL && die != NULL);
+// Moves the argument types which were pushed to the stack since start to the pool.
+static void _upf_pool_arg_types(_upf_type *type, uint32_t start) {
+    _UPF_ASSERT(type != NULL && start <= _upf_state.arg_type_stack.length);
 
-    for (size_t i = 0; i < _upf_state.type_map.length; i++) {
-        if (_upf_state.type_map.data[i].die == die) return i;
+    type->first = _upf_state.arg_types.length;
+    type->count = _upf_state.arg_type_stack.length - start;
+    for (uint32_t i = start; i < _upf_state.arg_type_stack.length; i++) {
+        _UPF_VECTOR_PUSH(&_upf_state.arg_types, _upf_state.arg_type_stack.data[i]);
     }
+    _upf_state.arg_type_stack.length = start;
+}
+
+static uint32_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
+    _UPF_ASSERT(cu != NULL && die != NULL);
+
+    uint64_t cached_type_idx;
+    if (_upf_map_get(&_upf_state.type_idxs, (uint64_t) die, &cached_type_idx)) return cached_type_idx;
+
+    // Types from type units and partial units are parsed in the context of their
+    // own unit, so that every unit which references them ends up with the same type.
+    cu = _upf_get_die_cu(cu, die);
 
     const uint8_t *base = die;
 
@@ -1233,7 +2616,8 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
     const _upf_abbrev *abbrev = _upf_get_abbrev(cu, code);
 
     const char *name = NULL;
-    uint64_t subtype_offset = _UPF_INVALID;
+    const uint8_t *subtype_die = NULL;
+    const uint8_t *signature_die = NULL;
     size_t size = _UPF_INVALID;
     int64_t encoding = 0;
     for (size_t i = 0; i < abbrev->attrs.length; i++) {
@@ -1242,7 +2626,9 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
         if (attr.name == _UPF_DW_AT_name) {
             name = _upf_get_str(cu, die, attr.form);
         } else if (attr.name == _UPF_DW_AT_type) {
-            subtype_offset = _upf_get_ref(die, attr.form);
+            subtype_die = _upf_get_ref_die(cu, die, attr.form);
+        } else if (attr.name == _UPF_DW_AT_signature) {
+            signature_die = _upf_get_ref_die(cu, die, attr.form);
         } else if (attr.name == _UPF_DW_AT_byte_size) {
             if (_upf_is_data(attr.form)) {
                 size = _upf_get_data(die, attr);
@@ -1252,31 +2638,41 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
         } else if (attr.name == _UPF_DW_AT_encoding) {
             encoding = _upf_get_data(die, attr);
         }
-        die += _upf_get_attr_size(die, attr.form);
+        die = _upf_skip_attr(die, attr);
+    }
+
+    // Declaration which stands in for the type from the type unit.
+    if (signature_die != NULL) {
+        uint32_t type_idx = _upf_parse_type(cu, signature_die);
+        _upf_map_set(&_upf_state.type_idxs, (uint64_t) base, type_idx);
+        return type_idx;
     }
 
     switch (abbrev->tag) {
         case _UPF_DW_TAG_array_type: {
-            _UPF_ASSERT(subtype_offset != _UPF_INVALID);
+            _UPF_ASSERT(subtype_die != NULL);
 
             _upf_type type = {
-                .name = name,
                 .kind = _UPF_TK_ARRAY,
                 .modifiers = 0,
+                .first = 0,
                 .size = size,
-                .as.array = {
-                    .element_type = _upf_parse_type(cu, cu->base + subtype_offset),
-                    .lengths = _UPF_VECTOR_NEW(&_upf_state.arena),
-                },
+                .count = 0,
+                .type = _upf_parse_type(cu, subtype_die),
+                .name = _upf_add_type_name(name),
             };
+            // Element type may have its own lengths, so they are pushed only after it.
+            type.first = _upf_state.lengths.length;
 
-            const _upf_type *element_type = _upf_get_type(type.as.array.element_type);
+            const _upf_type *element_type = _upf_get_type(type.type);
+            const char *element_name = _upf_get_name(element_type->name);
+            size_t element_size = element_type->size;
 
-            bool generate_name = element_type->name != NULL && type.name == NULL;
-            if (generate_name) type.name = element_type->name;
+            bool generate_name = element_name != NULL && type.name == 0;
+            if (generate_name) name = element_name;
 
             bool is_static = true;
-            size_t array_size = element_type->size;
+            size_t array_size = element_size;
             if (!abbrev->has_children) return _upf_add_type(base, type);
             while (true) {
                 die += _upf_uLEB_to_uint64(die, &code);
@@ -1302,44 +2698,47 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                         }
                     }
 
-                    die += _upf_get_attr_size(die, attr.form);
+                    die = _upf_skip_attr(die, attr);
                 }
 
                 if (length == _UPF_INVALID) {
                     is_static = false;
                     array_size = _UPF_INVALID;
-                    type.as.array.lengths.length = 0;
+                    _upf_state.lengths.length = type.first;
+                    type.count = 0;
                 }
 
                 if (is_static) {
                     array_size *= length;
-                    _UPF_VECTOR_PUSH(&type.as.array.lengths, length);
+                    _UPF_VECTOR_PUSH(&_upf_state.lengths, length);
+                    type.count++;
                 }
 
-                if (generate_name) type.name = _upf_arena_concat(&_upf_state.arena, type.name, "[]");
+                if (generate_name) name = _upf_arena_concat(&_upf_state.scratch_arena, name, "[]");
             }
+            if (generate_name) type.name = _upf_add_type_name(name);
 
-            if (element_type->size != _UPF_INVALID && type.size == _UPF_INVALID) {
+            if (element_size != _UPF_INVALID && type.size == _UPF_INVALID) {
                 type.size = array_size;
             }
 
             return _upf_add_type(base, type);
         }
         case _UPF_DW_TAG_enumeration_type: {
-            _UPF_ASSERT(subtype_offset != _UPF_INVALID);
+            _UPF_ASSERT(subtype_die != NULL);
 
             _upf_type type = {
-                .name = name ? name : "enum",
                 .kind = _UPF_TK_ENUM,
                 .modifiers = 0,
+                .first = 0,
                 .size = size,
-                .as.cenum = {
-                    .underlying_type = _upf_parse_type(cu, cu->base + subtype_offset),
-                    .enums = _UPF_VECTOR_NEW(&_upf_state.arena),
-                },
+                .count = 0,
+                .type = _upf_parse_type(cu, subtype_die),
+                .name = _upf_add_type_name(name ? name : "enum"),
             };
+            type.first = _upf_state.enums.length;
 
-            if (type.size == _UPF_INVALID) type.size = _upf_get_type(type.as.cenum.underlying_type)->size;
+            if (type.size == _UPF_INVALID) type.size = _upf_get_type(type.type)->size;
 
             if (!abbrev->has_children) return _upf_add_type(base, type);
             while (true) {
@@ -1350,15 +2749,16 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                 _UPF_ASSERT(abbrev->tag == _UPF_DW_TAG_enumerator);
 
                 bool found_value = false;
+                const char *enum_name = NULL;
                 _upf_enum cenum = {
-                    .name = NULL,
                     .value = 0,
+                    .name = 0,
                 };
                 for (size_t i = 0; i < abbrev->attrs.length; i++) {
                     _upf_attr attr = abbrev->attrs.data[i];
 
                     if (attr.name == _UPF_DW_AT_name) {
-                        cenum.name = _upf_get_str(cu, die, attr.form);
+                        enum_name = _upf_get_str(cu, die, attr.form);
                     } else if (attr.name == _UPF_DW_AT_const_value) {
                         if (_upf_is_data(attr.form)) {
                             cenum.value = _upf_get_data(die, attr);
@@ -1369,11 +2769,13 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                         }
                     }
 
-                    die += _upf_get_attr_size(die, attr.form);
+                    die = _upf_skip_attr(die, attr);
                 }
-                _UPF_ASSERT(cenum.name != NULL && found_value);
+                _UPF_ASSERT(enum_name != NULL && found_value);
+                cenum.name = _upf_add_type_name(enum_name);
 
-                _UPF_VECTOR_PUSH(&type.as.cenum.enums, cenum);
+                _UPF_VECTOR_PUSH(&_upf_state.enums, cenum);
+                type.count++;
             }
 
             return _upf_add_type(base, type);
@@ -1382,28 +2784,28 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
             _UPF_ASSERT(size == _UPF_INVALID || size == sizeof(void *));
 
             _upf_type type = {
-                .name = name,
                 .kind = _UPF_TK_POINTER,
                 .modifiers = 0,
-                .size = sizeof(void*),
-                .as.pointer = {
-                    .type = _UPF_INVALID,
-                },
+                .first = 0,
+                .size = sizeof(void *),
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
             };
 
             // Pointers have to be added before their data gets filled in so that
             // structs that pointer to themselves, such as linked lists, don't get
             // stuck in an infinite loop.
-            size_t type_idx = _upf_add_type(base, type);
+            uint32_t type_idx = _upf_add_type(base, type);
 
-            if (subtype_offset != _UPF_INVALID) {
+            if (subtype_die != NULL) {
                 // `void*`s have invalid offset (since they don't point to any type), thus
                 // pointer with invalid type represents a `void*`
 
-                size_t subtype_idx = _upf_parse_type(cu, cu->base + subtype_offset);
+                uint32_t subtype_idx = _upf_parse_type(cu, subtype_die);
                 // Pointers inside vector may become invalid if _upf_parse_type fills up the vector triggering realloc
-                _upf_type *type = &_upf_state.type_map.data[type_idx].type;
-                type->as.pointer.type = subtype_idx;
+                _upf_type *type = &_upf_state.types.data[type_idx];
+                type->type = subtype_idx;
                 type->name = _upf_get_type(subtype_idx)->name;
             }
 
@@ -1413,16 +2815,17 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
         case _UPF_DW_TAG_union_type: {
             bool is_struct = abbrev->tag == _UPF_DW_TAG_structure_type;
             _upf_type type = {
-                .name = name ? name : (is_struct ? "struct" : "union"),
                 .kind = is_struct ? _UPF_TK_STRUCT : _UPF_TK_UNION,
                 .modifiers = 0,
+                .first = 0,
                 .size = size,
-                .as.cstruct = {
-                    .members = _UPF_VECTOR_NEW(&_upf_state.arena),
-                },
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name ? name : (is_struct ? "struct" : "union")),
             };
 
             if (!abbrev->has_children) return _upf_add_type(base, type);
+            uint32_t stack_start = _upf_state.member_stack.length;
             while (true) {
                 die += _upf_uLEB_to_uint64(die, &code);
                 if (code == 0) break;
@@ -1433,10 +2836,12 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                     continue;
                 }
 
+                const char *member_name = NULL;
+                uint64_t offset = is_struct ? _UPF_INVALID : 0;
                 _upf_member member = {
-                    .name = NULL,
-                    .type = _UPF_INVALID,
-                    .offset = is_struct ? _UPF_INVALID : 0,
+                    .name = 0,
+                    .type = _UPF_NO_TYPE,
+                    .offset = 0,
                     .bit_size = 0,
                 };
                 bool skip_member = false;
@@ -1444,13 +2849,13 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                     _upf_attr attr = abbrev->attrs.data[i];
 
                     if (attr.name == _UPF_DW_AT_name) {
-                        member.name = _upf_get_str(cu, die, attr.form);
+                        member_name = _upf_get_str(cu, die, attr.form);
                     } else if (attr.name == _UPF_DW_AT_type) {
-                        const uint8_t *type_die = cu->base + _upf_get_ref(die, attr.form);
+                        const uint8_t *type_die = _upf_get_ref_die(cu, die, attr.form);
                         member.type = _upf_parse_type(cu, type_die);
                     } else if (attr.name == _UPF_DW_AT_data_member_location) {
                         if (_upf_is_data(attr.form)) {
-                            member.offset = _upf_get_data(die, attr);
+                            offset = _upf_get_data(die, attr);
                         } else {
                             _UPF_WARN("Non-constant member offsets aren't supported. Skipping this field.");
                             skip_member = true;
@@ -1459,7 +2864,7 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                         _UPF_WARN("Bit offset uses old format. Skipping this field.");
                         skip_member = true;
                     } else if (attr.name == _UPF_DW_AT_data_bit_offset) {
-                        member.offset = _upf_get_data(die, attr);
+                        offset = _upf_get_data(die, attr);
                     } else if (attr.name == _UPF_DW_AT_bit_size) {
                         if (_upf_is_data(attr.form)) {
                             member.bit_size = _upf_get_data(die, attr);
@@ -1469,33 +2874,40 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                         }
                     }
 
-                    die += _upf_get_attr_size(die, attr.form);
+                    die = _upf_skip_attr(die, attr);
                 }
                 if (skip_member) continue;
 
-                _UPF_ASSERT(member.name != NULL && member.type != _UPF_INVALID && member.offset != _UPF_INVALID);
-                _UPF_VECTOR_PUSH(&type.as.cstruct.members, member);
+                _UPF_ASSERT(member_name != NULL && member.type != _UPF_NO_TYPE && offset != _UPF_INVALID);
+                if (offset > UINT32_MAX) {
+                    _UPF_WARN("Member offsets above 4 GiB aren't supported. Skipping this field.");
+                    continue;
+                }
+                member.name = _upf_add_type_name(member_name);
+                member.offset = offset;
+                _UPF_VECTOR_PUSH(&_upf_state.member_stack, member);
             }
+            _upf_pool_members(&type, stack_start);
 
             return _upf_add_type(base, type);
         }
         case _UPF_DW_TAG_subroutine_type: {
             _upf_type type = {
-                .name = name,
                 .kind = _UPF_TK_FUNCTION,
                 .modifiers = 0,
+                .first = 0,
                 .size = size,
-                .as.function = {
-                    .return_type = _UPF_INVALID,
-                    .arg_types = _UPF_VECTOR_NEW(&_upf_state.arena),
-                },
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
             };
 
-            if (subtype_offset != _UPF_INVALID) {
-                type.as.function.return_type = _upf_parse_type(cu, cu->base + subtype_offset);
+            if (subtype_die != NULL) {
+                type.type = _upf_parse_type(cu, subtype_die);
             }
 
             if (!abbrev->has_children) return _upf_add_type(base, type);
+            uint32_t stack_start = _upf_state.arg_type_stack.length;
             while (true) {
                 die += _upf_uLEB_to_uint64(die, &code);
                 if (code == 0) break;
@@ -1510,35 +2922,39 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
                     _upf_attr attr = abbrev->attrs.data[i];
 
                     if (attr.name == _UPF_DW_AT_type) {
-                        const uint8_t *type_die = cu->base + _upf_get_ref(die, attr.form);
-                        size_t arg_type = _upf_parse_type(cu, type_die);
-                        _UPF_VECTOR_PUSH(&type.as.function.arg_types, arg_type);
+                        const uint8_t *type_die = _upf_get_ref_die(cu, die, attr.form);
+                        uint32_t arg_type = _upf_parse_type(cu, type_die);
+                        _UPF_VECTOR_PUSH(&_upf_state.arg_type_stack, arg_type);
                     }
 
-                    die += _upf_get_attr_size(die, attr.form);
+                    die = _upf_skip_attr(die, attr);
                 }
             }
+            _upf_pool_arg_types(&type, stack_start);
 
             return _upf_add_type(base, type);
         }
         case _UPF_DW_TAG_typedef: {
             _UPF_ASSERT(name != NULL);
 
-            if (subtype_offset == _UPF_INVALID) {
+            if (subtype_die == NULL) {
                 // void type is represented by absence of type attribute, e.g. typedef void NAME
 
                 _upf_type type = {
-                    .name = name,
                     .kind = _UPF_TK_VOID,
                     .modifiers = 0,
+                    .first = 0,
                     .size = _UPF_INVALID,
+                    .count = 0,
+                    .type = _UPF_NO_TYPE,
+                    .name = _upf_add_type_name(name),
                 };
                 return _upf_add_type(base, type);
             }
 
-            size_t type_idx = _upf_parse_type(cu, cu->base + subtype_offset);
+            uint32_t type_idx = _upf_parse_type(cu, subtype_die);
             _upf_type type = *_upf_get_type(type_idx);
-            type.name = name;
+            type.name = _upf_add_type_name(name);
 
             if (type.kind == _UPF_TK_SCHAR && strcmp(name, "int8_t") == 0) type.kind = _UPF_TK_S1;
             else if (type.kind == _UPF_TK_UCHAR && strcmp(name, "uint8_t") == 0) type.kind = _UPF_TK_U1;
@@ -1549,10 +2965,13 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
             _UPF_ASSERT(name != NULL && size != _UPF_INVALID && encoding != 0);
 
             _upf_type type = {
-                .name = name,
                 .kind = _upf_get_type_kind(encoding, size),
                 .modifiers = 0,
+                .first = 0,
                 .size = size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
             };
 
             return _upf_add_type(base, type);
@@ -1561,17 +2980,20 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
         case _UPF_DW_TAG_volatile_type:
         case _UPF_DW_TAG_restrict_type:
         case _UPF_DW_TAG_atomic_type: {
-            if (subtype_offset == _UPF_INVALID) {
+            if (subtype_die == NULL) {
                 _upf_type type = {
-                    .name = "void",
                     .kind = _UPF_TK_VOID,
                     .modifiers = _upf_get_type_modifier(abbrev->tag),
+                    .first = 0,
                     .size = sizeof(void *),
+                    .count = 0,
+                    .type = _UPF_NO_TYPE,
+                    .name = _upf_add_type_name("void"),
                 };
 
                 return _upf_add_type(base, type);
             } else {
-                size_t type_idx = _upf_parse_type(cu, cu->base + subtype_offset);
+                uint32_t type_idx = _upf_parse_type(cu, subtype_die);
                 _upf_type type = *_upf_get_type(type_idx);
                 type.modifiers |= _upf_get_type_modifier(abbrev->tag);
 
@@ -1586,26 +3008,32 @@ static size_t _upf_parse_type(const _upf_cu *cu, const uint8_t *die) {
     _upf_type type;
 unknown_type:
     type = (_upf_type){
-        .name = name,
         .kind = _UPF_TK_UNKNOWN,
         .modifiers = 0,
+        .first = 0,
         .size = size,
+        .count = 0,
+        .type = _UPF_NO_TYPE,
+        .name = _upf_add_type_name(name),
     };
     return _upf_add_type(base, type);
 }
 
 static _upf_range_vec _upf_get_ranges(const _upf_cu *cu, const uint8_t *die, uint64_t form) {
-    _UPF_ASSERT(cu != NULL && die != NULL && _upf_state.dwarf.rnglists != NULL);
+    _UPF_ASSERT(cu != NULL && die != NULL);
+
+    const uint8_t *rnglists = cu->dwo != NULL ? cu->dwo->rnglists : _upf_get_section(&_upf_state.module->dwarf.rnglists);
+    _UPF_ASSERT(rnglists != NULL);
 
     const uint8_t *rnglist = NULL;
     if (form == _UPF_DW_FORM_sec_offset) {
-        rnglist = _upf_state.dwarf.rnglists + _upf_offset_cast(die);
+        rnglist = rnglists + _upf_offset_cast(die);
     } else {
         _UPF_ASSERT(cu->rnglists_base != _UPF_INVALID);
         uint64_t index;
         _upf_uLEB_to_uint64(die, &index);
-        uint64_t rnglist_offset = _upf_offset_cast(_upf_state.dwarf.rnglists + cu->rnglists_base + index * _upf_state.dwarf.offset_size);
-        rnglist = _upf_state.dwarf.rnglists + cu->rnglists_base + rnglist_offset;
+        uint64_t rnglist_offset = _upf_offset_cast(rnglists + cu->rnglists_base + index * _upf_state.module->dwarf.offset_size);
+        rnglist = rnglists + cu->rnglists_base + rnglist_offset;
     }
     _UPF_ASSERT(rnglist != NULL);
 
@@ -1614,7 +3042,7 @@ static _upf_range_vec _upf_get_ranges(const _upf_cu *cu, const uint8_t *die, uin
         base = cu->scope.ranges.data[0].start;
     }
 
-    _upf_range_vec ranges = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_range_vec ranges = _UPF_VECTOR_NEW(cu->arena);
     while (*rnglist != _UPF_DW_RLE_end_of_list) {
         switch (*rnglist++) {
             case _UPF_DW_RLE_base_addressx:
@@ -1637,8 +3065,8 @@ static _upf_range_vec _upf_get_ranges(const _upf_cu *cu, const uint8_t *die, uin
             case _UPF_DW_RLE_startx_length: {
                 uint64_t address = _upf_get_addr(cu, rnglist, _UPF_DW_FORM_addrx);
                 rnglist += _upf_get_attr_size(rnglist, _UPF_DW_FORM_addrx);
-                uint64_t length = _upf_get_addr(cu, rnglist, _UPF_DW_FORM_addrx);
-                rnglist += _upf_get_attr_size(rnglist, _UPF_DW_FORM_addrx);
+                uint64_t length;
+                rnglist += _upf_uLEB_to_uint64(rnglist, &length);
 
                 _upf_range range = {
                     .start = address,
@@ -1661,13 +3089,13 @@ static _upf_range_vec _upf_get_ranges(const _upf_cu *cu, const uint8_t *die, uin
             } break;
             case _UPF_DW_RLE_base_address:
                 base = _upf_address_cast(rnglist);
-                rnglist += _upf_state.dwarf.address_size;
+                rnglist += _upf_state.module->dwarf.address_size;
                 break;
             case _UPF_DW_RLE_start_end: {
                 uint64_t start = _upf_address_cast(rnglist);
-                rnglist += _upf_state.dwarf.address_size;
+                rnglist += _upf_state.module->dwarf.address_size;
                 uint64_t end = _upf_address_cast(rnglist);
-                rnglist += _upf_state.dwarf.address_size;
+                rnglist += _upf_state.module->dwarf.address_size;
 
                 _upf_range range = {
                     .start = start,
@@ -1678,7 +3106,7 @@ static _upf_range_vec _upf_get_ranges(const _upf_cu *cu, const uint8_t *die, uin
             } break;
             case _UPF_DW_RLE_start_length: {
                 uint64_t address = _upf_address_cast(rnglist);
-                rnglist += _upf_state.dwarf.address_size;
+                rnglist += _upf_state.module->dwarf.address_size;
                 uint64_t length;
                 rnglist += _upf_uLEB_to_uint64(rnglist, &length);
 
@@ -1705,37 +3133,37 @@ static _upf_named_type _upf_get_var(const _upf_cu *cu, const uint8_t *die) {
     die += _upf_uLEB_to_uint64(die, &code);
     const _upf_abbrev *abbrev = _upf_get_abbrev(cu, code);
 
+    _upf_attr attr;
+    const uint8_t *origin = _upf_find_attr(die, abbrev, _UPF_DW_AT_abstract_origin, &attr);
+    if (origin != NULL) {
+        const uint8_t *origin_die = _upf_get_ref_die(cu, origin, attr.form);
+        return _upf_get_var(_upf_get_die_cu(cu, origin_die), origin_die);
+    }
+
     _upf_named_type var = {
         .die = NULL,
         .name = NULL,
     };
-    for (size_t i = 0; i < abbrev->attrs.length; i++) {
-        _upf_attr attr = abbrev->attrs.data[i];
-
-        if (attr.name == _UPF_DW_AT_name) {
-            var.name = _upf_get_str(cu, die, attr.form);
-        } else if (attr.name == _UPF_DW_AT_type) {
-            var.die = cu->base + _upf_get_ref(die, attr.form);
-        } else if (attr.name == _UPF_DW_AT_abstract_origin) {
-            return _upf_get_var(cu, cu->base + _upf_get_ref(die, attr.form));
-        }
-
-        die += _upf_get_attr_size(die, attr.form);
-    }
+    const uint8_t *name = _upf_find_attr(die, abbrev, _UPF_DW_AT_name, &attr);
+    if (name != NULL) var.name = _upf_get_str(cu, name, attr.form);
+    const uint8_t *type = _upf_find_attr(die, abbrev, _UPF_DW_AT_type, &attr);
+    if (type != NULL) var.die = _upf_get_ref_die(cu, type, attr.form);
 
     return var;
 }
 
-static _upf_abbrev_vec _upf_parse_abbrevs(const uint8_t *abbrev_table) {
-    _UPF_ASSERT(abbrev_table != NULL);
+static _upf_abbrev_vec _upf_parse_abbrevs(_upf_arena *arena, const uint8_t *abbrev_table) {
+    _UPF_ASSERT(arena != NULL && abbrev_table != NULL);
 
-    _upf_abbrev_vec abbrevs = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_abbrev_vec abbrevs = _UPF_VECTOR_NEW(arena);
     while (true) {
         _upf_abbrev abbrev = {
             .code = _UPF_INVALID,
             .tag = _UPF_INVALID,
             .has_children = false,
-            .attrs = _UPF_VECTOR_NEW(&_upf_state.arena),
+            .attrs = _UPF_VECTOR_NEW(arena),
+            .size = 0,
+            .first_variable_attr = 0,
         };
         abbrev_table += _upf_uLEB_to_uint64(abbrev_table, &abbrev.code);
         if (abbrev.code == 0) break;
@@ -1750,8 +3178,21 @@ static _upf_abbrev_vec _upf_parse_abbrevs(const uint8_t *abbrev_table) {
             abbrev_table += _upf_uLEB_to_uint64(abbrev_table, &attr.form);
             if (attr.form == _UPF_DW_FORM_implicit_const) abbrev_table += _upf_LEB_to_int64(abbrev_table, &attr.implicit_const);
             if (attr.name == 0 && attr.form == 0) break;
+
+            // Offsets are known up to and including the first variable size attribute.
+            attr.size = _upf_get_fixed_attr_size(attr.form);
+            attr.offset = abbrev.size;
+            if (abbrev.size != _UPF_INVALID) {
+                if (attr.size == _UPF_INVALID) {
+                    abbrev.size = _UPF_INVALID;
+                    abbrev.first_variable_attr = abbrev.attrs.length;
+                } else {
+                    abbrev.size += attr.size;
+                }
+            }
             _UPF_VECTOR_PUSH(&abbrev.attrs, attr);
         }
+        if (abbrev.size != _UPF_INVALID) abbrev.first_variable_attr = abbrev.attrs.length;
 
         _UPF_VECTOR_PUSH(&abbrevs, abbrev);
     }
@@ -1759,6 +3200,28 @@ static _upf_abbrev_vec _upf_parse_abbrevs(const uint8_t *abbrev_table) {
     return abbrevs;
 }
 
+// Units often share abbreviation table, so the parsed tables are cached by their offset.
+static const _upf_abbrev_table *_upf_get_abbrev_table(const uint8_t *abbrev) {
+    _UPF_ASSERT(abbrev != NULL);
+
+    uint64_t cached;
+    if (_upf_map_get(&_upf_state.module->abbrev_tables, (uint64_t) abbrev, &cached)) return (const _upf_abbrev_table *) cached;
+
+    _upf_abbrev_table *table = (_upf_abbrev_table *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*table));
+    table->abbrevs = _upf_parse_abbrevs(&_upf_state.module->arena, abbrev);
+    table->is_dense = true;
+    _upf_map_init(&table->code_to_idx, &_upf_state.module->arena);
+    for (uint32_t i = 0; i < table->abbrevs.length; i++) {
+        if (table->abbrevs.data[i].code != i + 1) table->is_dense = false;
+    }
+    if (!table->is_dense) {
+        for (uint32_t i = 0; i < table->abbrevs.length; i++) _upf_map_set(&table->code_to_idx, table->abbrevs.data[i].code, i);
+    }
+
+    _upf_map_set(&_upf_state.module->abbrev_tables, (uint64_t) abbrev, (uint64_t) table);
+    return table;
+}
+
 static bool _upf_is_language_c(int64_t language) {
     switch (language) {
         case _UPF_DW_LANG_C:
@@ -1778,7 +3241,7 @@ static _upf_range_vec _upf_get_cu_ranges(const _upf_cu *cu, const uint8_t *low_p
 
     if (ranges_die != NULL) return _upf_get_ranges(cu, ranges_die, ranges_attr.form);
 
-    _upf_range_vec ranges = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_range_vec ranges = _UPF_VECTOR_NEW(cu->arena);
     _upf_range range = {
         .start = _UPF_INVALID,
         .end = _UPF_INVALID,
@@ -1810,9 +3273,9 @@ static bool _upf_parse_cu_scope(const _upf_cu *cu, _upf_scope_stack *scope_stack
     _UPF_ASSERT(scope_stack->length > 0);
 
     _upf_scope new_scope = {
-        .ranges = _UPF_VECTOR_NEW(&_upf_state.arena),
-        .vars = _UPF_VECTOR_NEW(&_upf_state.arena),
-        .scopes = _UPF_VECTOR_NEW(&_upf_state.arena),
+        .ranges = _UPF_VECTOR_NEW(cu->arena),
+        .vars = _UPF_VECTOR_NEW(cu->arena),
+        .scopes = _UPF_VECTOR_NEW(cu->arena),
     };
 
     uint64_t low_pc = _UPF_INVALID;
@@ -1830,7 +3293,7 @@ static bool _upf_parse_cu_scope(const _upf_cu *cu, _upf_scope_stack *scope_stack
             new_scope.ranges = _upf_get_ranges(cu, die, attr.form);
         }
 
-        die += _upf_get_attr_size(die, attr.form);
+        die = _upf_skip_attr(die, attr);
     }
 
     if (low_pc != _UPF_INVALID) {
@@ -1882,13 +3345,9 @@ static void _upf_parse_cu_type(_upf_cu *cu, const uint8_t *die) {
     const _upf_abbrev *abbrev = _upf_get_abbrev(cu, code);
 
     const char *name = NULL;
-    for (size_t i = 0; i < abbrev->attrs.length; i++) {
-        _upf_attr attr = abbrev->attrs.data[i];
-
-        if (attr.name == _UPF_DW_AT_name) name = _upf_get_str(cu, die, attr.form);
-
-        die += _upf_get_attr_size(die, attr.form);
-    }
+    _upf_attr attr;
+    const uint8_t *name_die = _upf_find_attr(die, abbrev, _UPF_DW_AT_name, &attr);
+    if (name_die != NULL) name = _upf_get_str(cu, name_die, attr.form);
     if (abbrev->tag == _UPF_DW_TAG_pointer_type) {
         if (name) return;
         name = "void";
@@ -1900,6 +3359,7 @@ static void _upf_parse_cu_type(_upf_cu *cu, const uint8_t *die) {
         .name = name,
     };
     _UPF_VECTOR_PUSH(&cu->types, type);
+    _upf_add_name(&cu->type_names, name, cu->types.length - 1);
 }
 
 static bool _upf_parse_subprogram_args(_upf_cu *cu, const uint8_t *die, _upf_named_type_vec *args) {
@@ -1923,9 +3383,9 @@ static bool _upf_parse_subprogram_args(_upf_cu *cu, const uint8_t *die, _upf_nam
             _upf_attr attr = abbrev->attrs.data[i];
 
             if (attr.name == _UPF_DW_AT_name) arg.name = _upf_get_str(cu, die, attr.form);
-            else if (attr.name == _UPF_DW_AT_type) arg.die = cu->base + _upf_get_ref(die, attr.form);
+            else if (attr.name == _UPF_DW_AT_type) arg.die = _upf_get_ref_die(cu, die, attr.form);
 
-            die += _upf_get_attr_size(die, attr.form);
+            die = _upf_skip_attr(die, attr);
         }
         _UPF_ASSERT(die != NULL);
 
@@ -1941,56 +3401,110 @@ static const char *_upf_parse_cu_function(_upf_cu *cu, const uint8_t *die, const
     _upf_function function = {
         .name = NULL,
         .return_type = NULL,
-        .args = _UPF_VECTOR_NEW(&_upf_state.arena),
+        .args = _UPF_VECTOR_NEW(cu->arena),
         .is_variadic = false,
         .low_pc = _UPF_INVALID,
     };
+    _upf_range_vec ranges = _UPF_VECTOR_NEW(cu->arena);
+    const uint8_t *high_pc_die = NULL;
+    _upf_attr high_pc_attr = {0};
     for (size_t i = 0; i < abbrev->attrs.length; i++) {
         _upf_attr attr = abbrev->attrs.data[i];
 
         if (attr.name == _UPF_DW_AT_name) function.name = _upf_get_str(cu, die, attr.form);
-        else if (attr.name == _UPF_DW_AT_type) function.return_type = cu->base + _upf_get_ref(die, attr.form);
+        else if (attr.name == _UPF_DW_AT_type) function.return_type = _upf_get_ref_die(cu, die, attr.form);
         else if (attr.name == _UPF_DW_AT_low_pc) function.low_pc = _upf_get_addr(cu, die, attr.form);
-        else if (attr.name == _UPF_DW_AT_ranges) {
-            _upf_range_vec ranges = _upf_get_ranges(cu, die, attr.form);
+        else if (attr.name == _UPF_DW_AT_high_pc) {
+            high_pc_die = die;
+            high_pc_attr = attr;
+        } else if (attr.name == _UPF_DW_AT_ranges) {
+            ranges = _upf_get_ranges(cu, die, attr.form);
             _UPF_ASSERT(ranges.length > 0);
             function.low_pc = ranges.data[0].start;
         }
 
-        die += _upf_get_attr_size(die, attr.form);
+        die = _upf_skip_attr(die, attr);
     }
     if (abbrev->has_children && function.low_pc != _UPF_INVALID) {
         // Args only need to be parsed in case the function has low_pc, because
         // they are only used for printing the signature of a function pointer.
         function.is_variadic = _upf_parse_subprogram_args(cu, die, &function.args);
     }
-    if (function.name != NULL) _UPF_VECTOR_PUSH(&cu->functions, function);
+    if (function.name != NULL) {
+        _UPF_VECTOR_PUSH(&cu->functions, function);
+        size_t function_idx = cu->functions.length - 1;
+        _upf_add_name(&cu->function_names, function.name, function_idx);
+
+        if (ranges.length == 0 && function.low_pc != _UPF_INVALID && high_pc_die != NULL) {
+            _upf_range range = {
+                .start = function.low_pc,
+                .end = _UPF_INVALID,
+            };
+            if (_upf_is_addr(high_pc_attr.form)) {
+                range.end = _upf_get_addr(cu, high_pc_die, high_pc_attr.form);
+            } else {
+                range.end = function.low_pc + _upf_get_data(high_pc_die, high_pc_attr);
+            }
+
+            _UPF_VECTOR_PUSH(&ranges, range);
+        }
+
+        for (size_t i = 0; i < ranges.length; i++) {
+            _upf_function_range function_range = {
+                .start = ranges.data[i].start,
+                .end = ranges.data[i].end,
+                .function_idx = function_idx,
+            };
+            if (function_range.start >= function_range.end) continue;
+            _UPF_VECTOR_PUSH(&cu->function_ranges, function_range);
+        }
+    }
 
     return function.name;
 }
 
-static void _upf_parse_cu(const uint8_t *cu_base, const uint8_t *die, const uint8_t *die_end, const uint8_t *abbrev_table) {
-    _UPF_ASSERT(cu_base != NULL && die != NULL && die_end != NULL && abbrev_table != NULL);
+// Parses root DIE of the unit, i.e. everything except for its children.
+// Returns NULL if the unit isn't written in C.
+static _upf_cu *_upf_parse_cu_root(_upf_arena *arena, const _upf_unit *unit) {
+    _UPF_ASSERT(arena != NULL && unit != NULL);
 
     _upf_cu cu = {
-        .base = cu_base,
-        .abbrevs = _upf_parse_abbrevs(abbrev_table),
-        .types = _UPF_VECTOR_NEW(&_upf_state.arena),
-        .functions = _UPF_VECTOR_NEW(&_upf_state.arena),
+        .base = unit->base,
+        .end = unit->end,
+        .is_sup = unit->is_sup,
+        .arena = arena,
+        .abbrevs = _upf_get_abbrev_table(unit->abbrev),
+        .types = _UPF_VECTOR_NEW(arena),
+        .functions = _UPF_VECTOR_NEW(arena),
+        .type_names = {0},
+        .function_names = {0},
+        .function_ranges = _UPF_VECTOR_NEW(arena),
         .addr_base = 0,
         .str_offsets_base = _UPF_INVALID,
         .rnglists_base = _UPF_INVALID,
+        .dwo = unit->dwo,
         .scope = {
             .ranges = {0},
-            .vars = _UPF_VECTOR_NEW(&_upf_state.arena),
-            .scopes = _UPF_VECTOR_NEW(&_upf_state.arena),
+            .vars = _UPF_VECTOR_NEW(arena),
+            .scopes = _UPF_VECTOR_NEW(arena),
         },
+        .scope_nodes = _UPF_VECTOR_NEW(arena),
+        .scope_intervals = _UPF_VECTOR_NEW(arena),
     };
 
+    const uint8_t *die = unit->die;
     uint64_t code;
     die += _upf_uLEB_to_uint64(die, &code);
     const _upf_abbrev *abbrev = _upf_get_abbrev(&cu, code);
-    _UPF_ASSERT(abbrev->tag == _UPF_DW_TAG_compile_unit);
+    _UPF_ASSERT(abbrev->tag == _UPF_DW_TAG_compile_unit || abbrev->tag == _UPF_DW_TAG_skeleton_unit
+                || abbrev->tag == _UPF_DW_TAG_type_unit || abbrev->tag == _UPF_DW_TAG_partial_unit);
+
+    // Split units don't specify the bases, which instead point right past the
+    // headers of the unit's contributions to the sections.
+    if (unit->dwo != NULL) {
+        cu.str_offsets_base = _upf_state.module->dwarf.is64bit ? 16 : 8;
+        cu.rnglists_base = _upf_state.module->dwarf.is64bit ? 20 : 12;
+    }
 
     // Save to parse after the initializing addr_base, str_offsets, and rnglists_base
     const uint8_t *low_pc_die = NULL;
@@ -2019,24 +3533,174 @@ static void _upf_parse_cu(const uint8_t *cu_base, const uint8_t *die, const uint
             cu.rnglists_base = _upf_offset_cast(die);
         } else if (attr.name == _UPF_DW_AT_language) {
             int64_t language = _upf_get_data(die, attr);
-            if (!_upf_is_language_c(language)) return;
+            if (!_upf_is_language_c(language)) return NULL;
         }
 
-        die += _upf_get_attr_size(die, attr.form);
+        die = _upf_skip_attr(die, attr);
     }
 
     cu.scope.ranges = _upf_get_cu_ranges(&cu, low_pc_die, low_pc_attr, high_pc_die, high_pc_attr, ranges_die, ranges_attr);
 
+    _upf_cu *result = (_upf_cu *) _upf_arena_alloc(arena, sizeof(*result));
+    *result = cu;
+    _upf_map_init(&result->type_names, arena);
+    _upf_map_init(&result->function_names, arena);
+    return result;
+}
+
+#define _UPF_SCOPE_VAR_NAMES_THRESHOLD 8
+
+// Returns index of the scope's variables by name, or NULL if there are few
+// enough of them for a linear search.
+static _upf_map *_upf_get_var_names(_upf_arena *arena, const _upf_scope *scope) {
+    _UPF_ASSERT(arena != NULL && scope != NULL);
+
+    if (scope->vars.length <= _UPF_SCOPE_VAR_NAMES_THRESHOLD) return NULL;
+
+    _upf_map *var_names = (_upf_map *) _upf_arena_alloc(arena, sizeof(*var_names));
+    _upf_map_init(var_names, arena);
+    for (size_t i = 0; i < scope->vars.length; i++) _upf_add_name(var_names, scope->vars.data[i].name, i);
+    return var_names;
+}
+
+static void _upf_add_scope_node(_upf_cu *cu, const _upf_scope *scope, uint32_t parent, uint32_t depth,
+                                _upf_scope_interval_vec *intervals) {
+    _UPF_ASSERT(cu != NULL && scope != NULL && intervals != NULL);
+
+    _upf_scope_node node = {
+        .scope = scope,
+        .parent = parent,
+        .var_names = _upf_get_var_names(cu->arena, scope),
+    };
+    _UPF_VECTOR_PUSH(&cu->scope_nodes, node);
+    uint32_t node_idx = cu->scope_nodes.length - 1;
+
+    for (size_t i = 0; i < scope->ranges.length; i++) {
+        _upf_range range = scope->ranges.data[i];
+        if (range.start >= range.end) continue;
+
+        _upf_scope_interval interval = {
+            .start = range.start,
+            .end = range.end,
+            .node_idx = node_idx,
+            .depth = depth,
+        };
+        _UPF_VECTOR_PUSH(intervals, interval);
+    }
+
+    for (size_t i = 0; i < scope->scopes.length; i++) _upf_add_scope_node(cu, &scope->scopes.data[i], node_idx, depth + 1, intervals);
+}
+
+static int _upf_scope_interval_compare(const void *a, const void *b) {
+    const _upf_scope_interval *interval_a = (const _upf_scope_interval *) a;
+    const _upf_scope_interval *interval_b = (const _upf_scope_interval *) b;
+    if (interval_a->start != interval_b->start) return interval_a->start < interval_b->start ? -1 : 1;
+    // Outer scopes must be opened before the inner ones.
+    if (interval_a->depth != interval_b->depth) return interval_a->depth < interval_b->depth ? -1 : 1;
+    // The earlier of overlapping siblings takes precedence, thus it must be opened last.
+    if (interval_a->node_idx != interval_b->node_idx) return interval_a->node_idx > interval_b->node_idx ? -1 : 1;
+    return 0;
+}
+
+static void _upf_push_scope_interval(_upf_cu *cu, uint64_t start, uint64_t end, uint32_t node_idx) {
+    if (start >= end) return;
+
+    _upf_scope_interval interval = {
+        .start = start,
+        .end = end,
+        .node_idx = node_idx,
+        .depth = 0,
+    };
+    _UPF_VECTOR_PUSH(&cu->scope_intervals, interval);
+}
+
+static void _upf_count_scopes(const _upf_scope *scope, uint32_t *scopes_count, uint32_t *ranges_count) {
+    _UPF_ASSERT(scope != NULL && scopes_count != NULL && ranges_count != NULL);
+
+    (*scopes_count)++;
+    *ranges_count += scope->ranges.length;
+    for (size_t i = 0; i < scope->scopes.length; i++) _upf_count_scopes(&scope->scopes.data[i], scopes_count, ranges_count);
+}
+
+// Splits ranges of the nested scopes into disjoint intervals, each of which
+// belongs to the innermost scope that contains it.
+static void _upf_flatten_scopes(_upf_cu *cu) {
+    _UPF_ASSERT(cu != NULL);
+
+    // Nodes and intervals are pushed in turns, so neither could grow in place.
+    uint32_t scopes_count = 0, ranges_count = 0;
+    _upf_count_scopes(&cu->scope, &scopes_count, &ranges_count);
+    _UPF_VECTOR_RESERVE(&cu->scope_nodes, scopes_count);
+    _upf_scope_interval_vec intervals = _UPF_VECTOR_NEW(cu->arena);
+    _UPF_VECTOR_RESERVE(&intervals, ranges_count);
+    _upf_add_scope_node(cu, &cu->scope, _UPF_NO_PARENT, 0, &intervals);
+    if (intervals.length == 0) return;
+    qsort(intervals.data, intervals.length, sizeof(*intervals.data), _upf_scope_interval_compare);
+
+    _upf_scope_interval_vec stack = _UPF_VECTOR_NEW(cu->arena);
+    uint64_t pos = 0;
+    for (size_t i = 0; i < intervals.length; i++) {
+        _upf_scope_interval interval = intervals.data[i];
+
+        while (stack.length > 0 && _UPF_VECTOR_TOP(&stack).end <= interval.start) {
+            _upf_scope_interval top = _UPF_VECTOR_TOP(&stack);
+            _upf_push_scope_interval(cu, pos, top.end, top.node_idx);
+            if (top.end > pos) pos = top.end;
+            _UPF_VECTOR_POP(&stack);
+        }
+
+        if (stack.length > 0) _upf_push_scope_interval(cu, pos, interval.start, _UPF_VECTOR_TOP(&stack).node_idx);
+        pos = interval.start;
+        _UPF_VECTOR_PUSH(&stack, interval);
+    }
+
+    while (stack.length > 0) {
+        _upf_scope_interval top = _UPF_VECTOR_TOP(&stack);
+        _upf_push_scope_interval(cu, pos, top.end, top.node_idx);
+        if (top.end > pos) pos = top.end;
+        _UPF_VECTOR_POP(&stack);
+    }
+}
+
+static int _upf_function_range_compare(const void *a, const void *b) {
+    const _upf_function_range *range_a = (const _upf_function_range *) a;
+    const _upf_function_range *range_b = (const _upf_function_range *) b;
+    if (range_a->start == range_b->start) return 0;
+    return range_a->start < range_b->start ? -1 : 1;
+}
+
+// Returns the next sibling of the DIE if it has children and DW_AT_sibling,
+// allowing to skip them, otherwise NULL. `die` must point to the first attribute.
+static const uint8_t *_upf_get_sibling(const _upf_cu *cu, const uint8_t *die, const _upf_abbrev *abbrev) {
+    _UPF_ASSERT(cu != NULL && die != NULL && abbrev != NULL);
+
+    if (!abbrev->has_children) return NULL;
+
+    _upf_attr attr;
+    const uint8_t *sibling = _upf_find_attr(die, abbrev, _UPF_DW_AT_sibling, &attr);
+    if (sibling == NULL) return NULL;
+    return cu->base + _upf_get_ref(sibling, attr.form);
+}
+
+// Parses children of the root DIE, i.e. scopes, variables, types and functions.
+static void _upf_parse_cu(_upf_cu *cu, const _upf_unit *unit) {
+    _UPF_ASSERT(cu != NULL && unit != NULL);
+
+    const uint8_t *die = unit->die;
+    uint64_t code;
+    die += _upf_uLEB_to_uint64(die, &code);
+    die = _upf_skip_die(die, _upf_get_abbrev(cu, code));
+
     int depth = 0;
-    _upf_scope_stack scope_stack = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_scope_stack scope_stack = _UPF_VECTOR_NEW(cu->arena);
 
     _upf_scope_stack_entry stack_entry = {
         .depth = depth,
-        .scope = &cu.scope,
+        .scope = &cu->scope,
     };
     _UPF_VECTOR_PUSH(&scope_stack, stack_entry);
 
-    while (die < die_end) {
+    while (die < unit->end) {
         const uint8_t *die_base = die;
 
         die += _upf_uLEB_to_uint64(die, &code);
@@ -2047,175 +3711,3036 @@ static void _upf_parse_cu(const uint8_t *cu_base, const uint8_t *die, const uint
             continue;
         }
 
-        abbrev = _upf_get_abbrev(&cu, code);
-        if (abbrev->has_children) depth++;
+        const _upf_abbrev *abbrev = _upf_get_abbrev(cu, code);
+        if (abbrev->has_children) depth++;
+
+        const uint8_t *sibling = NULL;
+        switch (abbrev->tag) {
+            case _UPF_DW_TAG_subprogram:
+                _upf_parse_cu_function(cu, die, abbrev);
+                __attribute__((fallthrough));
+            case _UPF_DW_TAG_lexical_block:
+            case _UPF_DW_TAG_inlined_subroutine:
+                _upf_parse_cu_scope(cu, &scope_stack, depth, die, abbrev);
+                break;
+            case _UPF_DW_TAG_array_type:
+            case _UPF_DW_TAG_enumeration_type:
+            case _UPF_DW_TAG_structure_type:
+            case _UPF_DW_TAG_union_type:
+                _upf_parse_cu_type(cu, die_base);
+                // Members, enumerators and subranges are read lazily by _upf_parse_type.
+                sibling = _upf_get_sibling(cu, die, abbrev);
+                break;
+            case _UPF_DW_TAG_subroutine_type:
+                sibling = _upf_get_sibling(cu, die, abbrev);
+                break;
+            case _UPF_DW_TAG_pointer_type:
+            case _UPF_DW_TAG_typedef:
+            case _UPF_DW_TAG_base_type:
+                _upf_parse_cu_type(cu, die_base);
+                break;
+            case _UPF_DW_TAG_variable:
+            case _UPF_DW_TAG_formal_parameter: {
+                _upf_scope *scope = _UPF_VECTOR_TOP(&scope_stack).scope;
+                if (scope == NULL) break;
+
+                _upf_named_type var = _upf_get_var(cu, die_base);
+                if (var.name == NULL) break;
+                if (var.die == NULL) {
+                    _UPF_ERROR(
+                        "Unable to find variable DIE. "
+                        "Ensure that the executable contains debugging information of at least 2nd level (-g2 or -g3).");
+                }
+
+                _UPF_VECTOR_PUSH(&scope->vars, var);
+            } break;
+        }
+
+        if (sibling != NULL) {
+            // The subtree, including its terminating entry, is skipped entirely.
+            depth--;
+            die = sibling;
+            continue;
+        }
+        die = _upf_skip_die(die, abbrev);
+    }
+
+    if (cu->scope.scopes.length > 0 && cu->scope.ranges.length == 1) {
+        _upf_range *range = &cu->scope.ranges.data[0];
+
+        if (range->start == _UPF_INVALID) {
+            if (cu->scope.scopes.data[0].ranges.length == 0) {
+                range->start = 0;
+            } else {
+                range->start = cu->scope.scopes.data[0].ranges.data[0].start;
+            }
+        }
+
+        if (range->end == _UPF_INVALID) {
+            if (_UPF_VECTOR_TOP(&cu->scope.scopes).ranges.length == 0) {
+                range->end = UINT64_MAX;
+            } else {
+                range->end = _UPF_VECTOR_TOP(&_UPF_VECTOR_TOP(&cu->scope.scopes).ranges).end;
+            }
+        }
+    }
+
+    _upf_flatten_scopes(cu);
+    if (cu->function_ranges.length > 0) {
+        qsort(cu->function_ranges.data, cu->function_ranges.length, sizeof(*cu->function_ranges.data),
+              _upf_function_range_compare);
+    }
+}
+
+static _upf_cu *_upf_load_cached_cu(_upf_arena *arena, const _upf_unit *unit);
+static void _upf_load_split_unit(_upf_unit *unit, const _upf_cu *skeleton);
+
+// Parses root DIE of the skeleton unit's split unit, which replaces the skeleton
+// but keeps its address ranges. Returns NULL if the unit isn't written in C.
+static _upf_cu *_upf_parse_split_cu_root(_upf_arena *arena, _upf_unit *unit, const _upf_cu *skeleton) {
+    _UPF_ASSERT(arena != NULL && unit != NULL && skeleton != NULL);
+
+    if (unit->split == NULL) _upf_load_split_unit(unit, skeleton);
+
+    _upf_cu *cu = _upf_parse_cu_root(arena, unit->split);
+    if (cu == NULL) return NULL;
+
+    cu->addr_base = skeleton->addr_base;
+    cu->scope.ranges = skeleton->scope.ranges;
+    return cu;
+}
+
+static void _upf_parse_unit(_upf_arena *arena, _upf_unit *unit) {
+    _UPF_ASSERT(arena != NULL && unit != NULL);
+
+    if (unit->is_parsed) return;
+
+    _upf_cu *cu = NULL;
+    if (unit->cached_cu != NULL) {
+        cu = _upf_load_cached_cu(arena, unit);
+    } else {
+        cu = unit->cu != NULL ? unit->cu : _upf_parse_cu_root(arena, unit);
+        if (cu != NULL && unit->is_skeleton) cu = _upf_parse_split_cu_root(arena, unit, cu);
+        if (cu != NULL) _upf_parse_cu(cu, unit->is_skeleton ? unit->split : unit);
+    }
+
+    unit->cu = cu;
+    unit->is_parsed = true;
+}
+
+// CUs which are parsed on demand get arenas of their own, so that they can be
+// evicted once they haven't been used for a while. The rest continue in the
+// arena of their root.
+static _upf_arena *_upf_get_unit_arena(_upf_unit *unit) {
+    _UPF_ASSERT(unit != NULL);
+
+    if (unit->cu != NULL) return unit->cu->arena;
+    if (unit->arena.head == NULL) {
+        _upf_arena_init(&unit->arena, _UPF_INITIAL_UNIT_ARENA_SIZE);
+        _UPF_VECTOR_PUSH(&_upf_state.parsed_units, unit);
+    }
+    return &unit->arena;
+}
+
+static void _upf_use_unit(_upf_unit *unit) {
+    _UPF_ASSERT(unit != NULL);
+
+    // Written only when it changes, since the threads of UPRINTF_INIT_THREADS read
+    // the roots of the partial units at the same time.
+    if (unit->last_use != _upf_state.epoch) unit->last_use = _upf_state.epoch;
+}
+
+// Returns CU of the unit, parsing it if this is the first time it is needed
+// since it was evicted, if ever.
+static _upf_cu *_upf_load_unit(_upf_unit *unit) {
+    _UPF_ASSERT(unit != NULL);
+
+    _upf_use_unit(unit);
+    if (!unit->is_parsed) _upf_parse_unit(_upf_get_unit_arena(unit), unit);
+    return unit->cu;
+}
+
+#if UPRINTF_INIT_THREADS > 1
+typedef struct {
+    size_t *order;
+    size_t length;
+    size_t next;
+    bool is_failed;
+} _upf_unit_queue;
+
+typedef struct {
+    _upf_unit_queue *queue;
+    _upf_arena *arena;
+} _upf_worker;
+
+static void *_upf_parse_units_worker(void *data) {
+    _upf_worker *worker = (_upf_worker *) data;
+    _upf_unit_queue *queue = worker->queue;
+
+    jmp_buf worker_jmp;
+    _upf_thread_jmp_buf = &worker_jmp;
+    if (setjmp(worker_jmp) != 0) {
+        __atomic_store_n(&queue->is_failed, true, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    _upf_arena_init(worker->arena, _UPF_INITIAL_ARENA_SIZE);
+    while (!__atomic_load_n(&queue->is_failed, __ATOMIC_RELAXED)) {
+        size_t idx = __atomic_fetch_add(&queue->next, 1, __ATOMIC_RELAXED);
+        if (idx >= queue->length) break;
+
+        _upf_parse_unit(worker->arena, &_upf_state.module->units.data[queue->order[idx]]);
+    }
+
+    return NULL;
+}
+
+static int _upf_unit_size_compare(const void *a, const void *b) {
+    const _upf_unit *unit_a = &_upf_state.module->units.data[*((const size_t *) a)];
+    const _upf_unit *unit_b = &_upf_state.module->units.data[*((const size_t *) b)];
+    size_t size_a = unit_a->end - unit_a->base;
+    size_t size_b = unit_b->end - unit_b->base;
+    if (size_a > size_b) return -1;
+    if (size_a < size_b) return 1;
+    return 0;
+}
+
+// Parses all units using a pool of threads. Units are handed out in order of
+// decreasing size, one at a time, so that a single huge unit doesn't end up
+// at the end of some thread's share while the rest are idle.
+static void _upf_parse_units_parallel(void) {
+    size_t length = _upf_state.module->units.length;
+    size_t threads_count = UPRINTF_INIT_THREADS;
+    if (threads_count > length) threads_count = length;
+
+    // Abbreviation table cache isn't thread-safe, so it is filled beforehand.
+    // Same goes for mapping the split units' files.
+    for (size_t i = 0; i < length; i++) {
+        _upf_unit *unit = &_upf_state.module->units.data[i];
+        _upf_get_abbrev_table(unit->abbrev);
+        if (!unit->is_skeleton) continue;
+
+        if (unit->cu == NULL) unit->cu = _upf_parse_cu_root(&_upf_state.module->arena, unit);
+        _upf_load_split_unit(unit, unit->cu);
+        _upf_get_abbrev_table(unit->split->abbrev);
+    }
+    // Nor is parsing the roots of the partial units, which variables can reference.
+    for (size_t i = 0; i < _upf_state.module->partial_units.length; i++) {
+        _upf_get_cu_root(&_upf_state.module->partial_units.data[i]);
+    }
+    // Neither is decompression of the sections.
+    _upf_get_section(&_upf_state.module->dwarf.line_str);
+    _upf_get_section(&_upf_state.module->dwarf.str_offsets);
+    _upf_get_section(&_upf_state.module->dwarf.addr);
+    _upf_get_section(&_upf_state.module->dwarf.rnglists);
+
+    _upf_unit_queue queue = {
+        .order = (size_t *) _upf_arena_alloc(&_upf_state.module->arena, length * sizeof(*queue.order)),
+        .length = length,
+        .next = 0,
+        .is_failed = false,
+    };
+    for (size_t i = 0; i < length; i++) queue.order[i] = i;
+    qsort(queue.order, length, sizeof(*queue.order), _upf_unit_size_compare);
+
+    // Thread arenas must outlive the parsing since CUs point into them, so they
+    // are freed together with the module.
+    _upf_state.module->thread_arenas = (_upf_arena *) _upf_arena_alloc(&_upf_state.module->arena, UPRINTF_INIT_THREADS * sizeof(*_upf_state.module->thread_arenas));
+    memset(_upf_state.module->thread_arenas, 0, UPRINTF_INIT_THREADS * sizeof(*_upf_state.module->thread_arenas));
+
+    _upf_worker *workers = (_upf_worker *) _upf_arena_alloc(&_upf_state.module->arena, threads_count * sizeof(*workers));
+    pthread_t *threads = (pthread_t *) _upf_arena_alloc(&_upf_state.module->arena, threads_count * sizeof(*threads));
+    size_t started = 0;
+    for (; started < threads_count; started++) {
+        workers[started].queue = &queue;
+        workers[started].arena = &_upf_state.module->thread_arenas[started];
+        if (pthread_create(&threads[started], NULL, _upf_parse_units_worker, &workers[started]) != 0) break;
+    }
+
+    // The current thread finishes the remaining units in case some of the threads failed to start.
+    if (started < threads_count) _upf_parse_units_worker(&(_upf_worker){.queue = &queue, .arena = &_upf_state.module->thread_arenas[started]});
+    _upf_thread_jmp_buf = NULL;
+
+    for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+
+    // The error has already been reported by the thread which encountered it.
+    if (queue.is_failed) longjmp(_upf_state.jmp_buf, EXIT_FAILURE);
+}
+#endif
+
+static void _upf_add_unit_ranges(size_t unit_idx, _upf_range_vec ranges) {
+    for (size_t i = 0; i < ranges.length; i++) {
+        if (ranges.data[i].start == _UPF_INVALID || ranges.data[i].end == _UPF_INVALID) continue;
+        if (ranges.data[i].start >= ranges.data[i].end) continue;
+
+        _upf_unit_range range = {
+            .start = ranges.data[i].start,
+            .end = ranges.data[i].end,
+            .unit_idx = unit_idx,
+        };
+        // Only the ranges inferred by _upf_parse_cu start at 0 or end at UINT64_MAX.
+        if (range.start == 0 || range.end == UINT64_MAX) _UPF_VECTOR_PUSH(&_upf_state.module->inferred_unit_ranges, range);
+        else _UPF_VECTOR_PUSH(&_upf_state.module->unit_ranges, range);
+    }
+}
+
+static _upf_unit *_upf_find_unit_by_offset(uint64_t offset) {
+    const uint8_t *base = _upf_state.module->dwarf.die + offset;
+
+    size_t low = 0, high = _upf_state.module->units.length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (_upf_state.module->units.data[mid].base < base) low = mid + 1;
+        else high = mid;
+    }
+
+    if (low == _upf_state.module->units.length || _upf_state.module->units.data[low].base != base) return NULL;
+    return &_upf_state.module->units.data[low];
+}
+
+// Adds address ranges from .debug_aranges to the units they belong to. Returns
+// bitmap of units which got at least one range.
+static bool *_upf_parse_aranges(void) {
+    bool *has_ranges = (bool *) _upf_arena_alloc(&_upf_state.module->arena, _upf_state.module->units.length * sizeof(*has_ranges));
+    memset(has_ranges, 0, _upf_state.module->units.length * sizeof(*has_ranges));
+
+    const uint8_t *aranges = _upf_get_section(&_upf_state.module->dwarf.aranges);
+    const uint8_t *aranges_end = aranges + _upf_state.module->dwarf.aranges.size;
+    while (aranges < aranges_end) {
+        const uint8_t *set_base = aranges;
+
+        uint64_t length = 0;
+        memcpy(&length, aranges, sizeof(uint32_t));
+        aranges += sizeof(uint32_t);
+
+        uint8_t offset_size = 4;
+        if (length == 0xffffffffU) {
+            memcpy(&length, aranges, sizeof(uint64_t));
+            aranges += sizeof(uint64_t);
+            offset_size = 8;
+        }
+        const uint8_t *next = aranges + length;
+
+        uint16_t version = 0;
+        memcpy(&version, aranges, sizeof(version));
+        aranges += sizeof(version);
+        if (version != 2) {
+            aranges = next;
+            continue;
+        }
+
+        uint64_t unit_offset = 0;
+        memcpy(&unit_offset, aranges, offset_size);
+        aranges += offset_size;
+
+        uint8_t address_size = *aranges;
+        aranges += sizeof(address_size);
+        uint8_t segment_selector_size = *aranges;
+        aranges += sizeof(segment_selector_size);
+
+        _upf_unit *unit = _upf_find_unit_by_offset(unit_offset);
+        if (unit == NULL || segment_selector_size != 0 || address_size != sizeof(void *)) {
+            aranges = next;
+            continue;
+        }
+        size_t unit_idx = unit - _upf_state.module->units.data;
+
+        // Tuples are aligned to the size of a tuple from the beginning of the set.
+        size_t tuple_size = 2 * address_size;
+        size_t offset = aranges - set_base;
+        if (offset % tuple_size != 0) aranges += tuple_size - offset % tuple_size;
+
+        while (aranges + tuple_size <= next) {
+            _upf_range range = {0};
+            memcpy(&range.start, aranges, address_size);
+            aranges += address_size;
+            uint64_t range_length = 0;
+            memcpy(&range_length, aranges, address_size);
+            aranges += address_size;
+            if (range.start == 0 && range_length == 0) break;
+
+            range.end = range.start + range_length;
+            _upf_range_vec ranges = {
+                .arena = NULL,
+                .capacity = 1,
+                .length = 1,
+                .data = &range,
+            };
+            _upf_add_unit_ranges(unit_idx, ranges);
+            has_ranges[unit_idx] = true;
+        }
+
+        aranges = next;
+    }
+
+    return has_ranges;
+}
+
+static int _upf_unit_range_compare(const void *a, const void *b) {
+    const _upf_unit_range *range_a = (const _upf_unit_range *) a;
+    const _upf_unit_range *range_b = (const _upf_unit_range *) b;
+    if (range_a->start < range_b->start) return -1;
+    if (range_a->start > range_b->start) return 1;
+    return 0;
+}
+
+// Parses header of the unit which starts at the `base`.
+static _upf_unit_header _upf_parse_unit_header(const uint8_t *base) {
+    _UPF_ASSERT(base != NULL);
+
+    const uint8_t *die = base;
+    uint64_t length = 0;
+    memcpy(&length, die, sizeof(uint32_t));
+    die += sizeof(uint32_t);
+
+    _upf_state.module->dwarf.is64bit = false;
+    if (length == 0xffffffffU) {
+        memcpy(&length, die, sizeof(uint64_t));
+        die += sizeof(uint64_t);
+        _upf_state.module->dwarf.is64bit = true;
+    }
+
+    _upf_state.module->dwarf.offset_size = _upf_state.module->dwarf.is64bit ? 8 : 4;
+
+    _upf_unit_header header = {0};
+    header.end = die + length;
+
+    uint16_t version = 0;
+    memcpy(&version, die, sizeof(version));
+    die += sizeof(version);
+    if (version != 5) _UPF_ERROR("uprintf only supports DWARF version 5.");
+
+    header.type = *die;
+    die += sizeof(header.type);
+
+    uint8_t address_size = *die;
+    _UPF_ASSERT(_upf_state.module->dwarf.address_size == 0 || _upf_state.module->dwarf.address_size == address_size);
+    _upf_state.module->dwarf.address_size = address_size;
+    die += sizeof(address_size);
+
+    header.abbrev_offset = _upf_offset_cast(die);
+    die += _upf_state.module->dwarf.offset_size;
+
+    if (header.type == _UPF_DW_UT_skeleton || header.type == _UPF_DW_UT_split_compile) {
+        memcpy(&header.dwo_id, die, sizeof(header.dwo_id));
+        die += sizeof(header.dwo_id);
+    } else if (header.type == _UPF_DW_UT_type || header.type == _UPF_DW_UT_split_type) {
+        memcpy(&header.type_signature, die, sizeof(header.type_signature));
+        die += sizeof(header.type_signature);
+        header.type_offset = _upf_offset_cast(die);
+        die += _upf_state.module->dwarf.offset_size;
+    }
+
+    header.die = die;
+    return header;
+}
+
+// Adds the type unit to the module's index, unless a unit with the same
+// signature, which must then describe the same type, has already been added.
+static void _upf_add_type_unit(const uint8_t *base, const _upf_unit_header *header, const uint8_t *abbrev, const _upf_dwo *dwo) {
+    _UPF_ASSERT(base != NULL && header != NULL && abbrev != NULL);
+
+    uint64_t type_die;
+    if (header->type_signature == 0 || _upf_map_get(&_upf_state.module->type_signatures, header->type_signature, &type_die)) return;
+
+    _upf_unit *unit = (_upf_unit *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*unit));
+    *unit = (_upf_unit) {
+        .base = base,
+        .die = header->die,
+        .end = header->end,
+        .abbrev = abbrev + header->abbrev_offset,
+        .is_skeleton = false,
+        .dwo_id = 0,
+        .split = NULL,
+        .dwo = dwo,
+        .is_sup = false,
+        .is_parsed = false,
+        .cu = NULL,
+        .cached_cu = NULL,
+        .arena = {0},
+        .last_use = 0,
+    };
+    _UPF_VECTOR_PUSH(&_upf_state.module->type_units, unit);
+
+    type_die = (uint64_t) (base + header->type_offset);
+    _upf_map_set(&_upf_state.module->type_signatures, header->type_signature, type_die);
+    _upf_map_set(&_upf_state.module->type_unit_dies, type_die, _upf_state.module->type_units.length - 1);
+}
+
+static void _upf_add_referenced_units(const uint8_t *die, size_t die_size, const uint8_t *abbrev, bool is_sup) {
+    _UPF_ASSERT(die != NULL && abbrev != NULL);
+
+    const uint8_t *die_end = die + die_size;
+    while (die < die_end) {
+        _upf_unit_header header = _upf_parse_unit_header(die);
+        if (header.type == _UPF_DW_UT_type) _upf_add_type_unit(die, &header, abbrev, NULL);
+        if (header.type != _UPF_DW_UT_partial) {
+            die = header.end;
+            continue;
+        }
+
+        _upf_unit unit = {
+            .base = die,
+            .die = header.die,
+            .end = header.end,
+            .abbrev = abbrev + header.abbrev_offset,
+            .is_skeleton = false,
+            .dwo_id = 0,
+            .split = NULL,
+            .dwo = NULL,
+            .is_sup = is_sup,
+            .is_parsed = false,
+            .cu = NULL,
+            .cached_cu = NULL,
+            .arena = {0},
+            .last_use = 0,
+        };
+        _UPF_VECTOR_PUSH(&_upf_state.module->partial_units, unit);
+
+        die = header.end;
+    }
+}
+
+static int _upf_unit_base_compare(const void *a, const void *b) {
+    const _upf_unit *unit_a = (const _upf_unit *) a;
+    const _upf_unit *unit_b = (const _upf_unit *) b;
+    if (unit_a->base < unit_b->base) return -1;
+    if (unit_a->base > unit_b->base) return 1;
+    return 0;
+}
+
+static void _upf_advise_units(int advice) {
+    const _upf_dwarf *dwarf = &_upf_state.module->dwarf;
+    _upf_advise(dwarf->die, dwarf->die_size, advice);
+    if (dwarf->sup != NULL) _upf_advise(dwarf->sup->die, dwarf->sup->die_size, advice);
+}
+
+// Indexes the units which are only referenced by other units: type units by
+// their signatures, and partial units of dwz by their addresses. Only the
+// headers are read, since the units are parsed once their DIEs are needed.
+static void _upf_parse_referenced_units(void) {
+    const _upf_dwarf *dwarf = &_upf_state.module->dwarf;
+    _upf_add_referenced_units(dwarf->die, dwarf->die_size, dwarf->abbrev, false);
+    if (dwarf->sup != NULL) _upf_add_referenced_units(dwarf->sup->die, dwarf->sup->die_size, dwarf->sup->abbrev, true);
+
+    _upf_unit_vec *units = &_upf_state.module->partial_units;
+    if (units->length > 0) qsort(units->data, units->length, sizeof(*units->data), _upf_unit_base_compare);
+}
+
+// Builds index of units' address ranges without parsing their contents, which
+// happens on demand, once some PC lands in the unit (see _upf_get_cu).
+static void _upf_parse_dwarf(void) {
+    const uint8_t *die = _upf_state.module->dwarf.die;
+    const uint8_t *die_end = die + _upf_state.module->dwarf.die_size;
+
+    // Sections which are read in full are read ahead while the headers are walked.
+#if UPRINTF_INIT_THREADS > 0
+    _upf_advise(die, _upf_state.module->dwarf.die_size, _UPF_MADV_WILLNEED);
+#endif
+    _upf_section *aranges = &_upf_state.module->dwarf.aranges;
+    bool is_aranges_compressed = aranges->compressed != NULL;
+    if (!is_aranges_compressed) _upf_advise(aranges->data, aranges->size, _UPF_MADV_WILLNEED);
+
+    while (die < die_end) {
+        _upf_unit_header header = _upf_parse_unit_header(die);
+        // Type and partial units are indexed beforehand by _upf_parse_referenced_units.
+        if (header.type == _UPF_DW_UT_type || header.type == _UPF_DW_UT_partial) {
+            die = header.end;
+            continue;
+        }
+        _UPF_ASSERT(header.type == _UPF_DW_UT_compile || header.type == _UPF_DW_UT_skeleton);
+
+        _upf_unit unit = {
+            .base = die,
+            .die = header.die,
+            .end = header.end,
+            .abbrev = _upf_state.module->dwarf.abbrev + header.abbrev_offset,
+            .is_skeleton = header.type == _UPF_DW_UT_skeleton,
+            .dwo_id = header.dwo_id,
+            .split = NULL,
+            .dwo = NULL,
+            .is_sup = false,
+            .is_parsed = false,
+            .cu = NULL,
+            .cached_cu = NULL,
+            .arena = {0},
+            .last_use = 0,
+        };
+        _UPF_VECTOR_PUSH(&_upf_state.module->units, unit);
+        if (unit.is_skeleton) _upf_state.module->dwarf.has_skeleton_units = true;
+
+        die = header.end;
+    }
+
+#if UPRINTF_INIT_THREADS > 1
+    _upf_parse_units_parallel();
+#elif UPRINTF_INIT_THREADS == 1
+    for (size_t i = 0; i < _upf_state.module->units.length; i++) _upf_parse_unit(&_upf_state.module->arena, &_upf_state.module->units.data[i]);
+#endif
+
+    bool *has_aranges = NULL;
+    if (_upf_get_section(aranges) != NULL) {
+        has_aranges = _upf_parse_aranges();
+        // Ranges have been copied to unit_ranges, so the section isn't read again.
+        if (!is_aranges_compressed) _upf_advise(aranges->data, aranges->size, _UPF_MADV_DONTNEED);
+    }
+
+    // Units without .debug_aranges fall back to the ranges of their root DIE.
+    for (size_t i = 0; i < _upf_state.module->units.length; i++) {
+        if (has_aranges != NULL && has_aranges[i]) continue;
+
+        _upf_unit *unit = &_upf_state.module->units.data[i];
+        if (!unit->is_parsed) {
+            unit->cu = _upf_parse_cu_root(&_upf_state.module->arena, unit);
+            if (unit->cu == NULL) {
+                unit->is_parsed = true;
+                continue;
+            }
+
+            // Ranges of CUs without low or high PC are inferred from their scopes, which
+            // requires parsing the whole unit.
+            bool is_complete = true;
+            _upf_range_vec ranges = unit->cu->scope.ranges;
+            for (size_t j = 0; j < ranges.length; j++) {
+                if (ranges.data[j].start == _UPF_INVALID || ranges.data[j].end == _UPF_INVALID) is_complete = false;
+            }
+            if (!is_complete) _upf_parse_unit(&_upf_state.module->arena, unit);
+        }
+        if (unit->cu == NULL) continue;
+
+        _upf_add_unit_ranges(i, unit->cu->scope.ranges);
+        // Root is parsed again once the unit is needed, so that it gets an arena of its own.
+        if (!unit->is_parsed) unit->cu = NULL;
+    }
+
+    qsort(_upf_state.module->unit_ranges.data, _upf_state.module->unit_ranges.length, sizeof(*_upf_state.module->unit_ranges.data), _upf_unit_range_compare);
+}
+
+static _upf_unit *_upf_find_unit(uint64_t pc) {
+    _upf_unit_range_vec ranges = _upf_state.module->unit_ranges;
+
+    // Find the last range that starts at or before the PC.
+    size_t low = 0, high = ranges.length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (ranges.data[mid].start <= pc) low = mid + 1;
+        else high = mid;
+    }
+    if (low > 0 && pc < ranges.data[low - 1].end) return &_upf_state.module->units.data[ranges.data[low - 1].unit_idx];
+
+    ranges = _upf_state.module->inferred_unit_ranges;
+    for (size_t i = 0; i < ranges.length; i++) {
+        if (ranges.data[i].start <= pc && pc < ranges.data[i].end) return &_upf_state.module->units.data[ranges.data[i].unit_idx];
+    }
+    return NULL;
+}
+
+// Returns CU which contains the PC, parsing it if this is the first time it is needed.
+static _upf_cu *_upf_get_cu(uint64_t pc) {
+    _upf_unit *unit = _upf_find_unit(pc);
+    if (unit == NULL) return NULL;
+
+    return _upf_load_unit(unit);
+}
+
+// Case folding DJB hash used by .debug_names.
+static uint32_t _upf_names_hash(const char *name) {
+    _UPF_ASSERT(name != NULL);
+
+    uint32_t hash = 5381;
+    for (; *name != '\0'; name++) {
+        uint8_t c = *name;
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+        hash = hash * 33 + c;
+    }
+    return hash;
+}
+
+static uint64_t _upf_get_names_value(const uint8_t *entry, uint64_t form) {
+    _UPF_ASSERT(entry != NULL);
+
+    switch (form) {
+        case _UPF_DW_FORM_ref1:
+        case _UPF_DW_FORM_ref2:
+        case _UPF_DW_FORM_ref4:
+        case _UPF_DW_FORM_ref8:
+        case _UPF_DW_FORM_ref_udata:
+            return _upf_get_ref(entry, form);
+        case _UPF_DW_FORM_data1:
+        case _UPF_DW_FORM_data2:
+        case _UPF_DW_FORM_data4:
+        case _UPF_DW_FORM_data8:
+        case _UPF_DW_FORM_udata: {
+            _upf_attr attr = {
+                .name = 0,
+                .form = form,
+                .implicit_const = 0,
+            };
+            return _upf_get_data(entry, attr);
+        }
+        case _UPF_DW_FORM_flag_present:
+            return true;
+    }
+    _UPF_ERROR("Found unsupported form (0x%lx) in .debug_names.", form);
+}
+
+// Searches name indexes in .debug_names for the DIE of the type with the given
+// name inside of the unit. Returns NULL if there is no such type, or if the unit
+// isn't covered by any of the indexes.
+static const uint8_t *_upf_names_find_type(const _upf_unit *unit, const char *name) {
+    _UPF_ASSERT(unit != NULL && name != NULL);
+
+    // Entries of skeleton units point into their split units, which may not be loaded yet.
+    if (unit->is_skeleton) return NULL;
+
+    uint64_t unit_offset = unit->base - _upf_state.module->dwarf.die;
+    uint32_t hash = _upf_names_hash(name);
+
+    const uint8_t *names = _upf_get_section(&_upf_state.module->dwarf.names);
+    const uint8_t *names_end = names + _upf_state.module->dwarf.names.size;
+    while (names < names_end) {
+        uint64_t length = 0;
+        memcpy(&length, names, sizeof(uint32_t));
+        names += sizeof(uint32_t);
+
+        uint8_t offset_size = 4;
+        if (length == 0xffffffffU) {
+            memcpy(&length, names, sizeof(uint64_t));
+            names += sizeof(uint64_t);
+            offset_size = 8;
+        }
+        const uint8_t *next = names + length;
+
+        uint16_t version = 0;
+        memcpy(&version, names, sizeof(version));
+        names += sizeof(version) + sizeof(uint16_t);  // padding
+
+        uint32_t header[7];
+        memcpy(header, names, sizeof(header));
+        names += sizeof(header);
+        uint32_t cu_count = header[0];
+        uint32_t local_tu_count = header[1];
+        uint32_t foreign_tu_count = header[2];
+        uint32_t bucket_count = header[3];
+        uint32_t name_count = header[4];
+        uint32_t abbrevs_size = header[5];
+        uint32_t augmentation_size = header[6];
+        names += augmentation_size;
+
+        const uint8_t *cus = names;
+        names += cu_count * offset_size + local_tu_count * offset_size + foreign_tu_count * sizeof(uint64_t);
+        const uint8_t *buckets = names;
+        names += bucket_count * sizeof(uint32_t);
+        const uint8_t *hashes = names;
+        if (bucket_count > 0) names += name_count * sizeof(uint32_t);
+        const uint8_t *str_offsets = names;
+        names += name_count * offset_size;
+        const uint8_t *entry_offsets = names;
+        names += name_count * offset_size;
+        const uint8_t *abbrevs = names;
+        const uint8_t *entries = abbrevs + abbrevs_size;
+
+        uint64_t cu_idx = _UPF_INVALID;
+        for (uint32_t i = 0; i < cu_count && version == 5; i++) {
+            uint64_t offset = 0;
+            memcpy(&offset, cus + i * offset_size, offset_size);
+            if (offset == unit_offset) cu_idx = i;
+        }
+        if (cu_idx == _UPF_INVALID) {
+            names = next;
+            continue;
+        }
+
+        // Find range of names which may match: a bucket if there is a hash table, all of them otherwise.
+        uint32_t first = 0, last = name_count;
+        if (bucket_count > 0) {
+            uint32_t bucket = hash % bucket_count;
+            memcpy(&first, buckets + bucket * sizeof(uint32_t), sizeof(uint32_t));
+            // Bucket's names are 1-based, 0 marks empty bucket.
+            if (first == 0) return NULL;
+            first--;
+        }
+
+        const uint8_t *best = NULL;
+        for (uint32_t i = first; i < last; i++) {
+            if (bucket_count > 0) {
+                uint32_t name_hash;
+                memcpy(&name_hash, hashes + i * sizeof(uint32_t), sizeof(uint32_t));
+                if (name_hash % bucket_count != hash % bucket_count) break;
+                if (name_hash != hash) continue;
+            }
+
+            uint64_t str_offset = 0;
+            memcpy(&str_offset, str_offsets + i * offset_size, offset_size);
+            if (strcmp(_upf_state.module->dwarf.str + str_offset, name) != 0) continue;
+
+            uint64_t entry_offset = 0;
+            memcpy(&entry_offset, entry_offsets + i * offset_size, offset_size);
+            const uint8_t *entry = entries + entry_offset;
+            while (true) {
+                uint64_t code;
+                entry += _upf_uLEB_to_uint64(entry, &code);
+                if (code == 0) break;
+
+                // Abbreviation tables of indexes are tiny, so they are scanned instead of being parsed.
+                const uint8_t *abbrev = abbrevs;
+                uint64_t tag = 0;
+                while (true) {
+                    uint64_t abbrev_code, idx, form;
+                    abbrev += _upf_uLEB_to_uint64(abbrev, &abbrev_code);
+                    if (abbrev_code == 0) _UPF_ERROR("Unable to find abbreviation with code %lu in .debug_names.", code);
+                    abbrev += _upf_uLEB_to_uint64(abbrev, &tag);
+                    if (abbrev_code == code) break;
+
+                    do {
+                        abbrev += _upf_uLEB_to_uint64(abbrev, &idx);
+                        abbrev += _upf_uLEB_to_uint64(abbrev, &form);
+                    } while (idx != 0 || form != 0);
+                }
+
+                uint64_t entry_cu_idx = _UPF_INVALID;
+                uint64_t entry_tu_idx = _UPF_INVALID;
+                uint64_t die_offset = _UPF_INVALID;
+                while (true) {
+                    uint64_t idx, form;
+                    abbrev += _upf_uLEB_to_uint64(abbrev, &idx);
+                    abbrev += _upf_uLEB_to_uint64(abbrev, &form);
+                    if (idx == 0 && form == 0) break;
+
+                    if (idx == _UPF_DW_IDX_compile_unit) entry_cu_idx = _upf_get_names_value(entry, form);
+                    else if (idx == _UPF_DW_IDX_type_unit) entry_tu_idx = _upf_get_names_value(entry, form);
+                    else if (idx == _UPF_DW_IDX_die_offset) die_offset = _upf_get_names_value(entry, form);
+
+                    entry += _upf_get_attr_size(entry, form);
+                }
+                // Offsets of the entries in type units are relative to those units, and the
+                // CU only references their types by signatures, which the DIE walk resolves.
+                if (entry_tu_idx != _UPF_INVALID) continue;
+                // Index with a single CU may omit DW_IDX_compile_unit.
+                if (entry_cu_idx == _UPF_INVALID && cu_count == 1) entry_cu_idx = 0;
+                if (entry_cu_idx != cu_idx || die_offset == _UPF_INVALID) continue;
+
+                bool is_type = false;
+                switch (tag) {
+                    case _UPF_DW_TAG_array_type:
+                    case _UPF_DW_TAG_enumeration_type:
+                    case _UPF_DW_TAG_pointer_type:
+                    case _UPF_DW_TAG_structure_type:
+                    case _UPF_DW_TAG_typedef:
+                    case _UPF_DW_TAG_union_type:
+                    case _UPF_DW_TAG_base_type:
+                        is_type = true;
+                        break;
+                }
+                if (!is_type) continue;
+
+                // Same as the DIE walk, the first DIE with the name is used.
+                const uint8_t *die = unit->base + die_offset;
+                if (best == NULL || die < best) best = die;
+            }
+        }
+
+        return best;
+    }
+
+    return NULL;
+}
+
+// Returns root-only CU of the unit, which is enough for parsing types.
+static const _upf_cu *_upf_get_cu_root(_upf_unit *unit) {
+    _UPF_ASSERT(unit != NULL);
+
+    // Loading the whole unit from the cache is cheaper than parsing its root DIE.
+    if (unit->cached_cu != NULL) return _upf_load_unit(unit);
+
+    _upf_use_unit(unit);
+    if (unit->cu == NULL && !unit->is_parsed) {
+        unit->cu = _upf_parse_cu_root(_upf_get_unit_arena(unit), unit);
+        if (unit->cu == NULL) unit->is_parsed = true;
+    }
+    return unit->cu;
+}
+
+// ======================= ELF ============================
+
+static _upf_section _upf_get_elf_section(const uint8_t *file, const Elf64_Shdr *header, const char *name) {
+    _UPF_ASSERT(file != NULL && header != NULL && name != NULL);
+
+    _upf_section section = {
+        .name = name,
+        .data = file + header->sh_offset,
+        .size = header->sh_size,
+        .compressed = NULL,
+    };
+
+    if (header->sh_flags & SHF_COMPRESSED) {
+        Elf64_Chdr compression;
+        if (header->sh_size < sizeof(compression)) _UPF_ERROR("Invalid compressed section %s.", name);
+        memcpy(&compression, section.data, sizeof(compression));
+        if (compression.ch_size == 0) _UPF_ERROR("Invalid compressed section %s.", name);
+
+        section.size = compression.ch_size;
+        section.compressed = header;
+    }
+
+    return section;
+}
+
+// Maps the range of the file at the same offset from the start of the reserved address space.
+static bool _upf_map_file_range(uint8_t *file, int fd, uint64_t offset, uint64_t size) {
+    _UPF_ASSERT(file != NULL);
+
+    uint64_t page_size = sysconf(_SC_PAGESIZE);
+    uint64_t start = offset & ~(page_size - 1);
+    return mmap(file + start, offset + size - start, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, start) != MAP_FAILED;
+}
+
+// Sections which are read besides the debug ones: .ctf, the string tables of
+// its external strings, the compiler version and the links to other files.
+static bool _upf_is_read_section(const char *name) {
+    static const char *names[] = {".ctf", ".strtab", ".dynstr", ".comment", ".note.gnu.build-id", ".gnu_debuglink", ".gnu_debugaltlink"};
+
+    if (strncmp(name, ".debug_", strlen(".debug_")) == 0) return true;
+    for (size_t i = 0; i < sizeof(names) / sizeof(*names); i++) {
+        if (strcmp(name, names[i]) == 0) return true;
+    }
+    return false;
+}
+
+// Maps the headers and the sections which are read. Address space is reserved
+// for the whole file, so that the offsets in it are the same as in the file,
+// but the rest of it, e.g. the code, is never mapped. Returns NULL if the file
+// can't be opened or isn't a supported ELF file.
+static uint8_t *_upf_map_elf(const char *path, size_t *size) {
+    _UPF_ASSERT(path != NULL && size != NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return NULL;
+
+    struct stat file_info;
+    if (fstat(fd, &file_info) == -1 || (size_t) file_info.st_size < sizeof(Elf64_Ehdr)) {
+        close(fd);
+        return NULL;
+    }
+    *size = file_info.st_size;
+
+    uint8_t *file = (uint8_t *) mmap(NULL, *size, PROT_NONE, MAP_PRIVATE | _UPF_MAP_ANONYMOUS, -1, 0);
+    if (file == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    if (!_upf_map_file_range(file, fd, 0, sizeof(Elf64_Ehdr))) goto invalid_file;
+
+    const Elf64_Ehdr *header = (Elf64_Ehdr *) file;
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_VERSION] != 1
+        || header->e_machine != EM_X86_64 || header->e_version != 1 || header->e_shentsize != sizeof(Elf64_Shdr)
+        || header->e_shoff + header->e_shnum * sizeof(Elf64_Shdr) > *size || header->e_shstrndx >= header->e_shnum) {
+        goto invalid_file;
+    }
+    if (!_upf_map_file_range(file, fd, header->e_shoff, header->e_shnum * sizeof(Elf64_Shdr))) goto invalid_file;
+
+    const Elf64_Shdr *sections = (Elf64_Shdr *) (file + header->e_shoff);
+    const Elf64_Shdr *string_section = &sections[header->e_shstrndx];
+    if (string_section->sh_offset + string_section->sh_size > *size) goto invalid_file;
+    if (!_upf_map_file_range(file, fd, string_section->sh_offset, string_section->sh_size)) goto invalid_file;
+
+    const char *string_table = (char *) (file + string_section->sh_offset);
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        const Elf64_Shdr *section = &sections[i];
+        if (section->sh_type == SHT_NOBITS || section->sh_size == 0 || section->sh_offset + section->sh_size > *size) continue;
+        if (section->sh_name >= string_section->sh_size || !_upf_is_read_section(string_table + section->sh_name)) continue;
+
+        if (!_upf_map_file_range(file, fd, section->sh_offset, section->sh_size)) goto invalid_file;
+    }
+
+    close(fd);
+    return file;
+
+invalid_file:
+    munmap(file, *size);
+    close(fd);
+    return NULL;
+}
+
+static const Elf64_Shdr *_upf_find_elf_section(const uint8_t *file, const char *name) {
+    _UPF_ASSERT(file != NULL && name != NULL);
+
+    const Elf64_Ehdr *header = (Elf64_Ehdr *) file;
+    const Elf64_Shdr *sections = (Elf64_Shdr *) (file + header->e_shoff);
+    const char *string_table = (char *) (file + sections[header->e_shstrndx].sh_offset);
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        if (strcmp(string_table + sections[i].sh_name, name) == 0) return &sections[i];
+    }
+    return NULL;
+}
+
+// Debug files created by `objcopy --only-keep-debug` keep headers of all the
+// sections, but only the debug ones have contents.
+static bool _upf_has_debug_info(const uint8_t *file) {
+    const Elf64_Shdr *section = _upf_find_elf_section(file, ".debug_info");
+    return section != NULL && section->sh_type != SHT_NOBITS;
+}
+
+static const uint8_t *_upf_get_build_id(const uint8_t *file, size_t *size) {
+    _UPF_ASSERT(file != NULL && size != NULL);
+
+    const Elf64_Shdr *section = _upf_find_elf_section(file, ".note.gnu.build-id");
+    if (section == NULL || section->sh_size < sizeof(Elf64_Nhdr)) return NULL;
+
+    const Elf64_Nhdr *note = (const Elf64_Nhdr *) (file + section->sh_offset);
+    size_t name_size = (note->n_namesz + 3) & ~3;
+    if (note->n_type != NT_GNU_BUILD_ID || sizeof(*note) + name_size + note->n_descsz > section->sh_size) return NULL;
+
+    *size = note->n_descsz;
+    return (const uint8_t *) (note + 1) + name_size;
+}
+
+// CRC-32 which .gnu_debuglink uses to identify the debug file, the same as in zlib.
+static uint32_t _upf_crc32(const uint8_t *data, size_t size) {
+    _UPF_ASSERT(data != NULL);
+
+    uint32_t table[256];
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t crc = i;
+        for (int bit = 0; bit < 8; bit++) crc = (crc & 1) ? 0xedb88320U ^ (crc >> 1) : crc >> 1;
+        table[i] = crc;
+    }
+
+    uint32_t crc = 0xffffffffU;
+    for (size_t i = 0; i < size; i++) crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return crc ^ 0xffffffffU;
+}
+
+// Computes the CRC of the whole file, which is the only time it is read in full.
+static uint32_t _upf_get_file_crc32(const char *path) {
+    _UPF_ASSERT(path != NULL);
+
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return 0;
+
+    struct stat file_info;
+    if (fstat(fd, &file_info) == -1 || file_info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    uint8_t *file = (uint8_t *) mmap(NULL, file_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED) return 0;
+
+    _upf_advise(file, file_info.st_size, _UPF_MADV_SEQUENTIAL);
+    uint32_t crc = _upf_crc32(file, file_info.st_size);
+    munmap(file, file_info.st_size);
+    return crc;
+}
+
+// Maps the debug file if it exists and belongs to the executable, which is
+// checked by the build ID if the executable has one, or by the CRC otherwise.
+static bool _upf_try_debug_file(const char *path, const uint8_t *build_id, size_t build_id_size, uint32_t crc) {
+    _UPF_ASSERT(path != NULL);
+
+    size_t size;
+    uint8_t *file = _upf_map_elf(path, &size);
+    if (file == NULL) return false;
+
+    bool is_matching = _upf_has_debug_info(file);
+    if (is_matching && build_id != NULL) {
+        size_t file_build_id_size;
+        const uint8_t *file_build_id = _upf_get_build_id(file, &file_build_id_size);
+        is_matching = file_build_id != NULL && file_build_id_size == build_id_size && memcmp(file_build_id, build_id, build_id_size) == 0;
+    } else if (is_matching) {
+        is_matching = _upf_get_file_crc32(path) == crc;
+    }
+
+    if (!is_matching) {
+        munmap(file, size);
+        return false;
+    }
+
+    _upf_state.module->dwarf.path = path;
+    _upf_state.module->dwarf.file = file;
+    _upf_state.module->dwarf.file_size = size;
+    return true;
+}
+
+static const char *_upf_get_module_real_path(void) {
+    char *path = realpath(_upf_state.module->path, NULL);
+    if (path == NULL) return NULL;
+
+    const char *result = _upf_arena_string(&_upf_state.module->arena, path, path + strlen(path));
+    // Allocated by libc, regardless of UPRINTF_MALLOC.
+    free(path);
+    return result;
+}
+
+static const char *_upf_get_module_dir(void) {
+    const char *path = _upf_get_module_real_path();
+    if (path == NULL) return NULL;
+
+    const char *end = path + strlen(path);
+    while (end > path && end[-1] != '/') end--;
+    return end == path ? NULL : _upf_arena_string(&_upf_state.module->arena, path, end - 1);
+}
+
+// Returns the directories with debug files: the ones from UPRINTF_DEBUG_DIRS followed by /usr/lib/debug.
+static _upf_cstr_vec _upf_get_debug_dirs(void) {
+    _upf_cstr_vec dirs = _UPF_VECTOR_NEW(&_upf_state.module->arena);
+    const char *env_dirs = getenv("UPRINTF_DEBUG_DIRS");
+    if (env_dirs != NULL) {
+        while (*env_dirs != '\0') {
+            const char *end = strchr(env_dirs, ':');
+            if (end == NULL) end = env_dirs + strlen(env_dirs);
+            if (end > env_dirs) _UPF_VECTOR_PUSH(&dirs, _upf_arena_string(&_upf_state.module->arena, env_dirs, end));
+            env_dirs = *end == ':' ? end + 1 : end;
+        }
+    }
+    _UPF_VECTOR_PUSH(&dirs, "/usr/lib/debug");
+    return dirs;
+}
+
+// Finds separate debug file of the stripped module and maps it instead.
+// Looks in the same places as GDB: .build-id/xx/yyyy.debug in each of the debug
+// directories, then the file named by .gnu_debuglink in the module's directory,
+// its .debug subdirectory and its path under each debug directory.
+static bool _upf_load_debug_file(const uint8_t *file) {
+    _UPF_ASSERT(file != NULL);
+
+    size_t build_id_size = 0;
+    const uint8_t *build_id = _upf_get_build_id(file, &build_id_size);
+
+    const char *debuglink = NULL;
+    uint32_t crc = 0;
+    const Elf64_Shdr *debuglink_section = _upf_find_elf_section(file, ".gnu_debuglink");
+    if (debuglink_section != NULL) {
+        // Null-terminated file name, padded to 4 bytes, followed by the CRC.
+        const char *name = (const char *) (file + debuglink_section->sh_offset);
+        const char *name_end = (const char *) memchr(name, '\0', debuglink_section->sh_size);
+        if (name_end != NULL) {
+            size_t crc_offset = ((size_t) (name_end - name) + 4) & ~3UL;
+            if (crc_offset + sizeof(crc) <= debuglink_section->sh_size) {
+                debuglink = name;
+                memcpy(&crc, name + crc_offset, sizeof(crc));
+            }
+        }
+    }
+    if (build_id == NULL && debuglink == NULL) return false;
+
+    _upf_cstr_vec dirs = _upf_get_debug_dirs();
+
+    if (build_id != NULL && build_id_size > 1) {
+        const char *id = _upf_bytes_to_hex(&_upf_state.module->arena, build_id, build_id_size);
+        const char *prefix = _upf_arena_string(&_upf_state.module->arena, id, id + 2);
+        for (size_t i = 0; i < dirs.length; i++) {
+            const char *path = _upf_arena_concat(&_upf_state.module->arena, dirs.data[i], "/.build-id/", prefix, "/", id + 2, ".debug");
+            if (_upf_try_debug_file(path, build_id, build_id_size, crc)) return true;
+        }
+    }
+
+    const char *module_dir = _upf_get_module_dir();
+    if (debuglink == NULL || module_dir == NULL) return false;
+
+    const char *path = _upf_arena_concat(&_upf_state.module->arena, module_dir, "/", debuglink);
+    if (_upf_try_debug_file(path, build_id, build_id_size, crc)) return true;
+
+    path = _upf_arena_concat(&_upf_state.module->arena, module_dir, "/.debug/", debuglink);
+    if (_upf_try_debug_file(path, build_id, build_id_size, crc)) return true;
+
+    for (size_t i = 0; i < dirs.length; i++) {
+        path = _upf_arena_concat(&_upf_state.module->arena, dirs.data[i], module_dir, "/", debuglink);
+        if (_upf_try_debug_file(path, build_id, build_id_size, crc)) return true;
+    }
+
+    return false;
+}
+
+// Returns false if the module has neither DWARF nor CTF.
+static bool _upf_parse_elf(void) {
+    size_t size;
+    uint8_t *file = _upf_map_elf(_upf_state.module->path, &size);
+    if (file == NULL) return false;
+    _upf_state.module->dwarf.file = file;
+    _upf_state.module->dwarf.file_size = size;
+
+    // Only the debug file stays mapped, since the addresses are translated using
+    // the segments of the loaded module rather than the file. Without the debug
+    // file, the module itself stays mapped if it has CTF, which strip keeps.
+    if (!_upf_has_debug_info(file)) {
+        if (_upf_load_debug_file(file)) {
+            munmap(file, size);
+            file = _upf_state.module->dwarf.file;
+        } else if (_upf_find_elf_section(file, ".ctf") == NULL) {
+            munmap(file, size);
+            _upf_state.module->dwarf.file = NULL;
+            return false;
+        }
+    }
+
+    const Elf64_Ehdr *header = (Elf64_Ehdr *) file;
+    const Elf64_Shdr *string_section = (Elf64_Shdr *) (file + header->e_shoff + header->e_shstrndx * header->e_shentsize);
+    const char *string_table = (char *) (file + string_section->sh_offset);
+
+    _upf_section info = {0}, abbrev = {0}, str = {0};
+    const Elf64_Shdr *section = (Elf64_Shdr *) (file + header->e_shoff);
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        const char *name = string_table + section->sh_name;
+
+        if (strcmp(name, ".debug_info") == 0) {
+            info = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_abbrev") == 0) {
+            abbrev = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_str") == 0) {
+            str = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_line_str") == 0) {
+            _upf_state.module->dwarf.line_str = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_str_offsets") == 0) {
+            _upf_state.module->dwarf.str_offsets = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_rnglists") == 0) {
+            _upf_state.module->dwarf.rnglists = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_addr") == 0) {
+            _upf_state.module->dwarf.addr = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_names") == 0) {
+            _upf_state.module->dwarf.names = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".debug_aranges") == 0) {
+            _upf_state.module->dwarf.aranges = _upf_get_elf_section(file, section, name);
+        } else if (strcmp(name, ".ctf") == 0) {
+            _upf_state.module->ctf.section = _upf_get_elf_section(file, section, name);
+        }
+
+        section++;
+    }
+
+    // Modules with only CTF don't have any units, thus all the lookups besides typenames fail.
+    if (info.name == NULL || abbrev.name == NULL || str.name == NULL) return _upf_state.module->ctf.section.name != NULL;
+
+    _upf_state.module->dwarf.build_id = _upf_get_build_id(file, &_upf_state.module->dwarf.build_id_size);
+
+    _upf_state.module->dwarf.die = _upf_get_section(&info);
+    _upf_state.module->dwarf.die_size = info.size;
+    _upf_state.module->dwarf.abbrev = _upf_get_section(&abbrev);
+    _upf_state.module->dwarf.str = (const char *) _upf_get_section(&str);
+    return true;
+}
+
+// ===================== SPLIT DWARF ======================
+
+// Units compiled with -gsplit-dwarf are split in two: the skeleton unit in the
+// module only has the address ranges, while the rest is in the split unit of
+// the .dwo file named by the skeleton, or of the .dwp package which combines all
+// the .dwo files of the module. Files are only mapped once their units are parsed.
+
+static const uint8_t *_upf_get_dwo_section(const uint8_t *file, const char *name, size_t *size) {
+    _UPF_ASSERT(file != NULL && name != NULL);
+
+    const Elf64_Shdr *header = _upf_find_elf_section(file, name);
+    if (header == NULL) return NULL;
+
+    _upf_section section = _upf_get_elf_section(file, header, name);
+    if (size != NULL) *size = section.size;
+    return _upf_get_section(&section);
+}
+
+// Parses index of the package's units (see DWARF 5 section 7.3.5). Returns false if it is invalid.
+static bool _upf_parse_dwp_index(const uint8_t *data, size_t size, _upf_dwp_index *index) {
+    _UPF_ASSERT(index != NULL);
+
+    memset(index, 0, sizeof(*index));
+    if (data == NULL || size < 4 * sizeof(uint32_t)) return false;
+
+    uint16_t version;
+    memcpy(&version, data, sizeof(version));
+    memcpy(&index->columns_count, data + sizeof(uint32_t), sizeof(index->columns_count));
+    memcpy(&index->units_count, data + 2 * sizeof(uint32_t), sizeof(index->units_count));
+    memcpy(&index->slots_count, data + 3 * sizeof(uint32_t), sizeof(index->slots_count));
+    if (version != 5 || index->slots_count == 0 || (index->slots_count & (index->slots_count - 1)) != 0) {
+        index->slots_count = 0;
+        return false;
+    }
+
+    uint64_t index_size = 4 * sizeof(uint32_t) + (uint64_t) index->slots_count * (sizeof(uint64_t) + sizeof(uint32_t))
+                          + (uint64_t) index->columns_count * sizeof(uint32_t)
+                          + 2 * (uint64_t) index->units_count * index->columns_count * sizeof(uint32_t);
+    if (index_size > size) {
+        index->slots_count = 0;
+        return false;
+    }
+
+    index->signatures = data + 4 * sizeof(uint32_t);
+    index->rows = index->signatures + index->slots_count * sizeof(uint64_t);
+    index->section_ids = index->rows + index->slots_count * sizeof(uint32_t);
+    index->offsets = index->section_ids + index->columns_count * sizeof(uint32_t);
+    index->sizes = index->offsets + index->units_count * index->columns_count * sizeof(uint32_t);
+    return true;
+}
+
+// Finds the row of the unit with the signature using the index's hash table.
+// Returns 0 if there is no such unit.
+static uint32_t _upf_find_dwp_row(const _upf_dwp_index *index, uint64_t signature) {
+    _UPF_ASSERT(index != NULL);
+
+    if (index->slots_count == 0) return 0;
+
+    // Open addressing with double hashing, where rows are 1-based and 0 marks an empty slot.
+    uint32_t mask = index->slots_count - 1;
+    uint32_t slot = signature & mask;
+    uint32_t step = ((signature >> 32) & mask) | 1;
+    for (uint32_t i = 0; i < index->slots_count; i++) {
+        uint64_t slot_signature;
+        uint32_t row;
+        memcpy(&slot_signature, index->signatures + slot * sizeof(uint64_t), sizeof(slot_signature));
+        memcpy(&row, index->rows + slot * sizeof(uint32_t), sizeof(row));
+        if (row == 0) return 0;
+        if (slot_signature == signature) return row <= index->units_count ? row : 0;
+        slot = (slot + step) & mask;
+    }
+    return 0;
+}
+
+// Narrows the package down to the contributions of the unit in the row. Returns false if they are invalid.
+static bool _upf_get_dwp_row(const _upf_dwo_file *dwp, const _upf_dwp_index *index, uint32_t row, _upf_dwo_file *result) {
+    _UPF_ASSERT(dwp != NULL && index != NULL && row > 0 && row <= index->units_count && result != NULL);
+
+    *result = *dwp;
+    memset(&result->cu_index, 0, sizeof(result->cu_index));
+    memset(&result->tu_index, 0, sizeof(result->tu_index));
+    for (uint32_t i = 0; i < index->columns_count; i++) {
+        uint32_t section_id, offset, size;
+        size_t cell = ((size_t) (row - 1) * index->columns_count + i) * sizeof(uint32_t);
+        memcpy(&section_id, index->section_ids + i * sizeof(uint32_t), sizeof(section_id));
+        memcpy(&offset, index->offsets + cell, sizeof(offset));
+        memcpy(&size, index->sizes + cell, sizeof(size));
+
+        switch (section_id) {
+            case _UPF_DW_SECT_info:
+                if (offset + (uint64_t) size > dwp->die_size) return false;
+                result->die += offset;
+                result->die_size = size;
+                break;
+            case _UPF_DW_SECT_abbrev:
+                result->abbrev += offset;
+                break;
+            case _UPF_DW_SECT_str_offsets:
+                if (result->str_offsets != NULL) result->str_offsets += offset;
+                break;
+            case _UPF_DW_SECT_rnglists:
+                if (result->rnglists != NULL) result->rnglists += offset;
+                break;
+        }
+    }
+    return true;
+}
+
+static const _upf_dwo *_upf_get_dwo(const _upf_dwo_file *file) {
+    _UPF_ASSERT(file != NULL);
+
+    _upf_dwo *dwo = (_upf_dwo *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*dwo));
+    dwo->str = file->str;
+    dwo->str_offsets = file->str_offsets;
+    dwo->rnglists = file->rnglists;
+    return dwo;
+}
+
+// Adds the type units of the file, which may be referenced by any of the split units.
+static void _upf_add_split_type_units(const _upf_dwo_file *file) {
+    _UPF_ASSERT(file != NULL);
+
+    const _upf_dwo *dwo = NULL;
+    const uint8_t *die = file->die;
+    const uint8_t *die_end = die + file->die_size;
+    while (die < die_end) {
+        _upf_unit_header header = _upf_parse_unit_header(die);
+        if (header.type == _UPF_DW_UT_split_type) {
+            if (dwo == NULL) dwo = _upf_get_dwo(file);
+            _upf_add_type_unit(die, &header, file->abbrev, dwo);
+        }
+        die = header.end;
+    }
+}
+
+// Adds the type units of the .dwo file. Unlike packages, .dwo files keep each
+// type unit in its own COMDAT group, i.e. in a separate .debug_info.dwo section,
+// so the section with the split unit is selected for the file.
+static void _upf_add_dwo_type_units(const uint8_t *file, _upf_dwo_file *dwo_file) {
+    _UPF_ASSERT(file != NULL && dwo_file != NULL);
+
+    const Elf64_Ehdr *header = (Elf64_Ehdr *) file;
+    const Elf64_Shdr *sections = (Elf64_Shdr *) (file + header->e_shoff);
+    const char *string_table = (char *) (file + sections[header->e_shstrndx].sh_offset);
+    for (size_t i = 0; i < header->e_shnum; i++) {
+        const char *name = string_table + sections[i].sh_name;
+        if (strcmp(name, ".debug_info.dwo") != 0) continue;
+
+        _upf_section section = _upf_get_elf_section(file, &sections[i], name);
+        _upf_dwo_file contributions = *dwo_file;
+        contributions.die = _upf_get_section(&section);
+        contributions.die_size = section.size;
+        _upf_add_split_type_units(&contributions);
+
+        _upf_unit_header unit_header = _upf_parse_unit_header(contributions.die);
+        if (unit_header.type == _UPF_DW_UT_split_compile) {
+            dwo_file->die = contributions.die;
+            dwo_file->die_size = contributions.die_size;
+        }
+    }
+}
+
+// Maps the .dwo file or .dwp package. Returns NULL if it can't be opened or doesn't contain split units.
+static const _upf_dwo_file *_upf_map_dwo_file(const char *path) {
+    _UPF_ASSERT(path != NULL);
+
+    size_t size;
+    uint8_t *file = _upf_map_elf(path, &size);
+    if (file == NULL) return NULL;
+
+    if (_upf_find_elf_section(file, ".debug_info.dwo") == NULL || _upf_find_elf_section(file, ".debug_abbrev.dwo") == NULL
+        || _upf_find_elf_section(file, ".debug_str.dwo") == NULL) {
+        munmap(file, size);
+        return NULL;
+    }
+
+    _upf_mapping mapping = {
+        .data = file,
+        .size = size,
+    };
+    _UPF_VECTOR_PUSH(&_upf_state.module->dwarf.mappings, mapping);
+
+    _upf_dwo_file *dwo_file = (_upf_dwo_file *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*dwo_file));
+    dwo_file->die = _upf_get_dwo_section(file, ".debug_info.dwo", &dwo_file->die_size);
+    dwo_file->abbrev = _upf_get_dwo_section(file, ".debug_abbrev.dwo", NULL);
+    dwo_file->str = (const char *) _upf_get_dwo_section(file, ".debug_str.dwo", NULL);
+    dwo_file->str_offsets = _upf_get_dwo_section(file, ".debug_str_offsets.dwo", NULL);
+    dwo_file->rnglists = _upf_get_dwo_section(file, ".debug_rnglists.dwo", NULL);
+
+    size_t cu_index_size = 0, tu_index_size = 0;
+    const uint8_t *cu_index = _upf_get_dwo_section(file, ".debug_cu_index", &cu_index_size);
+    const uint8_t *tu_index = _upf_get_dwo_section(file, ".debug_tu_index", &tu_index_size);
+    bool is_package = _upf_parse_dwp_index(cu_index, cu_index_size, &dwo_file->cu_index);
+
+    // Type units of a package have their own contributions, e.g. to .debug_abbrev.dwo.
+    if (!is_package) {
+        _upf_add_dwo_type_units(file, dwo_file);
+    } else if (_upf_parse_dwp_index(tu_index, tu_index_size, &dwo_file->tu_index)) {
+        for (uint32_t row = 1; row <= dwo_file->tu_index.units_count; row++) {
+            _upf_dwo_file contributions;
+            if (_upf_get_dwp_row(dwo_file, &dwo_file->tu_index, row, &contributions)) _upf_add_split_type_units(&contributions);
+        }
+    }
+
+    return dwo_file;
+}
+
+// Returns the module's package, which is looked up next to it, i.e. a.out.dwp for a.out.
+static const _upf_dwo_file *_upf_get_dwp(void) {
+    _upf_dwarf *dwarf = &_upf_state.module->dwarf;
+    if (dwarf->is_dwp_attempted) return dwarf->dwp;
+    dwarf->is_dwp_attempted = true;
+
+    const char *path = _upf_get_module_real_path();
+    if (path == NULL) return NULL;
+
+    const _upf_dwo_file *dwp = _upf_map_dwo_file(_upf_arena_concat(&_upf_state.module->arena, path, ".dwp"));
+    if (dwp != NULL && dwp->cu_index.slots_count > 0) dwarf->dwp = dwp;
+    return dwarf->dwp;
+}
+
+// Finds the split unit with the ID among the units of the file.
+static bool _upf_find_split_unit(const _upf_dwo_file *file, uint64_t dwo_id, _upf_unit *unit) {
+    _UPF_ASSERT(file != NULL && unit != NULL);
+
+    const uint8_t *die = file->die;
+    const uint8_t *die_end = die + file->die_size;
+    while (die < die_end) {
+        _upf_unit_header header = _upf_parse_unit_header(die);
+        if (header.type != _UPF_DW_UT_split_compile || header.dwo_id != dwo_id) {
+            die = header.end;
+            continue;
+        }
+
+        _upf_unit split = {
+            .base = die,
+            .die = header.die,
+            .end = header.end,
+            .abbrev = file->abbrev + header.abbrev_offset,
+            .is_skeleton = false,
+            .dwo_id = dwo_id,
+            .split = NULL,
+            .dwo = _upf_get_dwo(file),
+            .is_sup = false,
+            .is_parsed = false,
+            .cu = NULL,
+            .cached_cu = NULL,
+            .arena = {0},
+            .last_use = 0,
+        };
+        *unit = split;
+        return true;
+    }
+    return false;
+}
+
+// Finds the split unit of the skeleton unit, first in the module's package, then
+// in the .dwo file named by the skeleton. Its relative path is resolved against
+// the compilation directory, or the module's directory in case the build was moved.
+static void _upf_load_split_unit(_upf_unit *unit, const _upf_cu *skeleton) {
+    _UPF_ASSERT(unit != NULL && unit->is_skeleton && skeleton != NULL);
+
+    if (unit->split != NULL) return;
+
+    _upf_unit *split = (_upf_unit *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*split));
+
+    const _upf_dwo_file *dwp = _upf_get_dwp();
+    uint32_t row = dwp == NULL ? 0 : _upf_find_dwp_row(&dwp->cu_index, unit->dwo_id);
+    _upf_dwo_file contributions;
+    if (row != 0 && _upf_get_dwp_row(dwp, &dwp->cu_index, row, &contributions)
+        && _upf_find_split_unit(&contributions, unit->dwo_id, split)) {
+        unit->split = split;
+        return;
+    }
+
+    const uint8_t *die = unit->die;
+    uint64_t code;
+    die += _upf_uLEB_to_uint64(die, &code);
+    const _upf_abbrev *abbrev = _upf_get_abbrev(skeleton, code);
+
+    _upf_attr attr;
+    const uint8_t *dwo_name_die = _upf_find_attr(die, abbrev, _UPF_DW_AT_dwo_name, &attr);
+    if (dwo_name_die == NULL) _UPF_ERROR("Unable to find name of the .dwo file in skeleton unit.");
+    const char *dwo_name = _upf_get_str(skeleton, dwo_name_die, attr.form);
+
+    const uint8_t *comp_dir_die = _upf_find_attr(die, abbrev, _UPF_DW_AT_comp_dir, &attr);
+    const char *comp_dir = comp_dir_die == NULL ? NULL : _upf_get_str(skeleton, comp_dir_die, attr.form);
+
+    _upf_cstr_vec paths = _UPF_VECTOR_NEW(&_upf_state.module->arena);
+    if (dwo_name[0] == '/') {
+        _UPF_VECTOR_PUSH(&paths, dwo_name);
+    } else {
+        if (comp_dir != NULL) _UPF_VECTOR_PUSH(&paths, _upf_arena_concat(&_upf_state.module->arena, comp_dir, "/", dwo_name));
+
+        const char *module_dir = _upf_get_module_dir();
+        const char *file_name = strrchr(dwo_name, '/');
+        file_name = file_name == NULL ? dwo_name : file_name + 1;
+        if (module_dir != NULL) _UPF_VECTOR_PUSH(&paths, _upf_arena_concat(&_upf_state.module->arena, module_dir, "/", file_name));
+    }
+
+    for (size_t i = 0; i < paths.length; i++) {
+        const _upf_dwo_file *file = _upf_map_dwo_file(paths.data[i]);
+        if (file != NULL && _upf_find_split_unit(file, unit->dwo_id, split)) {
+            unit->split = split;
+            return;
+        }
+    }
+
+    _UPF_ERROR(
+        "Unable to find split unit in \"%s\". Ensure that the .dwo files, or the .dwp package next to the executable, "
+        "are available.",
+        dwo_name);
+}
+
+// ================= SUPPLEMENTARY FILE ===================
+
+// dwz moves DIEs which are duplicated across units to partial units, that are
+// referenced with DW_FORM_ref_addr. With `dwz -m`, the ones shared by several
+// modules go to the supplementary file, which the module names in .gnu_debugaltlink
+// (or .debug_sup in DWARF 5), and are referenced with DW_FORM_GNU_ref_alt or
+// DW_FORM_ref_sup4/8, while its strings are referenced with DW_FORM_GNU_strp_alt
+// or DW_FORM_strp_sup.
+
+static bool _upf_try_sup_file(const char *path, const uint8_t *build_id, size_t build_id_size) {
+    _UPF_ASSERT(path != NULL);
+
+    size_t size;
+    uint8_t *file = _upf_map_elf(path, &size);
+    if (file == NULL) return false;
+
+    const Elf64_Shdr *info_header = _upf_find_elf_section(file, ".debug_info");
+    const Elf64_Shdr *abbrev_header = _upf_find_elf_section(file, ".debug_abbrev");
+    const Elf64_Shdr *str_header = _upf_find_elf_section(file, ".debug_str");
+    bool is_matching = info_header != NULL && abbrev_header != NULL && str_header != NULL;
+    if (is_matching && build_id_size > 0) {
+        size_t file_build_id_size;
+        const uint8_t *file_build_id = _upf_get_build_id(file, &file_build_id_size);
+        is_matching = file_build_id != NULL && file_build_id_size == build_id_size && memcmp(file_build_id, build_id, build_id_size) == 0;
+    }
+
+    if (!is_matching) {
+        munmap(file, size);
+        return false;
+    }
+
+    _upf_mapping mapping = {
+        .data = file,
+        .size = size,
+    };
+    _UPF_VECTOR_PUSH(&_upf_state.module->dwarf.mappings, mapping);
+
+    _upf_section info = _upf_get_elf_section(file, info_header, ".debug_info");
+    _upf_section abbrev = _upf_get_elf_section(file, abbrev_header, ".debug_abbrev");
+    _upf_section str = _upf_get_elf_section(file, str_header, ".debug_str");
+
+    _upf_sup_file *sup = (_upf_sup_file *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*sup));
+    sup->die = _upf_get_section(&info);
+    sup->die_size = info.size;
+    sup->abbrev = _upf_get_section(&abbrev);
+    sup->str = (const char *) _upf_get_section(&str);
+    _upf_state.module->dwarf.sup = sup;
+    return true;
+}
+
+// Maps the supplementary file, if the module has one. It is looked up like GDB
+// does: at the path from the link, which is relative to the directory of the
+// file with the link, then as .build-id/xx/yyyy.debug in each of the debug
+// directories, since its build ID is in the link too.
+static void _upf_load_sup_file(void) {
+    const uint8_t *file = _upf_state.module->dwarf.file;
+
+    const char *name = NULL;
+    const uint8_t *build_id = NULL;
+    size_t build_id_size = 0;
+    const Elf64_Shdr *section = _upf_find_elf_section(file, ".gnu_debugaltlink");
+    if (section != NULL) {
+        // Null-terminated file name followed by the build ID.
+        const char *data = (const char *) (file + section->sh_offset);
+        const char *name_end = (const char *) memchr(data, '\0', section->sh_size);
+        if (name_end == NULL) return;
+
+        name = data;
+        build_id = (const uint8_t *) name_end + 1;
+        build_id_size = section->sh_size - (name_end + 1 - data);
+    } else if ((section = _upf_find_elf_section(file, ".debug_sup")) != NULL) {
+        // Version, is_supplementary flag, null-terminated file name, and the checksum with its ULEB length.
+        const uint8_t *data = file + section->sh_offset;
+        const uint8_t *data_end = data + section->sh_size;
+        if (section->sh_size < sizeof(uint16_t) + sizeof(uint8_t) + 1) return;
+        const char *name_start = (const char *) (data + sizeof(uint16_t) + sizeof(uint8_t));
+        const char *name_end = (const char *) memchr(name_start, '\0', data_end - (const uint8_t *) name_start);
+        if (name_end == NULL || data[sizeof(uint16_t)] != 0) return;
+
+        name = name_start;
+        uint64_t checksum_size;
+        const uint8_t *checksum = (const uint8_t *) name_end + 1;
+        checksum += _upf_uLEB_to_uint64(checksum, &checksum_size);
+        if (checksum + checksum_size > data_end) return;
+        build_id = checksum;
+        build_id_size = checksum_size;
+    } else {
+        return;
+    }
+    _upf_state.module->dwarf.sup_name = name;
+
+    if (name[0] == '/') {
+        if (_upf_try_sup_file(name, build_id, build_id_size)) return;
+    } else {
+        const char *path = _upf_state.module->dwarf.path;
+        const char *end = path == NULL ? NULL : strrchr(path, '/');
+        const char *dir = end == NULL ? _upf_get_module_dir() : _upf_arena_string(&_upf_state.module->arena, path, end);
+        if (dir != NULL && _upf_try_sup_file(_upf_arena_concat(&_upf_state.module->arena, dir, "/", name), build_id, build_id_size)) return;
+    }
+
+    if (build_id_size > 1) {
+        _upf_cstr_vec dirs = _upf_get_debug_dirs();
+        const char *id = _upf_bytes_to_hex(&_upf_state.module->arena, build_id, build_id_size);
+        const char *prefix = _upf_arena_string(&_upf_state.module->arena, id, id + 2);
+        for (size_t i = 0; i < dirs.length; i++) {
+            const char *path = _upf_arena_concat(&_upf_state.module->arena, dirs.data[i], "/.build-id/", prefix, "/", id + 2, ".debug");
+            if (_upf_try_sup_file(path, build_id, build_id_size)) return;
+        }
+    }
+}
+
+// ======================= CTF ============================
+
+// CTF (-gctf) is a compact format which only describes the types, without any
+// scopes or variables. Its dictionaries are indexed when the module is
+// initialized, which takes a single pass over the type records, and the types
+// are converted to _upf_type once typenames are looked up. They are keyed by
+// their records in the type map, like DWARF types by their DIEs. Only version 3,
+// which GCC and ld produce, is supported.
+
+#define _UPF_CTF_MAGIC 0xdff2
+#define _UPF_CTF_VERSION_3 4
+#define _UPF_CTF_F_COMPRESS 0x1
+#define _UPF_CTF_F_DYNSTR 0x8
+#define _UPF_CTF_ARCHIVE_MAGIC 0x8b47f2a4d7623eebULL
+// Types of the child dictionary have the flag in their IDs, and the other IDs refer to the parent.
+#define _UPF_CTF_CHILD_FLAG 0x80000000U
+// Names with the flag are in the external string table.
+#define _UPF_CTF_EXTERNAL_FLAG 0x80000000U
+// Size of the type which doesn't fit into 32 bits follows the record.
+#define _UPF_CTF_LSIZE_SENT 0xffffffffU
+// Members of the structs of this size and larger have 64-bit offsets.
+#define _UPF_CTF_LSTRUCT_THRESH 536870912
+
+#define _UPF_CTF_K_INTEGER 1
+#define _UPF_CTF_K_FLOAT 2
+#define _UPF_CTF_K_POINTER 3
+#define _UPF_CTF_K_ARRAY 4
+#define _UPF_CTF_K_FUNCTION 5
+#define _UPF_CTF_K_STRUCT 6
+#define _UPF_CTF_K_UNION 7
+#define _UPF_CTF_K_ENUM 8
+#define _UPF_CTF_K_FORWARD 9
+#define _UPF_CTF_K_TYPEDEF 10
+#define _UPF_CTF_K_VOLATILE 11
+#define _UPF_CTF_K_CONST 12
+#define _UPF_CTF_K_RESTRICT 13
+#define _UPF_CTF_K_SLICE 14
+
+#define _UPF_CTF_INT_SIGNED 0x1
+#define _UPF_CTF_INT_CHAR 0x2
+#define _UPF_CTF_INT_BOOL 0x4
+
+#define _UPF_CTF_FP_SINGLE 1
+#define _UPF_CTF_FP_DOUBLE 2
+#define _UPF_CTF_FP_CPLX 3
+#define _UPF_CTF_FP_DCPLX 4
+#define _UPF_CTF_FP_LDCPLX 5
+#define _UPF_CTF_FP_LDOUBLE 6
+#define _UPF_CTF_FP_IMAGRY 10
+#define _UPF_CTF_FP_DIMAGRY 11
+#define _UPF_CTF_FP_LDIMAGRY 12
+
+typedef struct {
+    uint16_t magic;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t parent_label;
+    uint32_t parent_name;
+    uint32_t cu_name;
+    uint32_t label_offset;
+    uint32_t object_offset;
+    uint32_t function_offset;
+    uint32_t object_index_offset;
+    uint32_t function_index_offset;
+    uint32_t var_offset;
+    // Offsets of the sections from the end of the header.
+    uint32_t type_offset;
+    uint32_t str_offset;
+    uint32_t str_size;
+} _upf_ctf_header;
+
+// Archive which ld creates when types of some units conflict, with the parent
+// dictionary named ".ctf" and a child dictionary for each such unit.
+typedef struct {
+    uint64_t magic;
+    uint64_t model;
+    uint64_t dicts_count;
+    uint64_t names_offset;
+    uint64_t dicts_offset;
+} _upf_ctf_archive;
+
+typedef struct {
+    uint64_t name_offset;
+    uint64_t dict_offset;
+} _upf_ctf_archive_member;
+
+// Type record with its fixed part decoded.
+typedef struct {
+    const char *name;
+    uint32_t kind;
+    bool is_root;
+    uint32_t vlen;
+    uint64_t size;
+    // Referenced type of the kinds that have one, in place of the size.
+    uint32_t type;
+    // Data which depends on the kind, e.g. members.
+    const uint8_t *data;
+} _upf_ctf_type;
+
+static uint32_t _upf_find_ctf_type(const char *name, bool is_any_dict);
+
+static uint32_t _upf_ctf_uint32(const uint8_t *data) {
+    _UPF_ASSERT(data != NULL);
+
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+static uint16_t _upf_ctf_uint16(const uint8_t *data) {
+    _UPF_ASSERT(data != NULL);
+
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+// Returns NULL for the empty name of anonymous types.
+static const char *_upf_get_ctf_str(const _upf_ctf_dict *dict, uint32_t offset) {
+    _UPF_ASSERT(dict != NULL);
+
+    const char *str = dict->str;
+    size_t size = dict->str_size;
+    if (offset & _UPF_CTF_EXTERNAL_FLAG) {
+        str = dict->ext_str;
+        size = dict->ext_str_size;
+        offset &= ~_UPF_CTF_EXTERNAL_FLAG;
+    }
+
+    if (str == NULL || offset >= size || str[offset] == '\0') return NULL;
+    return str + offset;
+}
+
+static _upf_ctf_type _upf_read_ctf_type(const _upf_ctf_dict *dict, const uint8_t *record) {
+    _UPF_ASSERT(dict != NULL && record != NULL);
+
+    uint32_t info = _upf_ctf_uint32(record + sizeof(uint32_t));
+    uint32_t size = _upf_ctf_uint32(record + 2 * sizeof(uint32_t));
+    _upf_ctf_type type = {
+        .name = _upf_get_ctf_str(dict, _upf_ctf_uint32(record)),
+        .kind = info >> 26,
+        .is_root = (info >> 25) & 1,
+        .vlen = info & 0xffffff,
+        .size = size,
+        .type = size,
+        .data = record + 3 * sizeof(uint32_t),
+    };
+
+    if (size == _UPF_CTF_LSIZE_SENT) {
+        type.size = ((uint64_t) _upf_ctf_uint32(type.data) << 32) | _upf_ctf_uint32(type.data + sizeof(uint32_t));
+        type.data += 2 * sizeof(uint32_t);
+    }
+
+    return type;
+}
+
+static size_t _upf_get_ctf_data_size(const _upf_ctf_type *type) {
+    _UPF_ASSERT(type != NULL);
+
+    switch (type->kind) {
+        case _UPF_CTF_K_INTEGER:
+        case _UPF_CTF_K_FLOAT:
+            return sizeof(uint32_t);
+        case _UPF_CTF_K_ARRAY:
+            return 3 * sizeof(uint32_t);
+        case _UPF_CTF_K_FUNCTION:
+            // Arguments are padded to the even number.
+            return ((type->vlen + 1) & ~1U) * sizeof(uint32_t);
+        case _UPF_CTF_K_STRUCT:
+        case _UPF_CTF_K_UNION:
+            return type->vlen * (type->size >= _UPF_CTF_LSTRUCT_THRESH ? 4 : 3) * sizeof(uint32_t);
+        case _UPF_CTF_K_ENUM:
+            return type->vlen * 2 * sizeof(uint32_t);
+        case _UPF_CTF_K_SLICE:
+            return sizeof(uint32_t) + 2 * sizeof(uint16_t);
+        default:
+            return 0;
+    }
+}
+
+// Types which can be found by their names. Forward declarations aren't, so that
+// names lead to the complete types, and neither are the types which aren't
+// root, since they duplicate the root ones, e.g. integers of bit fields.
+static bool _upf_is_ctf_named_type(const _upf_ctf_type *type) {
+    _UPF_ASSERT(type != NULL);
+    return type->is_root && type->name != NULL && type->kind != _UPF_CTF_K_FORWARD;
+}
+
+// Returns the record of the type, and switches to the parent dictionary if the
+// ID refers to it. Returns NULL for ID 0, which CTF uses for void.
+static const uint8_t *_upf_get_ctf_record(const _upf_ctf_dict **dict, uint32_t id) {
+    _UPF_ASSERT(dict != NULL && *dict != NULL);
+
+    if ((*dict)->parent != NULL && !(id & _UPF_CTF_CHILD_FLAG)) *dict = (*dict)->parent;
+    id &= ~_UPF_CTF_CHILD_FLAG;
+
+    if (id == 0) return NULL;
+    if (id >= (*dict)->records.length) _UPF_ERROR("Invalid CTF type ID (0x%x).", id);
+    return (*dict)->records.data[id];
+}
+
+// GCC represents void as an integer without any bits.
+static bool _upf_is_ctf_void(const _upf_ctf_dict *dict, uint32_t id) {
+    _UPF_ASSERT(dict != NULL);
+
+    const uint8_t *record = _upf_get_ctf_record(&dict, id);
+    if (record == NULL) return true;
+
+    _upf_ctf_type type = _upf_read_ctf_type(dict, record);
+    return type.kind == _UPF_CTF_K_INTEGER && (_upf_ctf_uint32(type.data) & 0xffff) == 0;
+}
+
+static int64_t _upf_get_ctf_int_encoding(uint32_t flags) {
+    if (flags & _UPF_CTF_INT_BOOL) return _UPF_DW_ATE_boolean;
+    if (flags & _UPF_CTF_INT_CHAR) return flags & _UPF_CTF_INT_SIGNED ? _UPF_DW_ATE_signed_char : _UPF_DW_ATE_unsigned_char;
+    return flags & _UPF_CTF_INT_SIGNED ? _UPF_DW_ATE_signed : _UPF_DW_ATE_unsigned;
+}
+
+// Returns DWARF encoding of the float format, or 0 if it has no equivalent.
+static int64_t _upf_get_ctf_float_encoding(uint32_t format) {
+    switch (format) {
+        case _UPF_CTF_FP_SINGLE:
+        case _UPF_CTF_FP_DOUBLE:
+        case _UPF_CTF_FP_LDOUBLE:
+            return _UPF_DW_ATE_float;
+        case _UPF_CTF_FP_CPLX:
+        case _UPF_CTF_FP_DCPLX:
+        case _UPF_CTF_FP_LDCPLX:
+            return _UPF_DW_ATE_complex_float;
+        case _UPF_CTF_FP_IMAGRY:
+        case _UPF_CTF_FP_DIMAGRY:
+        case _UPF_CTF_FP_LDIMAGRY:
+            return _UPF_DW_ATE_imaginary_float;
+        default:
+            return 0;
+    }
+}
+
+static int _upf_get_ctf_type_modifier(uint32_t kind) {
+    // clang-format off
+    switch (kind) {
+        case _UPF_CTF_K_CONST:    return _UPF_MOD_CONST;
+        case _UPF_CTF_K_VOLATILE: return _UPF_MOD_VOLATILE;
+        case _UPF_CTF_K_RESTRICT: return _UPF_MOD_RESTRICT;
+    }
+    // clang-format on
+    _UPF_UNREACHABLE();
+}
+
+// Fills in the same type as _upf_parse_type would from the equivalent DWARF.
+static uint32_t _upf_parse_ctf_type(const _upf_ctf_dict *dict, uint32_t id) {
+    _UPF_ASSERT(dict != NULL);
+
+    const uint8_t *record = _upf_get_ctf_record(&dict, id);
+    if (record == NULL) {
+        _upf_type type = {
+            .kind = _UPF_TK_VOID,
+            .modifiers = 0,
+            .first = 0,
+            .size = _UPF_INVALID,
+            .count = 0,
+            .type = _UPF_NO_TYPE,
+            .name = _upf_intern_type_name("void"),
+        };
+        return _upf_add_type(NULL, type);
+    }
+
+    uint64_t cached_type_idx;
+    if (_upf_map_get(&_upf_state.type_idxs, (uint64_t) record, &cached_type_idx)) return cached_type_idx;
+
+    _upf_ctf_type ctf = _upf_read_ctf_type(dict, record);
+    const char *name = ctf.name;
+    switch (ctf.kind) {
+        case _UPF_CTF_K_INTEGER: {
+            uint32_t encoding = _upf_ctf_uint32(ctf.data);
+            if ((encoding & 0xffff) == 0) {
+                _upf_type type = {
+                    .kind = _UPF_TK_VOID,
+                    .modifiers = 0,
+                    .first = 0,
+                    .size = _UPF_INVALID,
+                    .count = 0,
+                    .type = _UPF_NO_TYPE,
+                    .name = _upf_add_type_name(name ? name : "void"),
+                };
+                return _upf_add_type(record, type);
+            }
+
+            _UPF_ASSERT(name != NULL);
+            _upf_type type = {
+                .kind = _upf_get_type_kind(_upf_get_ctf_int_encoding(encoding >> 24), ctf.size),
+                .modifiers = 0,
+                .first = 0,
+                .size = ctf.size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
+            };
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_FLOAT: {
+            uint32_t format = _upf_ctf_uint32(ctf.data) >> 24;
+            int64_t encoding = _upf_get_ctf_float_encoding(format);
+            if (encoding == 0) {
+                _UPF_WARN("Found unsupported CTF float format (%u). Ignoring this type.", format);
+                goto unknown_type;
+            }
+
+            _UPF_ASSERT(name != NULL);
+            _upf_type type = {
+                .kind = _upf_get_type_kind(encoding, ctf.size),
+                .modifiers = 0,
+                .first = 0,
+                .size = ctf.size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
+            };
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_ARRAY: {
+            // Multidimensional arrays are nested arrays in CTF, but a single array
+            // with a length for each dimension in DWARF.
+            uint32_t first = _upf_state.lengths.length;
+            const _upf_ctf_dict *element_dict = dict;
+            _upf_ctf_type array = ctf;
+            uint32_t element_id;
+            size_t dimensions = 0;
+            bool is_static = true;
+            while (true) {
+                dimensions++;
+                uint32_t length = _upf_ctf_uint32(array.data + 2 * sizeof(uint32_t));
+                // Flexible array members have no length.
+                if (length == 0) is_static = false;
+                if (is_static) _UPF_VECTOR_PUSH(&_upf_state.lengths, length);
+                else _upf_state.lengths.length = first;
+
+                element_id = _upf_ctf_uint32(array.data);
+                const _upf_ctf_dict *next_dict = element_dict;
+                const uint8_t *next_record = _upf_get_ctf_record(&next_dict, element_id);
+                if (next_record == NULL) break;
+
+                _upf_ctf_type next = _upf_read_ctf_type(next_dict, next_record);
+                if (next.kind != _UPF_CTF_K_ARRAY) break;
+                element_dict = next_dict;
+                array = next;
+            }
+
+            // Element type may have its own lengths, so the range is taken before it is parsed.
+            uint32_t count = _upf_state.lengths.length - first;
+            size_t *lengths = &_upf_state.lengths.data[first];
+            if (_upf_state.module->ctf.is_array_reversed) {
+                for (size_t i = 0; i < count / 2; i++) {
+                    size_t length = lengths[i];
+                    lengths[i] = lengths[count - 1 - i];
+                    lengths[count - 1 - i] = length;
+                }
+            }
+
+            _upf_type type = {
+                .kind = _UPF_TK_ARRAY,
+                .modifiers = 0,
+                .first = first,
+                .size = _UPF_INVALID,
+                .count = count,
+                .type = _upf_parse_ctf_type(element_dict, element_id),
+                .name = _upf_add_type_name(name),
+            };
+
+            const _upf_type *element_type = _upf_get_type(type.type);
+            const char *element_name = _upf_get_name(element_type->name);
+            if (element_name != NULL && type.name == 0) {
+                for (size_t i = 0; i < dimensions; i++) element_name = _upf_arena_concat(&_upf_state.scratch_arena, element_name, "[]");
+                type.name = _upf_add_type_name(element_name);
+            }
+
+            if (is_static && element_type->size != _UPF_INVALID) {
+                type.size = element_type->size;
+                for (uint32_t i = 0; i < type.count; i++) type.size *= _upf_get_length(&type, i);
+            }
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_ENUM: {
+            _upf_type type = {
+                .kind = _UPF_TK_ENUM,
+                .modifiers = 0,
+                .first = _upf_state.enums.length,
+                .size = ctf.size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name ? name : "enum"),
+            };
+
+            bool is_signed = false;
+            for (uint32_t i = 0; i < ctf.vlen; i++) {
+                const uint8_t *entry = ctf.data + i * 2 * sizeof(uint32_t);
+                const char *enum_name = _upf_get_ctf_str(dict, _upf_ctf_uint32(entry));
+                _UPF_ASSERT(enum_name != NULL);
+                _upf_enum cenum = {
+                    .value = (int32_t) _upf_ctf_uint32(entry + sizeof(uint32_t)),
+                    .name = _upf_add_type_name(enum_name),
+                };
+                if (cenum.value < 0) is_signed = true;
+
+                _UPF_VECTOR_PUSH(&_upf_state.enums, cenum);
+                type.count++;
+            }
+
+            // CTF doesn't have the underlying type, so it is picked the same way as GCC does it.
+            _upf_type underlying_type = {
+                .kind = _upf_get_type_kind(is_signed ? _UPF_DW_ATE_signed : _UPF_DW_ATE_unsigned, ctf.size),
+                .modifiers = 0,
+                .first = 0,
+                .size = ctf.size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_intern_type_name(is_signed ? "int" : "unsigned int"),
+            };
+            type.type = _upf_add_type(NULL, underlying_type);
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_POINTER: {
+            _upf_type type = {
+                .kind = _UPF_TK_POINTER,
+                .modifiers = 0,
+                .first = 0,
+                .size = sizeof(void *),
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name),
+            };
+
+            // Added before the data gets filled in for the same reason as in _upf_parse_type.
+            uint32_t type_idx = _upf_add_type(record, type);
+
+            if (!_upf_is_ctf_void(dict, ctf.type)) {
+                uint32_t subtype_idx = _upf_parse_ctf_type(dict, ctf.type);
+                _upf_type *type = &_upf_state.types.data[type_idx];
+                type->type = subtype_idx;
+                type->name = _upf_get_type(subtype_idx)->name;
+            }
+
+            return type_idx;
+        }
+        case _UPF_CTF_K_STRUCT:
+        case _UPF_CTF_K_UNION: {
+            bool is_struct = ctf.kind == _UPF_CTF_K_STRUCT;
+            _upf_type type = {
+                .kind = is_struct ? _UPF_TK_STRUCT : _UPF_TK_UNION,
+                .modifiers = 0,
+                .first = 0,
+                .size = ctf.size,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name ? name : (is_struct ? "struct" : "union")),
+            };
+
+            bool is_large = ctf.size >= _UPF_CTF_LSTRUCT_THRESH;
+            const uint8_t *data = ctf.data;
+            uint32_t stack_start = _upf_state.member_stack.length;
+            for (uint32_t i = 0; i < ctf.vlen; i++) {
+                const char *member_name = _upf_get_ctf_str(dict, _upf_ctf_uint32(data));
+                uint32_t member_type;
+                uint64_t bit_offset;
+                if (is_large) {
+                    bit_offset = ((uint64_t) _upf_ctf_uint32(data + sizeof(uint32_t)) << 32) | _upf_ctf_uint32(data + 3 * sizeof(uint32_t));
+                    member_type = _upf_ctf_uint32(data + 2 * sizeof(uint32_t));
+                    data += 4 * sizeof(uint32_t);
+                } else {
+                    bit_offset = _upf_ctf_uint32(data + sizeof(uint32_t));
+                    member_type = _upf_ctf_uint32(data + 2 * sizeof(uint32_t));
+                    data += 3 * sizeof(uint32_t);
+                }
+
+                uint64_t offset = bit_offset / 8;
+                _upf_member member = {
+                    .name = 0,
+                    .type = _UPF_NO_TYPE,
+                    .offset = 0,
+                    .bit_size = 0,
+                };
+
+                // Bit fields are slices of their types, whose offset is relative to the member.
+                const _upf_ctf_dict *member_dict = dict;
+                const uint8_t *member_record = _upf_get_ctf_record(&member_dict, member_type);
+                _upf_ctf_type slice;
+                if (member_record != NULL && (slice = _upf_read_ctf_type(member_dict, member_record)).kind == _UPF_CTF_K_SLICE) {
+                    offset = bit_offset + _upf_ctf_uint16(slice.data + sizeof(uint32_t));
+                    member.bit_size = _upf_ctf_uint16(slice.data + sizeof(uint32_t) + sizeof(uint16_t));
+                    member.type = _upf_parse_ctf_type(member_dict, _upf_ctf_uint32(slice.data));
+                } else {
+                    member.type = _upf_parse_ctf_type(dict, member_type);
+                }
+
+                _UPF_ASSERT(member_name != NULL && member.type != _UPF_NO_TYPE);
+                if (offset > UINT32_MAX) {
+                    _UPF_WARN("Member offsets above 4 GiB aren't supported. Skipping this field.");
+                    continue;
+                }
+                member.name = _upf_add_type_name(member_name);
+                member.offset = offset;
+                _UPF_VECTOR_PUSH(&_upf_state.member_stack, member);
+            }
+            _upf_pool_members(&type, stack_start);
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_FUNCTION: {
+            _upf_type type = {
+                .kind = _UPF_TK_FUNCTION,
+                .modifiers = 0,
+                .first = 0,
+                .size = _UPF_INVALID,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = 0,
+            };
+
+            if (!_upf_is_ctf_void(dict, ctf.type)) {
+                type.type = _upf_parse_ctf_type(dict, ctf.type);
+            }
+
+            uint32_t stack_start = _upf_state.arg_type_stack.length;
+            for (uint32_t i = 0; i < ctf.vlen; i++) {
+                uint32_t arg = _upf_ctf_uint32(ctf.data + i * sizeof(uint32_t));
+                // Variadic functions have 0 as the last argument.
+                if (arg == 0 && i == ctf.vlen - 1) break;
+
+                uint32_t arg_type = _upf_parse_ctf_type(dict, arg);
+                _UPF_VECTOR_PUSH(&_upf_state.arg_type_stack, arg_type);
+            }
+            _upf_pool_arg_types(&type, stack_start);
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_FORWARD: {
+            // Unit's dictionary may only have the declaration of the type defined in another one.
+            if (name != NULL) {
+                uint32_t type_idx = _upf_find_ctf_type(name, true);
+                if (type_idx != _UPF_NO_TYPE) {
+                    _upf_map_set(&_upf_state.type_idxs, (uint64_t) record, type_idx);
+                    return type_idx;
+                }
+            }
+
+            if (ctf.type != _UPF_CTF_K_STRUCT && ctf.type != _UPF_CTF_K_UNION) goto unknown_type;
+
+            bool is_struct = ctf.type == _UPF_CTF_K_STRUCT;
+            _upf_type type = {
+                .kind = is_struct ? _UPF_TK_STRUCT : _UPF_TK_UNION,
+                .modifiers = 0,
+                .first = 0,
+                .size = _UPF_INVALID,
+                .count = 0,
+                .type = _UPF_NO_TYPE,
+                .name = _upf_add_type_name(name ? name : (is_struct ? "struct" : "union")),
+            };
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_TYPEDEF: {
+            _UPF_ASSERT(name != NULL);
+
+            uint32_t type_idx = _upf_parse_ctf_type(dict, ctf.type);
+            _upf_type type = *_upf_get_type(type_idx);
+            type.name = _upf_add_type_name(name);
+
+            if (type.kind == _UPF_TK_SCHAR && strcmp(name, "int8_t") == 0) type.kind = _UPF_TK_S1;
+            else if (type.kind == _UPF_TK_UCHAR && strcmp(name, "uint8_t") == 0) type.kind = _UPF_TK_U1;
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_VOLATILE:
+        case _UPF_CTF_K_CONST:
+        case _UPF_CTF_K_RESTRICT: {
+            uint32_t type_idx = _upf_parse_ctf_type(dict, ctf.type);
+            _upf_type type = *_upf_get_type(type_idx);
+            type.modifiers |= _upf_get_ctf_type_modifier(ctf.kind);
+
+            return _upf_add_type(record, type);
+        }
+        case _UPF_CTF_K_SLICE:
+            return _upf_parse_ctf_type(dict, _upf_ctf_uint32(ctf.data));
+        default:
+            _UPF_WARN("Found unsupported CTF type (%u). Ignoring it.", ctf.kind);
+            break;
+    }
+
+    _upf_type type;
+unknown_type:
+    type = (_upf_type){
+        .kind = _UPF_TK_UNKNOWN,
+        .modifiers = 0,
+        .first = 0,
+        .size = ctf.size,
+        .count = 0,
+        .type = _UPF_NO_TYPE,
+        .name = _upf_add_type_name(name),
+    };
+    return _upf_add_type(record, type);
+}
+
+// Finds the type by its name. Types from the child dictionaries are only found
+// if is_any_dict is set, since they differ between the units.
+static uint32_t _upf_find_ctf_type(const char *name, bool is_any_dict) {
+    _UPF_ASSERT(name != NULL);
+
+    const _upf_ctf *ctf = &_upf_state.module->ctf;
+    if (ctf->dicts.length == 0) return _UPF_NO_TYPE;
+
+    uint64_t value;
+    if (!_upf_map_get(&ctf->names, _upf_string_hash(name), &value)) return _UPF_NO_TYPE;
+
+    const _upf_ctf_dict *dict = ctf->dicts.data[value >> 32];
+    uint32_t idx = value & ~_UPF_CTF_CHILD_FLAG;
+    if (dict->parent != NULL && !is_any_dict) return _UPF_NO_TYPE;
+    if (strcmp(_upf_read_ctf_type(dict, dict->records.data[idx]).name, name) == 0) return _upf_parse_ctf_type(dict, (uint32_t) value);
+
+    // Hash collision
+    for (size_t i = 0; i < ctf->dicts.length; i++) {
+        dict = ctf->dicts.data[i];
+        if (dict->parent != NULL && !is_any_dict) break;
+
+        for (uint32_t j = 1; j < dict->records.length; j++) {
+            _upf_ctf_type type = _upf_read_ctf_type(dict, dict->records.data[j]);
+            if (!_upf_is_ctf_named_type(&type) || strcmp(type.name, name) != 0) continue;
+
+            return _upf_parse_ctf_type(dict, (dict->parent != NULL ? _UPF_CTF_CHILD_FLAG : 0) | j);
+        }
+    }
+    return _UPF_NO_TYPE;
+}
+
+// Indexes records of the dictionary. Returns NULL if the dictionary is invalid or unsupported.
+static _upf_ctf_dict *_upf_parse_ctf_dict(const uint8_t *data, size_t size, const _upf_ctf_dict *parent) {
+    _UPF_ASSERT(data != NULL);
+
+    _upf_ctf_header header;
+    if (size < sizeof(header)) goto invalid_dict;
+    memcpy(&header, data, sizeof(header));
+    if (header.magic != _UPF_CTF_MAGIC) goto invalid_dict;
+    if (header.version != _UPF_CTF_VERSION_3) {
+        _UPF_WARN("Only CTF version 3 is supported (found format version %d). Ignoring CTF.", header.version);
+        return NULL;
+    }
+
+    const uint8_t *body = data + sizeof(header);
+    size_t body_size = size - sizeof(header);
+    uint64_t used_size = (uint64_t) header.str_offset + header.str_size;
+    if (header.flags & _UPF_CTF_F_COMPRESS) {
+        // Everything after the header is compressed with zlib. Like decompressed
+        // sections, it is kept separately from the arena.
+        uint8_t *out = (uint8_t *) mmap(NULL, used_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | _UPF_MAP_ANONYMOUS, -1, 0);
+        if (out == MAP_FAILED) _UPF_OUT_OF_MEMORY();
+        _upf_mapping mapping = {
+            .data = out,
+            .size = used_size,
+        };
+        _UPF_VECTOR_PUSH(&_upf_state.module->dwarf.mappings, mapping);
+
+        _upf_inflate(".ctf", body, body_size, out, used_size);
+        body = out;
+        body_size = used_size;
+    }
+    if (header.type_offset > header.str_offset || used_size > body_size) goto invalid_dict;
+
+    _upf_ctf_dict *dict = (_upf_ctf_dict *) _upf_arena_alloc(&_upf_state.module->arena, sizeof(*dict));
+    dict->str = (const char *) body + header.str_offset;
+    dict->str_size = header.str_size;
+    dict->ext_str = NULL;
+    dict->ext_str_size = 0;
+    dict->parent = parent;
+    _UPF_VECTOR_INIT(&dict->records, &_upf_state.module->arena);
+    _UPF_VECTOR_PUSH(&dict->records, NULL);
+
+    const Elf64_Shdr *ext_str = _upf_find_elf_section(_upf_state.module->dwarf.file, header.flags & _UPF_CTF_F_DYNSTR ? ".dynstr" : ".strtab");
+    if (ext_str != NULL && ext_str->sh_type != SHT_NOBITS) {
+        dict->ext_str = (const char *) (_upf_state.module->dwarf.file + ext_str->sh_offset);
+        dict->ext_str_size = ext_str->sh_size;
+    }
+
+    const uint8_t *record = body + header.type_offset;
+    const uint8_t *end = body + header.str_offset;
+    while (record < end) {
+        size_t fixed_size = 3 * sizeof(uint32_t);
+        if ((size_t) (end - record) < fixed_size) goto invalid_dict;
+        if (_upf_ctf_uint32(record + 2 * sizeof(uint32_t)) == _UPF_CTF_LSIZE_SENT) fixed_size += 2 * sizeof(uint32_t);
+        if ((size_t) (end - record) < fixed_size) goto invalid_dict;
+
+        _upf_ctf_type type = _upf_read_ctf_type(dict, record);
+        size_t data_size = _upf_get_ctf_data_size(&type);
+        if ((size_t) (end - type.data) < data_size) goto invalid_dict;
+
+        _UPF_VECTOR_PUSH(&dict->records, record);
+        record = type.data + data_size;
+    }
+
+    return dict;
+
+invalid_dict:
+    _UPF_WARN("Found invalid CTF dictionary. Ignoring it.");
+    return NULL;
+}
+
+// Returns false if the archive's member is invalid.
+static bool _upf_get_ctf_archive_member(const uint8_t *data, size_t size, const _upf_ctf_archive *archive, uint64_t idx,
+                                        const char **name, const uint8_t **dict, size_t *dict_size) {
+    _UPF_ASSERT(data != NULL && archive != NULL && name != NULL && dict != NULL && dict_size != NULL);
+
+    _upf_ctf_archive_member member;
+    memcpy(&member, data + sizeof(*archive) + idx * sizeof(member), sizeof(member));
+    if (archive->names_offset >= size || member.name_offset >= size - archive->names_offset) return false;
+    if (archive->dicts_offset >= size || member.dict_offset >= size - archive->dicts_offset) return false;
+
+    uint64_t member_size;
+    const uint8_t *member_data = data + archive->dicts_offset + member.dict_offset;
+    if ((size_t) (data + size - member_data) < sizeof(member_size)) return false;
+    memcpy(&member_size, member_data, sizeof(member_size));
+    member_data += sizeof(member_size);
+    if (member_size > (size_t) (data + size - member_data)) return false;
+
+    *name = (const char *) (data + archive->names_offset + member.name_offset);
+    *dict = member_data;
+    *dict_size = member_size;
+    return true;
+}
+
+// Checks whether the module was compiled by GCC older than 14, according to .comment.
+static bool _upf_is_old_gcc(void) {
+    const uint8_t *file = _upf_state.module->dwarf.file;
+    const Elf64_Shdr *section = _upf_find_elf_section(file, ".comment");
+    if (section == NULL || section->sh_type == SHT_NOBITS) return false;
+
+    // Null-terminated strings such as "GCC: (Debian 12.2.0-14) 12.2.0".
+    const char *comment = (const char *) (file + section->sh_offset);
+    const char *end = comment + section->sh_size;
+    while (comment < end) {
+        const char *string_end = (const char *) memchr(comment, '\0', end - comment);
+        if (string_end == NULL) break;
+
+        if (strncmp(comment, "GCC: ", 5) == 0) {
+            const char *version = strrchr(comment, ' ');
+            if (version != NULL && atoi(version + 1) < 14) return true;
+        }
+        comment = string_end + 1;
+    }
+    return false;
+}
+
+// Indexes the module's CTF: records of each dictionary, and names of all the
+// types, preferring the parent dictionary. Returns false if there is no CTF.
+static bool _upf_parse_ctf(void) {
+    _upf_ctf *ctf = &_upf_state.module->ctf;
+    _UPF_VECTOR_INIT(&ctf->dicts, &_upf_state.module->arena);
+    _upf_map_init(&ctf->names, &_upf_state.module->arena);
+    if (ctf->section.name == NULL) return false;
+
+    const uint8_t *data = _upf_get_section(&ctf->section);
+    size_t size = ctf->section.size;
+    ctf->is_array_reversed = _upf_is_old_gcc();
+
+    uint64_t magic = 0;
+    if (size >= sizeof(magic)) memcpy(&magic, data, sizeof(magic));
+    if (magic != _UPF_CTF_ARCHIVE_MAGIC) {
+        _upf_ctf_dict *dict = _upf_parse_ctf_dict(data, size, NULL);
+        if (dict != NULL) _UPF_VECTOR_PUSH(&ctf->dicts, dict);
+    } else {
+        _upf_ctf_archive archive;
+        if (size < sizeof(archive)) goto invalid_archive;
+        memcpy(&archive, data, sizeof(archive));
+        if (archive.dicts_count > (size - sizeof(archive)) / sizeof(_upf_ctf_archive_member)) goto invalid_archive;
+
+        // Children refer to the parent, so it is parsed first.
+        const char *name;
+        const uint8_t *dict_data;
+        size_t dict_size;
+        uint64_t parent_idx = archive.dicts_count;
+        for (uint64_t i = 0; i < archive.dicts_count; i++) {
+            if (!_upf_get_ctf_archive_member(data, size, &archive, i, &name, &dict_data, &dict_size)) goto invalid_archive;
+            if (strcmp(name, ".ctf") == 0) parent_idx = i;
+        }
+        if (parent_idx == archive.dicts_count) goto invalid_archive;
+
+        _upf_get_ctf_archive_member(data, size, &archive, parent_idx, &name, &dict_data, &dict_size);
+        _upf_ctf_dict *parent = _upf_parse_ctf_dict(dict_data, dict_size, NULL);
+        if (parent == NULL) return false;
+        _UPF_VECTOR_PUSH(&ctf->dicts, parent);
+
+        for (uint64_t i = 0; i < archive.dicts_count; i++) {
+            if (i == parent_idx) continue;
+
+            _upf_get_ctf_archive_member(data, size, &archive, i, &name, &dict_data, &dict_size);
+            _upf_ctf_dict *dict = _upf_parse_ctf_dict(dict_data, dict_size, parent);
+            if (dict != NULL) _UPF_VECTOR_PUSH(&ctf->dicts, dict);
+        }
+    }
+
+    for (size_t i = 0; i < ctf->dicts.length; i++) {
+        const _upf_ctf_dict *dict = ctf->dicts.data[i];
+        uint32_t child_flag = dict->parent != NULL ? _UPF_CTF_CHILD_FLAG : 0;
+        for (uint32_t j = 1; j < dict->records.length; j++) {
+            _upf_ctf_type type = _upf_read_ctf_type(dict, dict->records.data[j]);
+            if (_upf_is_ctf_named_type(&type)) _upf_add_name(&ctf->names, type.name, ((uint64_t) i << 32) | child_flag | j);
+        }
+    }
+
+    return ctf->dicts.length > 0;
+
+invalid_archive:
+    _UPF_WARN("Found invalid CTF archive. Ignoring CTF.");
+    return false;
+}
+
+// ====================== CACHE ===========================
+
+// Parsed units can be saved to a file in the directory specified by the
+// UPRINTF_CACHE_DIR environment variable. Later runs of the same executable,
+// identified by its build ID, map the file instead of parsing DWARF, so that
+// concurrent processes share the page cache. References into the executable
+// are stored as offsets from the start of the file, references within the
+// cache as offsets from the start of the cache.
+
+static const char *_upf_get_cache_path(const char *dir, const char *suffix) {
+    _UPF_ASSERT(dir != NULL && suffix != NULL);
+
+    const char *build_id = _upf_bytes_to_hex(&_upf_state.module->arena, _upf_state.module->dwarf.build_id, _upf_state.module->dwarf.build_id_size);
+    return _upf_arena_concat(&_upf_state.module->arena, dir, "/", build_id, ".cache", suffix);
+}
+
+static bool _upf_is_in_file(const void *ptr) {
+    const uint8_t *file = _upf_state.module->dwarf.file;
+    return file <= (const uint8_t *) ptr && (const uint8_t *) ptr < file + _upf_state.module->dwarf.file_size;
+}
+
+static const char *_upf_get_cache_dir(void) {
+    const char *dir = getenv("UPRINTF_CACHE_DIR");
+    if (dir == NULL || *dir == '\0') return NULL;
+    if (_upf_state.module->dwarf.build_id == NULL || _upf_state.module->dwarf.build_id_size > _UPF_CACHE_MAX_BUILD_ID_SIZE) return NULL;
+    // Cached units refer to DIEs and strings by their offsets in the file, which
+    // decompressed sections and the ones from .dwo and supplementary files don't have.
+    if (!_upf_is_in_file(_upf_state.module->dwarf.die) || !_upf_is_in_file(_upf_state.module->dwarf.abbrev) || !_upf_is_in_file(_upf_state.module->dwarf.str)
+        || _upf_state.module->dwarf.has_skeleton_units || _upf_state.module->dwarf.sup_name != NULL) {
+        return NULL;
+    }
+    return dir;
+}
+
+static uint64_t _upf_cache_write(_upf_cache_writer *w, const void *data, size_t size) {
+    _UPF_ASSERT(w != NULL && data != NULL);
+
+    uint64_t offset = w->size;
+    if (size > 0 && fwrite(data, size, 1, w->file) != 1) w->is_failed = true;
+    w->size += size;
+    return offset;
+}
+
+static uint64_t _upf_cache_file_offset(_upf_cache_writer *w, const void *ptr) {
+    _UPF_ASSERT(w != NULL);
+
+    if (ptr == NULL) return _UPF_INVALID;
+    if (!_upf_is_in_file(ptr)) {
+        w->is_failed = true;
+        return _UPF_INVALID;
+    }
+    return (const uint8_t *) ptr - _upf_state.module->dwarf.file;
+}
+
+static uint64_t _upf_cache_string(_upf_cache_writer *w, const char *str) {
+    _UPF_ASSERT(w != NULL);
+
+    if (str == NULL || _upf_is_in_file(str)) return _upf_cache_file_offset(w, str);
+
+    uint64_t offset = w->strings.length;
+    do {
+        _UPF_VECTOR_PUSH(&w->strings, *str);
+    } while (*str++ != '\0');
+    return offset | _UPF_CACHE_STRING_FLAG;
+}
+
+static _upf_cache_array _upf_cache_write_ranges(_upf_cache_writer *w, const _upf_range_vec *ranges) {
+    _UPF_ASSERT(w != NULL && ranges != NULL);
+
+    _upf_cache_array array = {
+        .offset = w->size,
+        .length = ranges->length,
+    };
+    for (size_t i = 0; i < ranges->length; i++) {
+        _upf_cache_range range = {
+            .start = ranges->data[i].start,
+            .end = ranges->data[i].end,
+            .idx = 0,
+        };
+        _upf_cache_write(w, &range, sizeof(range));
+    }
+    return array;
+}
+
+static _upf_cache_array _upf_cache_write_unit_ranges(_upf_cache_writer *w, const _upf_unit_range_vec *ranges) {
+    _UPF_ASSERT(w != NULL && ranges != NULL);
+
+    _upf_cache_array array = {
+        .offset = w->size,
+        .length = ranges->length,
+    };
+    for (size_t i = 0; i < ranges->length; i++) {
+        _upf_cache_range range = {
+            .start = ranges->data[i].start,
+            .end = ranges->data[i].end,
+            .idx = ranges->data[i].unit_idx,
+        };
+        _upf_cache_write(w, &range, sizeof(range));
+    }
+    return array;
+}
+
+static _upf_cache_array _upf_cache_write_named_types(_upf_cache_writer *w, const _upf_named_type_vec *types) {
+    _UPF_ASSERT(w != NULL && types != NULL);
+
+    _upf_cache_array array = {
+        .offset = w->size,
+        .length = types->length,
+    };
+    for (size_t i = 0; i < types->length; i++) {
+        _upf_cache_named_type type = {
+            .die = _upf_cache_file_offset(w, types->data[i].die),
+            .name = _upf_cache_string(w, types->data[i].name),
+        };
+        _upf_cache_write(w, &type, sizeof(type));
+    }
+    return array;
+}
+
+static uint64_t _upf_cache_write_cu(_upf_cache_writer *w, const _upf_cu *cu) {
+    _UPF_ASSERT(w != NULL && cu != NULL);
+
+    _upf_cache_cu cached = {
+        .addr_base = cu->addr_base,
+        .str_offsets_base = cu->str_offsets_base,
+        .rnglists_base = cu->rnglists_base,
+        .ranges = _upf_cache_write_ranges(w, &cu->scope.ranges),
+        .types = _upf_cache_write_named_types(w, &cu->types),
+        .functions = {0},
+        .function_ranges = {0},
+        .scope_nodes = {0},
+        .scope_intervals = {0},
+    };
+
+    // Arguments of all the functions are written first, so that each function
+    // can then compute where its arguments begin. Same for variables of scopes.
+    uint64_t args_offset = w->size;
+    for (size_t i = 0; i < cu->functions.length; i++) _upf_cache_write_named_types(w, &cu->functions.data[i].args);
+
+    cached.functions.offset = w->size;
+    cached.functions.length = cu->functions.length;
+    for (size_t i = 0; i < cu->functions.length; i++) {
+        const _upf_function *function = &cu->functions.data[i];
+        _upf_cache_function cached_function = {
+            .name = _upf_cache_string(w, function->name),
+            .return_type = _upf_cache_file_offset(w, function->return_type),
+            .args = {
+                .offset = args_offset,
+                .length = function->args.length,
+            },
+            .is_variadic = function->is_variadic,
+            .low_pc = function->low_pc,
+        };
+        args_offset += function->args.length * sizeof(_upf_cache_named_type);
+        _upf_cache_write(w, &cached_function, sizeof(cached_function));
+    }
+
+    cached.function_ranges.offset = w->size;
+    cached.function_ranges.length = cu->function_ranges.length;
+    for (size_t i = 0; i < cu->function_ranges.length; i++) {
+        _upf_cache_range range = {
+            .start = cu->function_ranges.data[i].start,
+            .end = cu->function_ranges.data[i].end,
+            .idx = cu->function_ranges.data[i].function_idx,
+        };
+        _upf_cache_write(w, &range, sizeof(range));
+    }
+
+    uint64_t vars_offset = w->size;
+    for (size_t i = 0; i < cu->scope_nodes.length; i++) _upf_cache_write_named_types(w, &cu->scope_nodes.data[i].scope->vars);
+
+    cached.scope_nodes.offset = w->size;
+    cached.scope_nodes.length = cu->scope_nodes.length;
+    for (size_t i = 0; i < cu->scope_nodes.length; i++) {
+        const _upf_scope_node *node = &cu->scope_nodes.data[i];
+        _upf_cache_scope_node cached_node = {
+            .parent = node->parent,
+            .vars = {
+                .offset = vars_offset,
+                .length = node->scope->vars.length,
+            },
+        };
+        vars_offset += node->scope->vars.length * sizeof(_upf_cache_named_type);
+        _upf_cache_write(w, &cached_node, sizeof(cached_node));
+    }
+
+    cached.scope_intervals.offset = w->size;
+    cached.scope_intervals.length = cu->scope_intervals.length;
+    for (size_t i = 0; i < cu->scope_intervals.length; i++) {
+        _upf_cache_range range = {
+            .start = cu->scope_intervals.data[i].start,
+            .end = cu->scope_intervals.data[i].end,
+            .idx = cu->scope_intervals.data[i].node_idx,
+        };
+        _upf_cache_write(w, &range, sizeof(range));
+    }
+
+    return _upf_cache_write(w, &cached, sizeof(cached));
+}
+
+// Parses all the units and saves them to the cache. The file is written under
+// a temporary name and then renamed, so that other processes never see it
+// partially written. Failing to save the cache isn't an error.
+static void _upf_save_cache(void) {
+    const char *dir = _upf_get_cache_dir();
+    if (dir == NULL) return;
+
+    for (size_t i = 0; i < _upf_state.module->units.length; i++) _upf_parse_unit(&_upf_state.module->arena, &_upf_state.module->units.data[i]);
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%d.tmp", (int) getpid());
+    const char *path = _upf_get_cache_path(dir, "");
+    const char *tmp_path = _upf_get_cache_path(dir, suffix);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (file == NULL) return;
+
+    _upf_cache_writer w = {
+        .file = file,
+        .size = 0,
+        .is_failed = false,
+        .strings = _UPF_VECTOR_NEW(&_upf_state.module->arena),
+    };
+
+    _upf_cache_header header;
+    memset(&header, 0, sizeof(header));
+    _upf_cache_write(&w, &header, sizeof(header));
+
+    _upf_unit_vec units = _upf_state.module->units;
+    uint64_t *cu_offsets = (uint64_t *) _upf_arena_alloc(&_upf_state.module->arena, units.length * sizeof(*cu_offsets));
+    for (size_t i = 0; i < units.length; i++) {
+        cu_offsets[i] = units.data[i].cu == NULL ? 0 : _upf_cache_write_cu(&w, units.data[i].cu);
+    }
+
+    header.units.offset = w.size;
+    header.units.length = units.length;
+    for (size_t i = 0; i < units.length; i++) {
+        _upf_cache_unit unit = {
+            .base = _upf_cache_file_offset(&w, units.data[i].base),
+            .die = _upf_cache_file_offset(&w, units.data[i].die),
+            .end = units.data[i].end - _upf_state.module->dwarf.file,
+            .abbrev = _upf_cache_file_offset(&w, units.data[i].abbrev),
+            .cu = cu_offsets[i],
+        };
+        _upf_cache_write(&w, &unit, sizeof(unit));
+    }
+
+    header.unit_ranges = _upf_cache_write_unit_ranges(&w, &_upf_state.module->unit_ranges);
+    header.inferred_unit_ranges = _upf_cache_write_unit_ranges(&w, &_upf_state.module->inferred_unit_ranges);
+
+    header.strings.offset = w.size;
+    header.strings.length = w.strings.length;
+    if (w.strings.length > 0) _upf_cache_write(&w, w.strings.data, w.strings.length);
+
+    memcpy(header.magic, "UPFCACHE", sizeof(header.magic));
+    header.version = _UPF_CACHE_VERSION;
+    header.size = w.size;
+    header.build_id_size = _upf_state.module->dwarf.build_id_size;
+    memcpy(header.build_id, _upf_state.module->dwarf.build_id, _upf_state.module->dwarf.build_id_size);
+    header.file_size = _upf_state.module->dwarf.file_size;
+    header.die_offset = _upf_state.module->dwarf.die - _upf_state.module->dwarf.file;
+    header.die_size = _upf_state.module->dwarf.die_size;
+    header.abbrev_offset = _upf_state.module->dwarf.abbrev - _upf_state.module->dwarf.file;
+    header.str_offset = (const uint8_t *) _upf_state.module->dwarf.str - _upf_state.module->dwarf.file;
+    header.offset_size = _upf_state.module->dwarf.offset_size;
+    header.address_size = _upf_state.module->dwarf.address_size;
+
+    if (fseek(file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, file) != 1) w.is_failed = true;
+    if (fclose(file) != 0) w.is_failed = true;
+
+    if (w.is_failed || rename(tmp_path, path) != 0) remove(tmp_path);
+}
+
+static bool _upf_is_cache_array_valid(_upf_cache_array array, size_t element_size) {
+    if (array.offset % sizeof(uint64_t) != 0 || array.offset > _upf_state.module->cache_size) return false;
+    return array.length <= (_upf_state.module->cache_size - array.offset) / element_size;
+}
+
+static bool _upf_is_cache_file_offset_valid(uint64_t offset, bool is_nullable) {
+    if (offset == _UPF_INVALID) return is_nullable;
+    return offset < (uint64_t) _upf_state.module->dwarf.file_size;
+}
+
+static bool _upf_is_cache_string_valid(uint64_t str, bool is_nullable) {
+    if (str == _UPF_INVALID || (str & _UPF_CACHE_STRING_FLAG) == 0) return _upf_is_cache_file_offset_valid(str, is_nullable);
+
+    const _upf_cache_header *header = (const _upf_cache_header *) _upf_state.module->cache;
+    return (str & ~_UPF_CACHE_STRING_FLAG) < header->strings.length;
+}
+
+static bool _upf_is_cached_named_types_valid(_upf_cache_array array, bool is_name_nullable) {
+    if (!_upf_is_cache_array_valid(array, sizeof(_upf_cache_named_type))) return false;
 
-        bool is_uprintf = false;
-        switch (abbrev->tag) {
-            case _UPF_DW_TAG_subprogram: {
-                const char *function_name = _upf_parse_cu_function(&cu, die, abbrev);
-                if (function_name != NULL && strcmp(function_name, "_upf_uprintf") == 0) is_uprintf = true;
-                __attribute__((fallthrough));
-            }
-            case _UPF_DW_TAG_lexical_block:
-            case _UPF_DW_TAG_inlined_subroutine: {
-                bool scope = _upf_parse_cu_scope(&cu, &scope_stack, depth, die, abbrev);
-                if (is_uprintf && scope) {
-                    _UPF_ASSERT(_upf_state.uprintf_ranges.length == 0);
-                    _UPF_VECTOR_COPY(&_upf_state.uprintf_ranges, &_UPF_VECTOR_TOP(&scope_stack).scope->ranges);
-                }
-                is_uprintf = false;
-            } break;
-            case _UPF_DW_TAG_array_type:
-            case _UPF_DW_TAG_enumeration_type:
-            case _UPF_DW_TAG_pointer_type:
-            case _UPF_DW_TAG_structure_type:
-            case _UPF_DW_TAG_typedef:
-            case _UPF_DW_TAG_union_type:
-            case _UPF_DW_TAG_base_type:
-                _upf_parse_cu_type(&cu, die_base);
-                break;
-            case _UPF_DW_TAG_variable:
-            case _UPF_DW_TAG_formal_parameter: {
-                _upf_scope *scope = _UPF_VECTOR_TOP(&scope_stack).scope;
-                if (scope == NULL) break;
+    const _upf_cache_named_type *types = (const _upf_cache_named_type *) (_upf_state.module->cache + array.offset);
+    for (size_t i = 0; i < array.length; i++) {
+        if (!_upf_is_cache_file_offset_valid(types[i].die, false)) return false;
+        if (!_upf_is_cache_string_valid(types[i].name, is_name_nullable)) return false;
+    }
+    return true;
+}
 
-                _upf_named_type var = _upf_get_var(&cu, die_base);
-                if (var.name == NULL) break;
-                if (var.die == NULL) {
-                    _UPF_ERROR(
-                        "Unable to find variable DIE. "
-                        "Ensure that the executable contains debugging information of at least 2nd level (-g2 or -g3).");
-                }
+static bool _upf_is_cached_cu_valid(uint64_t offset) {
+    if (offset % sizeof(uint64_t) != 0 || offset > _upf_state.module->cache_size - sizeof(_upf_cache_cu)) return false;
+    const _upf_cache_cu *cu = (const _upf_cache_cu *) (_upf_state.module->cache + offset);
 
-                _UPF_VECTOR_PUSH(&scope->vars, var);
-            } break;
-        }
+    if (!_upf_is_cache_array_valid(cu->ranges, sizeof(_upf_cache_range))) return false;
+    if (!_upf_is_cached_named_types_valid(cu->types, false)) return false;
 
-        die = _upf_skip_die(die, abbrev);
+    if (!_upf_is_cache_array_valid(cu->functions, sizeof(_upf_cache_function))) return false;
+    const _upf_cache_function *functions = (const _upf_cache_function *) (_upf_state.module->cache + cu->functions.offset);
+    for (size_t i = 0; i < cu->functions.length; i++) {
+        if (!_upf_is_cache_string_valid(functions[i].name, false)) return false;
+        if (!_upf_is_cache_file_offset_valid(functions[i].return_type, true)) return false;
+        if (!_upf_is_cached_named_types_valid(functions[i].args, true)) return false;
     }
 
-    if (cu.scope.scopes.length > 0 && cu.scope.ranges.length == 1) {
-        _upf_range *range = &cu.scope.ranges.data[0];
+    if (!_upf_is_cache_array_valid(cu->function_ranges, sizeof(_upf_cache_range))) return false;
+    const _upf_cache_range *function_ranges = (const _upf_cache_range *) (_upf_state.module->cache + cu->function_ranges.offset);
+    for (size_t i = 0; i < cu->function_ranges.length; i++) {
+        if (function_ranges[i].idx >= cu->functions.length) return false;
+        if (i > 0 && function_ranges[i].start < function_ranges[i - 1].start) return false;
+    }
 
-        if (range->start == _UPF_INVALID) {
-            if (cu.scope.scopes.data[0].ranges.length == 0) {
-                range->start = 0;
-            } else {
-                range->start = cu.scope.scopes.data[0].ranges.data[0].start;
-            }
-        }
+    // Parents must precede their children, which also rules out cycles.
+    if (cu->scope_nodes.length == 0 || !_upf_is_cache_array_valid(cu->scope_nodes, sizeof(_upf_cache_scope_node))) return false;
+    const _upf_cache_scope_node *nodes = (const _upf_cache_scope_node *) (_upf_state.module->cache + cu->scope_nodes.offset);
+    for (size_t i = 0; i < cu->scope_nodes.length; i++) {
+        if (i == 0 ? nodes[i].parent != _UPF_NO_PARENT : nodes[i].parent >= i) return false;
+        if (!_upf_is_cached_named_types_valid(nodes[i].vars, false)) return false;
+    }
 
-        if (range->end == _UPF_INVALID) {
-            if (_UPF_VECTOR_TOP(&cu.scope.scopes).ranges.length == 0) {
-                range->end = UINT64_MAX;
-            } else {
-                range->end = _UPF_VECTOR_TOP(&_UPF_VECTOR_TOP(&cu.scope.scopes).ranges).end;
-            }
-        }
+    if (!_upf_is_cache_array_valid(cu->scope_intervals, sizeof(_upf_cache_range))) return false;
+    const _upf_cache_range *intervals = (const _upf_cache_range *) (_upf_state.module->cache + cu->scope_intervals.offset);
+    for (size_t i = 0; i < cu->scope_intervals.length; i++) {
+        if (intervals[i].idx >= cu->scope_nodes.length) return false;
+        if (i > 0 && intervals[i].start < intervals[i - 1].start) return false;
     }
 
-    _UPF_VECTOR_PUSH(&_upf_state.cus, cu);
+    return true;
 }
 
-static void _upf_parse_dwarf(void) {
-    const uint8_t *die = _upf_state.dwarf.die;
-    const uint8_t *die_end = die + _upf_state.dwarf.die_size;
-    while (die < die_end) {
-        const uint8_t *cu_base = die;
+// Checks that the cache was created for this exact executable and that all the
+// references in it are in bounds, so that a stale or corrupted cache is never used.
+static bool _upf_is_cache_valid(void) {
+    if (_upf_state.module->cache_size < sizeof(_upf_cache_header)) return false;
+    const _upf_cache_header *header = (const _upf_cache_header *) _upf_state.module->cache;
+
+    if (memcmp(header->magic, "UPFCACHE", sizeof(header->magic)) != 0) return false;
+    if (header->version != _UPF_CACHE_VERSION || header->size != _upf_state.module->cache_size) return false;
+
+    if (header->build_id_size != _upf_state.module->dwarf.build_id_size) return false;
+    if (memcmp(header->build_id, _upf_state.module->dwarf.build_id, _upf_state.module->dwarf.build_id_size) != 0) return false;
+    if (header->file_size != (uint64_t) _upf_state.module->dwarf.file_size) return false;
+    if (header->die_offset != (uint64_t) (_upf_state.module->dwarf.die - _upf_state.module->dwarf.file)) return false;
+    if (header->die_size != _upf_state.module->dwarf.die_size) return false;
+    if (header->abbrev_offset != (uint64_t) (_upf_state.module->dwarf.abbrev - _upf_state.module->dwarf.file)) return false;
+    if (header->str_offset != (uint64_t) ((const uint8_t *) _upf_state.module->dwarf.str - _upf_state.module->dwarf.file)) return false;
+    if (header->offset_size != 4 && header->offset_size != 8) return false;
+    if (header->address_size != 4 && header->address_size != 8) return false;
+
+    if (!_upf_is_cache_array_valid(header->strings, sizeof(char))) return false;
+    if (header->strings.length > 0 && _upf_state.module->cache[header->strings.offset + header->strings.length - 1] != '\0') return false;
+
+    if (!_upf_is_cache_array_valid(header->units, sizeof(_upf_cache_unit))) return false;
+    const _upf_cache_unit *units = (const _upf_cache_unit *) (_upf_state.module->cache + header->units.offset);
+    for (size_t i = 0; i < header->units.length; i++) {
+        if (units[i].base < header->die_offset || units[i].base >= units[i].die || units[i].die >= units[i].end) return false;
+        if (units[i].end > header->die_offset + header->die_size) return false;
+        if (!_upf_is_cache_file_offset_valid(units[i].abbrev, false)) return false;
+        if (units[i].cu != 0 && !_upf_is_cached_cu_valid(units[i].cu)) return false;
+    }
 
-        uint64_t length = 0;
-        memcpy(&length, die, sizeof(uint32_t));
-        die += sizeof(uint32_t);
+    if (!_upf_is_cache_array_valid(header->unit_ranges, sizeof(_upf_cache_range))) return false;
+    const _upf_cache_range *ranges = (const _upf_cache_range *) (_upf_state.module->cache + header->unit_ranges.offset);
+    for (size_t i = 0; i < header->unit_ranges.length; i++) {
+        if (ranges[i].idx >= header->units.length || units[ranges[i].idx].cu == 0) return false;
+        if (i > 0 && ranges[i].start < ranges[i - 1].start) return false;
+    }
 
-        _upf_state.dwarf.is64bit = false;
-        if (length == 0xffffffffU) {
-            memcpy(&length, die, sizeof(uint64_t));
-            die += sizeof(uint64_t);
-            _upf_state.dwarf.is64bit = true;
-        }
+    if (!_upf_is_cache_array_valid(header->inferred_unit_ranges, sizeof(_upf_cache_range))) return false;
+    ranges = (const _upf_cache_range *) (_upf_state.module->cache + header->inferred_unit_ranges.offset);
+    for (size_t i = 0; i < header->inferred_unit_ranges.length; i++) {
+        if (ranges[i].idx >= header->units.length || units[ranges[i].idx].cu == 0) return false;
+    }
 
-        _upf_state.dwarf.offset_size = _upf_state.dwarf.is64bit ? 8 : 4;
+    return true;
+}
 
-        const uint8_t *next = die + length;
+static void _upf_load_cached_unit_ranges(_upf_cache_array array, _upf_unit_range_vec *ranges) {
+    _UPF_ASSERT(ranges != NULL);
 
-        uint16_t version = 0;
-        memcpy(&version, die, sizeof(version));
-        die += sizeof(version);
-        if (version != 5) _UPF_ERROR("uprintf only supports DWARF version 5.");
+    const _upf_cache_range *cached_ranges = (const _upf_cache_range *) (_upf_state.module->cache + array.offset);
+    for (size_t i = 0; i < array.length; i++) {
+        _upf_unit_range range = {
+            .start = cached_ranges[i].start,
+            .end = cached_ranges[i].end,
+            .unit_idx = cached_ranges[i].idx,
+        };
+        _UPF_VECTOR_PUSH(ranges, range);
+    }
+}
 
-        uint8_t type = *die;
-        die += sizeof(type);
-        _UPF_ASSERT(type == _UPF_DW_UT_compile);
+// Maps the cache and creates the units from it. Returns false if there is no
+// valid cache, in which case DWARF must be parsed.
+static bool _upf_load_cache(void) {
+    const char *dir = _upf_get_cache_dir();
+    if (dir == NULL) return false;
 
-        uint8_t address_size = *die;
-        _UPF_ASSERT(_upf_state.dwarf.address_size == 0 || _upf_state.dwarf.address_size == address_size);
-        _upf_state.dwarf.address_size = address_size;
-        die += sizeof(address_size);
+    int fd = open(_upf_get_cache_path(dir, ""), O_RDONLY);
+    if (fd == -1) return false;
 
-        uint64_t abbrev_offset = _upf_offset_cast(die);
-        die += _upf_state.dwarf.offset_size;
+    struct stat file_info;
+    if (fstat(fd, &file_info) == -1 || (size_t) file_info.st_size < sizeof(_upf_cache_header)) {
+        close(fd);
+        return false;
+    }
 
-        _upf_parse_cu(cu_base, die, next, _upf_state.dwarf.abbrev + abbrev_offset);
+    void *cache = mmap(NULL, file_info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cache == MAP_FAILED) return false;
+
+    _upf_state.module->cache = (const uint8_t *) cache;
+    _upf_state.module->cache_size = file_info.st_size;
+    if (!_upf_is_cache_valid()) {
+        munmap(cache, _upf_state.module->cache_size);
+        _upf_state.module->cache = NULL;
+        _upf_state.module->cache_size = 0;
+        return false;
+    }
 
-        die = next;
+    const _upf_cache_header *header = (const _upf_cache_header *) _upf_state.module->cache;
+    _upf_state.module->dwarf.offset_size = header->offset_size;
+    _upf_state.module->dwarf.is64bit = header->offset_size == 8;
+    _upf_state.module->dwarf.address_size = header->address_size;
+
+    const _upf_cache_unit *units = (const _upf_cache_unit *) (_upf_state.module->cache + header->units.offset);
+    for (size_t i = 0; i < header->units.length; i++) {
+        _upf_unit unit = {
+            .base = _upf_state.module->dwarf.file + units[i].base,
+            .die = _upf_state.module->dwarf.file + units[i].die,
+            .end = _upf_state.module->dwarf.file + units[i].end,
+            .abbrev = _upf_state.module->dwarf.file + units[i].abbrev,
+            .is_skeleton = false,
+            .dwo_id = 0,
+            .split = NULL,
+            .dwo = NULL,
+            .is_sup = false,
+            .is_parsed = units[i].cu == 0,
+            .cu = NULL,
+            .cached_cu = units[i].cu == 0 ? NULL : (const _upf_cache_cu *) (_upf_state.module->cache + units[i].cu),
+            .arena = {0},
+            .last_use = 0,
+        };
+        _UPF_VECTOR_PUSH(&_upf_state.module->units, unit);
     }
+
+    _upf_load_cached_unit_ranges(header->unit_ranges, &_upf_state.module->unit_ranges);
+    _upf_load_cached_unit_ranges(header->inferred_unit_ranges, &_upf_state.module->inferred_unit_ranges);
+
+    _UPF_COUNT_TEST_CACHE_LOAD();
+    return true;
 }
 
-// ======================= ELF ============================
+static const void *_upf_cache_file_ptr(uint64_t offset) { return offset == _UPF_INVALID ? NULL : _upf_state.module->dwarf.file + offset; }
 
-static void _upf_parse_elf(void) {
-    struct stat file_info;
-    if (stat("/proc/self/exe", &file_info) == -1) _UPF_ERROR("Unable to stat \"/proc/self/exe\": %s.", strerror(errno));
-    size_t size = file_info.st_size;
-    _upf_state.dwarf.file_size = size;
+static const char *_upf_cache_str(uint64_t str) {
+    if (str == _UPF_INVALID || (str & _UPF_CACHE_STRING_FLAG) == 0) return (const char *) _upf_cache_file_ptr(str);
 
-    int fd = open("/proc/self/exe", O_RDONLY);
-    _UPF_ASSERT(fd != -1);
+    const _upf_cache_header *header = (const _upf_cache_header *) _upf_state.module->cache;
+    return (const char *) (_upf_state.module->cache + header->strings.offset + (str & ~_UPF_CACHE_STRING_FLAG));
+}
 
-    uint8_t *file = (uint8_t *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
-    _UPF_ASSERT(file != MAP_FAILED);
-    _upf_state.dwarf.file = file;
+static _upf_named_type_vec _upf_load_cached_named_types(_upf_arena *arena, _upf_cache_array array) {
+    _UPF_ASSERT(arena != NULL);
 
-    close(fd);
+    const _upf_cache_named_type *cached_types = (const _upf_cache_named_type *) (_upf_state.module->cache + array.offset);
+    _upf_named_type_vec types = _UPF_VECTOR_NEW(arena);
+    for (size_t i = 0; i < array.length; i++) {
+        _upf_named_type type = {
+            .die = (const uint8_t *) _upf_cache_file_ptr(cached_types[i].die),
+            .name = _upf_cache_str(cached_types[i].name),
+        };
+        _UPF_VECTOR_PUSH(&types, type);
+    }
+    return types;
+}
 
-    const Elf64_Ehdr *header = (Elf64_Ehdr *) file;
+static _upf_cu *_upf_load_cached_cu(_upf_arena *arena, const _upf_unit *unit) {
+    _UPF_ASSERT(arena != NULL && unit != NULL && unit->cached_cu != NULL);
+
+    const _upf_cache_cu *cached = unit->cached_cu;
+    _upf_cu *cu = (_upf_cu *) _upf_arena_alloc(arena, sizeof(*cu));
+    *cu = (_upf_cu) {
+        .base = unit->base,
+        .end = unit->end,
+        .is_sup = false,
+        .arena = arena,
+        .abbrevs = _upf_get_abbrev_table(unit->abbrev),
+        .types = _upf_load_cached_named_types(arena, cached->types),
+        .functions = _UPF_VECTOR_NEW(arena),
+        .type_names = {0},
+        .function_names = {0},
+        .function_ranges = _UPF_VECTOR_NEW(arena),
+        .addr_base = cached->addr_base,
+        .str_offsets_base = cached->str_offsets_base,
+        .rnglists_base = cached->rnglists_base,
+        .scope = {
+            .ranges = _UPF_VECTOR_NEW(arena),
+            .vars = {0},
+            .scopes = _UPF_VECTOR_NEW(arena),
+        },
+        .scope_nodes = _UPF_VECTOR_NEW(arena),
+        .scope_intervals = _UPF_VECTOR_NEW(arena),
+    };
+    _upf_map_init(&cu->type_names, arena);
+    _upf_map_init(&cu->function_names, arena);
+    for (size_t i = 0; i < cu->types.length; i++) _upf_add_name(&cu->type_names, cu->types.data[i].name, i);
 
-    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0 || header->e_ident[EI_CLASS] != ELFCLASS64 || header->e_ident[EI_VERSION] != 1
-        || header->e_machine != EM_X86_64 || header->e_version != 1 || header->e_shentsize != sizeof(Elf64_Shdr)) {
-        _UPF_ERROR("Unsupported or invalid ELF file.");
+    const _upf_cache_range *ranges = (const _upf_cache_range *) (_upf_state.module->cache + cached->ranges.offset);
+    for (size_t i = 0; i < cached->ranges.length; i++) {
+        _upf_range range = {
+            .start = ranges[i].start,
+            .end = ranges[i].end,
+        };
+        _UPF_VECTOR_PUSH(&cu->scope.ranges, range);
     }
 
-    const Elf64_Shdr *string_section = (Elf64_Shdr *) (file + header->e_shoff + header->e_shstrndx * header->e_shentsize);
-    const char *string_table = (char *) (file + string_section->sh_offset);
+    const _upf_cache_function *functions = (const _upf_cache_function *) (_upf_state.module->cache + cached->functions.offset);
+    for (size_t i = 0; i < cached->functions.length; i++) {
+        _upf_function function = {
+            .name = _upf_cache_str(functions[i].name),
+            .return_type = (const uint8_t *) _upf_cache_file_ptr(functions[i].return_type),
+            .args = _upf_load_cached_named_types(arena, functions[i].args),
+            .is_variadic = functions[i].is_variadic,
+            .low_pc = functions[i].low_pc,
+        };
+        _UPF_VECTOR_PUSH(&cu->functions, function);
+        _upf_add_name(&cu->function_names, function.name, i);
+    }
 
-    const Elf64_Shdr *section = (Elf64_Shdr *) (file + header->e_shoff);
-    for (size_t i = 0; i < header->e_shnum; i++) {
-        const char *name = string_table + section->sh_name;
+    const _upf_cache_range *function_ranges = (const _upf_cache_range *) (_upf_state.module->cache + cached->function_ranges.offset);
+    for (size_t i = 0; i < cached->function_ranges.length; i++) {
+        _upf_function_range range = {
+            .start = function_ranges[i].start,
+            .end = function_ranges[i].end,
+            .function_idx = function_ranges[i].idx,
+        };
+        _UPF_VECTOR_PUSH(&cu->function_ranges, range);
+    }
 
-        if (strcmp(name, ".debug_info") == 0) {
-            _upf_state.dwarf.die = file + section->sh_offset;
-            _upf_state.dwarf.die_size = section->sh_size;
-        } else if (strcmp(name, ".debug_abbrev") == 0) {
-            _upf_state.dwarf.abbrev = file + section->sh_offset;
-        } else if (strcmp(name, ".debug_str") == 0) {
-            _upf_state.dwarf.str = (const char *) (file + section->sh_offset);
-        } else if (strcmp(name, ".debug_line_str") == 0) {
-            _upf_state.dwarf.line_str = (const char *) (file + section->sh_offset);
-        } else if (strcmp(name, ".debug_str_offsets") == 0) {
-            _upf_state.dwarf.str_offsets = file + section->sh_offset;
-        } else if (strcmp(name, ".debug_rnglists") == 0) {
-            _upf_state.dwarf.rnglists = file + section->sh_offset;
-        } else if (strcmp(name, ".debug_addr") == 0) {
-            _upf_state.dwarf.addr = file + section->sh_offset;
+    // The first node is the root scope of the CU, the rest only need variables.
+    const _upf_cache_scope_node *nodes = (const _upf_cache_scope_node *) (_upf_state.module->cache + cached->scope_nodes.offset);
+    for (size_t i = 0; i < cached->scope_nodes.length; i++) {
+        _upf_scope *scope = &cu->scope;
+        if (i > 0) {
+            scope = (_upf_scope *) _upf_arena_alloc(arena, sizeof(*scope));
+            scope->ranges = (_upf_range_vec) _UPF_VECTOR_NEW(arena);
+            scope->scopes = (_upf_scope_vec) _UPF_VECTOR_NEW(arena);
         }
+        scope->vars = _upf_load_cached_named_types(arena, nodes[i].vars);
 
-        section++;
+        _upf_scope_node node = {
+            .scope = scope,
+            .parent = nodes[i].parent,
+            .var_names = _upf_get_var_names(arena, scope),
+        };
+        _UPF_VECTOR_PUSH(&cu->scope_nodes, node);
     }
 
-    if (_upf_state.dwarf.die == NULL || _upf_state.dwarf.abbrev == NULL || _upf_state.dwarf.str == NULL) {
-        _UPF_ERROR("Unable to find debugging information. Ensure that the executable contains it by using -g2 or -g3.");
+    const _upf_cache_range *intervals = (const _upf_cache_range *) (_upf_state.module->cache + cached->scope_intervals.offset);
+    for (size_t i = 0; i < cached->scope_intervals.length; i++) {
+        _upf_scope_interval interval = {
+            .start = intervals[i].start,
+            .end = intervals[i].end,
+            .node_idx = intervals[i].idx,
+            .depth = 0,
+        };
+        _UPF_VECTOR_PUSH(&cu->scope_intervals, interval);
     }
+
+    return cu;
 }
 
 // ==================== TOKENIZING ========================
@@ -2223,7 +6748,7 @@ static void _upf_parse_elf(void) {
 static _upf_cstr_vec _upf_get_args(char *string) {
     _UPF_ASSERT(string != NULL);
 
-    _upf_cstr_vec args = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_cstr_vec args = _UPF_VECTOR_NEW(&_upf_state.scratch_arena);
 
     bool in_quotes = false;
     int paren = 0;
@@ -2299,7 +6824,7 @@ static void _upf_tokenize(_upf_tokenizer *t, const char *string) {
 
             _upf_token token = {
                 .kind = _UPF_TOK_NUMBER,
-                .string = _upf_arena_string(&_upf_state.arena, ch, end),
+                .string = _upf_arena_string(&_upf_state.scratch_arena, ch, end),
             };
             _UPF_VECTOR_PUSH(&t->tokens, token);
 
@@ -2308,7 +6833,7 @@ static void _upf_tokenize(_upf_tokenizer *t, const char *string) {
             const char *end = ch;
             while (('a' <= *end && *end <= 'z') || ('A' <= *end && *end <= 'Z') || ('0' <= *end && *end <= '9') || *end == '_') end++;
 
-            const char *string = _upf_arena_string(&_upf_state.arena, ch, end);
+            const char *string = _upf_arena_string(&_upf_state.scratch_arena, ch, end);
 
             enum _upf_token_kind kind = _UPF_TOK_ID;
 
@@ -2348,7 +6873,7 @@ static void _upf_tokenize(_upf_tokenizer *t, const char *string) {
 
             _upf_token token = {
                 .kind = _UPF_TOK_STRING,
-                .string = _upf_arena_string(&_upf_state.arena, ch, end),
+                .string = _upf_arena_string(&_upf_state.scratch_arena, ch, end),
             };
             _UPF_VECTOR_PUSH(&t->tokens, token);
 
@@ -2435,7 +6960,7 @@ static const char *_upf_modifier_typename_to_stdint(int type, bool is_signed, in
         return "double";
     } else if (type == _UPF_DW_ATE_signed) {
         int offset;
-        char *name = _upf_arena_alloc(&_upf_state.arena, 9);
+        char *name = _upf_arena_alloc(&_upf_state.scratch_arena, 9);
         if (is_signed) {
             offset = 3;
             memcpy(name, "int", offset);
@@ -2530,7 +7055,7 @@ static bool _upf_parse_cast_expr(_upf_tokenizer *t, _upf_parser_state *p) {
     // 	| '(' typename ')' cast_expr
 
     const char *typename;
-    int dereference;
+    int dereference = 0;
     size_t save = t->idx;
     if (_upf_consume(t, _UPF_TOK_OPEN_PAREN).kind != _UPF_TOK_NONE &&   //
         _upf_parse_typename(t, &typename, &dereference) &&              //
@@ -2814,131 +7339,230 @@ static bool _upf_parse_expr(_upf_tokenizer *t, _upf_parser_state *p) {
 
 // ================== TYPE INFERENCE ======================
 
-static size_t _upf_get_return_type(size_t type_idx, int count) {
+static uint32_t _upf_get_return_type(uint32_t type_idx, int count) {
     while (count-- > 0) {
         const _upf_type *type = _upf_get_type(type_idx);
-        while (type->kind == _UPF_TK_POINTER) type = _upf_get_type(type->as.pointer.type);
+        while (type->kind == _UPF_TK_POINTER) type = _upf_get_type(type->type);
         if (type->kind != _UPF_TK_FUNCTION) {
-            _UPF_ERROR("Unable to get return type of \"%s\" because it is not a function pointer.", type->name);
+            _UPF_ERROR("Unable to get return type of \"%s\" because it is not a function pointer.", _upf_get_name(type->name));
         }
-        type_idx = type->as.function.return_type;
+        type_idx = type->type;
     }
 
     return type_idx;
 }
 
-static const uint8_t *_upf_find_var_type(uint64_t pc, const char *var, const _upf_scope *scope) {
-    _UPF_ASSERT(var != NULL && scope != NULL);
+static const uint8_t *_upf_find_scope_var_type(const _upf_scope_node *node, const char *var) {
+    _UPF_ASSERT(node != NULL && var != NULL);
 
-    if (!_upf_is_in_range(pc, scope->ranges)) return NULL;
+    const _upf_named_type_vec *vars = &node->scope->vars;
+    if (node->var_names != NULL) {
+        uint64_t idx;
+        if (!_upf_map_get(node->var_names, _upf_string_hash(var), &idx)) return NULL;
+        if (strcmp(vars->data[idx].name, var) == 0) return vars->data[idx].die;
+        // Hash collision, fall back to the linear search.
+    }
 
-    for (size_t i = 0; i < scope->scopes.length; i++) {
-        const uint8_t *result = _upf_find_var_type(pc, var, &scope->scopes.data[i]);
-        if (result != NULL) return result;
+    for (size_t i = 0; i < vars->length; i++) {
+        if (strcmp(vars->data[i].name, var) == 0) return vars->data[i].die;
     }
 
-    for (size_t i = 0; i < scope->vars.length; i++) {
-        if (strcmp(scope->vars.data[i].name, var) == 0) {
-            return scope->vars.data[i].die;
-        }
+    return NULL;
+}
+
+// Searches variable in the innermost scope that contains the PC, and then in its parents.
+static const uint8_t *_upf_find_var_type(const _upf_cu *cu, uint64_t pc, const char *var) {
+    _UPF_ASSERT(cu != NULL && var != NULL);
+
+    _upf_scope_interval_vec intervals = cu->scope_intervals;
+
+    // Find the last interval that starts at or before the PC.
+    size_t low = 0, high = intervals.length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (intervals.data[mid].start <= pc) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0 || pc >= intervals.data[low - 1].end) return NULL;
+
+    uint32_t node_idx = intervals.data[low - 1].node_idx;
+    while (node_idx != _UPF_NO_PARENT) {
+        const _upf_scope_node *node = &cu->scope_nodes.data[node_idx];
+
+        const uint8_t *type_die = _upf_find_scope_var_type(node, var);
+        if (type_die != NULL) return type_die;
+
+        node_idx = node->parent;
     }
 
     return NULL;
 }
 
-static size_t _upf_get_member_type(const _upf_cstr_vec *member_names, size_t idx, size_t type_idx) {
-    _UPF_ASSERT(member_names != NULL && type_idx != _UPF_INVALID);
+// Finds the code range of the function that contains the PC.
+static const _upf_function_range *_upf_find_function_range(const _upf_cu *cu, uint64_t pc) {
+    _UPF_ASSERT(cu != NULL);
+
+    _upf_function_range_vec ranges = cu->function_ranges;
+
+    // Find the last range that starts at or before the PC.
+    size_t low = 0, high = ranges.length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (ranges.data[mid].start <= pc) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0 || pc >= ranges.data[low - 1].end) return NULL;
+
+    return &ranges.data[low - 1];
+}
+
+static uint32_t _upf_get_member_type(const _upf_cstr_vec *member_names, size_t idx, uint32_t type_idx) {
+    _UPF_ASSERT(member_names != NULL && type_idx != _UPF_NO_TYPE);
 
     if (idx == member_names->length) return type_idx;
 
     const _upf_type *type = _upf_get_type(type_idx);
     if (type->kind == _UPF_TK_POINTER) {
-        return _upf_get_member_type(member_names, idx, type->as.pointer.type);
+        return _upf_get_member_type(member_names, idx, type->type);
     }
 
     if (type->kind == _UPF_TK_FUNCTION && idx < member_names->length) {
-        size_t return_type_idx = type_idx;
+        uint32_t return_type_idx = type_idx;
         while (true) {
             const _upf_type *type = _upf_get_type(return_type_idx);
-            if (type->kind == _UPF_TK_POINTER) type = _upf_get_type(type->as.pointer.type);
+            if (type->kind == _UPF_TK_POINTER) type = _upf_get_type(type->type);
             if (type->kind != _UPF_TK_FUNCTION) break;
-            return_type_idx = type->as.function.return_type;
+            return_type_idx = type->type;
         }
         return _upf_get_member_type(member_names, idx, return_type_idx);
     }
 
     if (type->kind == _UPF_TK_STRUCT || type->kind == _UPF_TK_UNION) {
-        _upf_member_vec members = type->as.cstruct.members;
-        for (size_t i = 0; i < members.length; i++) {
-            if (strcmp(members.data[i].name, member_names->data[idx]) == 0) {
-                return _upf_get_member_type(member_names, idx + 1, members.data[i].type);
+        for (uint32_t i = 0; i < type->count; i++) {
+            const _upf_member *member = _upf_get_member(type, i);
+            if (strcmp(_upf_get_name(member->name), member_names->data[idx]) == 0) {
+                return _upf_get_member_type(member_names, idx + 1, member->type);
             }
         }
     }
 
-    _UPF_ERROR("Unable to find member \"%s\" in \"%s\".", member_names->data[idx], type->name);
+    _UPF_ERROR("Unable to find member \"%s\" in \"%s\".", member_names->data[idx], _upf_get_name(type->name));
 }
 
-static size_t _upf_find_typename(_upf_parser_state *p, uint64_t pc) {
-    for (size_t i = 0; i < _upf_state.cus.length; i++) {
-        const _upf_cu *cu = &_upf_state.cus.data[i];
-        if (!_upf_is_in_range(pc, cu->scope.ranges)) continue;
+static size_t _upf_find_cu_type(const _upf_cu *cu, const char *name) {
+    uint64_t idx;
+    if (!_upf_map_get(&cu->type_names, _upf_string_hash(name), &idx)) return _UPF_INVALID;
+    if (strcmp(cu->types.data[idx].name, name) == 0) return idx;
 
-        for (size_t j = 0; j < cu->types.length; j++) {
-            if (strcmp(cu->types.data[j].name, p->base) == 0) {
-                return _upf_parse_type(cu, cu->types.data[j].die);
-            }
-        }
+    // Hash collision
+    for (size_t i = 0; i < cu->types.length; i++) {
+        if (strcmp(cu->types.data[i].name, name) == 0) return i;
     }
-
     return _UPF_INVALID;
 }
 
-static size_t _upf_find_variable(_upf_parser_state *p, uint64_t pc) {
-    for (size_t i = 0; i < _upf_state.cus.length; i++) {
-        const _upf_cu *cu = &_upf_state.cus.data[i];
+// Finds the type in one of the units which other units reference instead of
+// defining the type themselves, i.e. type units and partial units.
+static uint32_t _upf_find_referenced_type(_upf_unit *unit, const char *name) {
+    _UPF_ASSERT(unit != NULL && name != NULL);
 
-        const uint8_t *type_die = _upf_find_var_type(pc, p->base, &cu->scope);
-        if (type_die == NULL) continue;
+    const _upf_cu *cu = _upf_load_unit(unit);
+    if (cu == NULL) return _UPF_NO_TYPE;
 
-        return _upf_parse_type(cu, type_die);
-    }
+    size_t idx = _upf_find_cu_type(cu, name);
+    return idx == _UPF_INVALID ? _UPF_NO_TYPE : _upf_parse_type(cu, cu->types.data[idx].die);
+}
 
+static size_t _upf_find_cu_function(const _upf_cu *cu, const char *name) {
+    uint64_t idx;
+    if (!_upf_map_get(&cu->function_names, _upf_string_hash(name), &idx)) return _UPF_INVALID;
+    if (strcmp(cu->functions.data[idx].name, name) == 0) return idx;
+
+    // Hash collision
+    for (size_t i = 0; i < cu->functions.length; i++) {
+        if (strcmp(cu->functions.data[i].name, name) == 0) return i;
+    }
     return _UPF_INVALID;
 }
 
-static size_t _upf_find_function(_upf_parser_state *p, uint64_t pc) {
-    for (size_t i = 0; i < _upf_state.cus.length; i++) {
-        const _upf_cu *cu = &_upf_state.cus.data[i];
-        if (!_upf_is_in_range(pc, cu->scope.ranges)) continue;
+static uint32_t _upf_find_typename(_upf_parser_state *p, uint64_t pc) {
+    // CTF has the types without any units to parse. Types which differ between
+    // units are left to DWARF, if there is one, since it knows the PC's unit.
+    uint32_t ctf_type_idx = _upf_find_ctf_type(p->base, _upf_state.module->dwarf.die == NULL);
+    if (ctf_type_idx != _UPF_NO_TYPE) return ctf_type_idx;
+
+    _upf_unit *unit = _upf_find_unit(pc);
+    if (unit == NULL) return _UPF_NO_TYPE;
+
+    // Accelerator table allows to parse only the type instead of the whole unit.
+    if (!unit->is_parsed && _upf_get_section(&_upf_state.module->dwarf.names) != NULL) {
+        const uint8_t *die = _upf_names_find_type(unit, p->base);
+        if (die != NULL) {
+            const _upf_cu *cu = _upf_get_cu_root(unit);
+            return cu == NULL ? _UPF_NO_TYPE : _upf_parse_type(cu, die);
+        }
+    }
 
-        for (size_t j = 0; j < cu->functions.length; j++) {
-            if (strcmp(cu->functions.data[j].name, p->base) == 0) {
-                if (cu->functions.data[j].return_type == NULL) {
-                    _upf_type type = {
-                        .name = "void",
-                        .kind = _UPF_TK_VOID,
-                        .modifiers = 0,
-                        .size = _UPF_INVALID,
-                    };
-                    return _upf_add_type(NULL, type);
-                } else {
-                    return _upf_parse_type(cu, cu->functions.data[j].return_type);
-                }
-            }
+    const _upf_cu *cu = _upf_get_cu(pc);
+    if (cu == NULL) return _UPF_NO_TYPE;
+
+    size_t idx = _upf_find_cu_type(cu, p->base);
+    if (idx == _UPF_INVALID) {
+        for (size_t i = 0; i < _upf_state.module->type_units.length; i++) {
+            uint32_t type_idx = _upf_find_referenced_type(_upf_state.module->type_units.data[i], p->base);
+            if (type_idx != _UPF_NO_TYPE) return type_idx;
+        }
+        for (size_t i = 0; i < _upf_state.module->partial_units.length; i++) {
+            uint32_t type_idx = _upf_find_referenced_type(&_upf_state.module->partial_units.data[i], p->base);
+            if (type_idx != _UPF_NO_TYPE) return type_idx;
         }
+        return _UPF_NO_TYPE;
     }
 
-    return _UPF_INVALID;
+    return _upf_parse_type(cu, cu->types.data[idx].die);
+}
+
+static uint32_t _upf_find_variable(_upf_parser_state *p, uint64_t pc) {
+    const _upf_cu *cu = _upf_get_cu(pc);
+    if (cu == NULL) return _UPF_NO_TYPE;
+
+    const uint8_t *type_die = _upf_find_var_type(cu, pc, p->base);
+    if (type_die == NULL) return _UPF_NO_TYPE;
+
+    return _upf_parse_type(cu, type_die);
+}
+
+static uint32_t _upf_find_function(_upf_parser_state *p, uint64_t pc) {
+    const _upf_cu *cu = _upf_get_cu(pc);
+    if (cu == NULL) return _UPF_NO_TYPE;
+
+    size_t idx = _upf_find_cu_function(cu, p->base);
+    if (idx == _UPF_INVALID) return _UPF_NO_TYPE;
+
+    const uint8_t *return_type = cu->functions.data[idx].return_type;
+    if (return_type == NULL) {
+        _upf_type type = {
+            .kind = _UPF_TK_VOID,
+            .modifiers = 0,
+            .first = 0,
+            .size = _UPF_INVALID,
+            .count = 0,
+            .type = _UPF_NO_TYPE,
+            .name = _upf_intern_type_name("void"),
+        };
+        return _upf_add_type(NULL, type);
+    }
+
+    return _upf_parse_type(cu, return_type);
 }
 
-static size_t _upf_get_base_type(_upf_parser_state *p, uint64_t pc, const char *arg) {
-    size_t type_idx = _UPF_INVALID;
+static uint32_t _upf_get_base_type(_upf_parser_state *p, uint64_t pc, const char *arg) {
+    uint32_t type_idx = _UPF_NO_TYPE;
     switch (p->base_type) {
         case _UPF_BT_TYPENAME:
             type_idx = _upf_find_typename(p, pc);
 
-            if (type_idx == _UPF_INVALID) {
+            if (type_idx == _UPF_NO_TYPE) {
                 _UPF_ERROR(
                     "Unable to find type \"%s\" in \"%s\" at %s:%d. "
                     "Ensure that the executable contains debugging information of at least 2nd level (-g2 or -g3).",
@@ -2947,19 +7571,22 @@ static size_t _upf_get_base_type(_upf_parser_state *p, uint64_t pc, const char *
             break;
         case _UPF_BT_VARIABLE:
             type_idx = _upf_find_variable(p, pc);
-            if (type_idx != _UPF_INVALID) break;
+            if (type_idx != _UPF_NO_TYPE) break;
 
-            if (_upf_find_function(p, pc) != _UPF_INVALID) {
+            if (_upf_find_function(p, pc) != _UPF_NO_TYPE) {
                 _upf_type type = {
-                    .name = NULL,
                     .kind = _UPF_TK_FUNCTION,
                     .modifiers = 0,
+                    .first = 0,
                     .size = sizeof(void *),
+                    .count = 0,
+                    .type = _UPF_NO_TYPE,
+                    .name = 0,
                 };
                 type_idx = _upf_add_type(NULL, type);
             }
 
-            if (type_idx == _UPF_INVALID) {
+            if (type_idx == _UPF_NO_TYPE) {
                 _UPF_ERROR(
                     "Unable to find type of \"%s\" in \"%s\" at %s:%d. "
                     "Ensure that the executable contains debugging information of at least 2nd level (-g2 or -g3).",
@@ -2969,19 +7596,19 @@ static size_t _upf_get_base_type(_upf_parser_state *p, uint64_t pc, const char *
         case _UPF_BT_FUNCTION:
             type_idx = _upf_find_variable(p, pc);
 
-            if (type_idx != _UPF_INVALID) {
+            if (type_idx != _UPF_NO_TYPE) {
                 const _upf_type *type = _upf_get_type(type_idx);
                 if (type->kind != _UPF_TK_POINTER) goto not_function_error;
 
-                type = _upf_get_type(type->as.pointer.type);
+                type = _upf_get_type(type->type);
                 if (type->kind != _UPF_TK_FUNCTION) goto not_function_error;
 
-                type_idx = type->as.function.return_type;
+                type_idx = type->type;
             } else {
                 type_idx = _upf_find_function(p, pc);
             }
 
-            if (type_idx == _UPF_INVALID) {
+            if (type_idx == _UPF_NO_TYPE) {
             not_function_error:
                 _UPF_ERROR(
                     "Unable to find type of function \"%s\" in \"%s\" at %s:%d. "
@@ -2993,24 +7620,24 @@ static size_t _upf_get_base_type(_upf_parser_state *p, uint64_t pc, const char *
             break;
     }
 
-    _UPF_ASSERT(type_idx != _UPF_INVALID);
+    _UPF_ASSERT(type_idx != _UPF_NO_TYPE);
     return type_idx;
 }
 
-static size_t _upf_dereference_type(size_t type_idx, int dereference, const char *arg) {
+static uint32_t _upf_dereference_type(uint32_t type_idx, int dereference, const char *arg) {
     // Arguments are pointers to data that should be printed, so they get dereferenced
     // in order not to be interpreted as actual pointers.
     dereference++;
 
     while (dereference < 0) {
         _upf_type type = {
-            .name = NULL,
             .kind = _UPF_TK_POINTER,
             .modifiers = 0,
-            .size = sizeof(void*),
-            .as.pointer = {
-                .type = type_idx,
-            },
+            .first = 0,
+            .size = sizeof(void *),
+            .count = 0,
+            .type = type_idx,
+            .name = 0,
         };
 
         type_idx = _upf_add_type(NULL, type);
@@ -3021,17 +7648,22 @@ static size_t _upf_dereference_type(size_t type_idx, int dereference, const char
         const _upf_type *type = _upf_get_type(type_idx);
 
         if (type->kind == _UPF_TK_POINTER) {
-            type_idx = type->as.pointer.type;
+            type_idx = type->type;
             dereference--;
         } else if (type->kind == _UPF_TK_ARRAY) {
-            int dimensions = type->as.array.lengths.length;
+            int dimensions = type->count;
             if (dereference > dimensions) {
                 goto not_pointer_error;
             } else if (dereference == dimensions) {
-                type_idx = type->as.array.element_type;
+                type_idx = type->type;
             } else {
+                _upf_type subarray = _upf_get_subarray(type, dereference);
+                const char *name = _upf_get_name(type->name);
+                if (name != NULL) {
+                    subarray.name = _upf_intern_type_name(_upf_arena_string(&_upf_state.scratch_arena, name, name + strlen(name) - 2 * dereference));
+                }
                 // This may invalidate type pointer
-                type_idx = _upf_add_type(NULL, _upf_get_subarray(type, dereference));
+                type_idx = _upf_add_type(NULL, subarray);
             }
 
             dereference = 0;
@@ -3041,7 +7673,7 @@ static size_t _upf_dereference_type(size_t type_idx, int dereference, const char
                        _upf_state.file, _upf_state.line);
         }
 
-        if (type_idx == _UPF_INVALID) {
+        if (type_idx == _UPF_NO_TYPE) {
             _UPF_ERROR(
                 "Unable to print void* because it can point to arbitrary data of any length. "
                 "To print the pointer itself, you must take pointer (&) of \"%s\" at %s:%d.",
@@ -3056,7 +7688,7 @@ static const _upf_type *_upf_get_arg_type(const char *arg, uint64_t pc) {
     _UPF_ASSERT(arg != NULL);
 
     _upf_tokenizer t = {
-        .tokens = _UPF_VECTOR_NEW(&_upf_state.arena),
+        .tokens = _UPF_VECTOR_NEW(&_upf_state.scratch_arena),
         .idx = 0,
     };
     _upf_tokenize(&t, arg);
@@ -3066,62 +7698,212 @@ static const _upf_type *_upf_get_arg_type(const char *arg, uint64_t pc) {
         .suffix_calls = 0,
         .base = NULL,
         .base_type = 0,
-        .members = _UPF_VECTOR_NEW(&_upf_state.arena),
+        .members = _UPF_VECTOR_NEW(&_upf_state.scratch_arena),
     };
     if (!_upf_parse_expr(&t, &p) || t.idx != t.tokens.length) {
         _UPF_ERROR("Unable to parse argument \"%s\" at %s:%d.", arg, _upf_state.file, _upf_state.line);
     }
 
-    size_t base_type = _upf_get_base_type(&p, pc, arg);
-    size_t member_type = _upf_get_member_type(&p.members, 0, base_type);
+    uint32_t base_type = _upf_get_base_type(&p, pc, arg);
+    uint32_t member_type = _upf_get_member_type(&p.members, 0, base_type);
     if (p.suffix_calls > 0) member_type = _upf_get_return_type(member_type, p.suffix_calls);
-    size_t type = _upf_dereference_type(member_type, p.dereference, arg);
+    uint32_t type = _upf_dereference_type(member_type, p.dereference, arg);
 
-    _UPF_ASSERT(type != _UPF_INVALID);
+    _UPF_ASSERT(type != _UPF_NO_TYPE);
     return _upf_get_type(type);
 }
 
-// ===================== GETTING PC =======================
+// ====================== MODULES =========================
 
-// Function returns the address to which this executable is mapped to.
-// It is retrieved by reading `/proc/self/maps` (see `man proc_pid_maps`).
-// It is used to convert between DWARF addresses and runtime/real ones: DWARF
-// addresses are relative to the beginning of the file, thus real = base + dwarf.
-static void *_upf_get_this_file_address(void) {
-    static const ssize_t PATH_BUFFER_SIZE = 1024;
+// Modules are discovered with dl_iterate_phdr, which reports the same counters
+// of added and removed modules in every callback. They are compared to the
+// counters from the last update, so that the list is only rebuilt after dlopen
+// or dlclose, and modules which are still loaded keep their parsed information.
 
-    char this_path[PATH_BUFFER_SIZE];
-    ssize_t read = readlink("/proc/self/exe", this_path, PATH_BUFFER_SIZE);
-    if (read == -1) _UPF_ERROR("Unable to readlink \"/proc/self/exe\": %s.", strerror(errno));
-    if (read == PATH_BUFFER_SIZE) _UPF_ERROR("Unable to readlink \"/proc/self/exe\": path is too long.");
-    this_path[read] = '\0';
+static int _upf_check_modules_callback(struct dl_phdr_info *dl_info, size_t size, void *data) {
+    const struct _upf_dl_phdr_info *info = (const struct _upf_dl_phdr_info *) dl_info;
+    bool *is_changed = (bool *) data;
 
-    FILE *file = fopen("/proc/self/maps", "r");
-    if (file == NULL) _UPF_ERROR("Unable to open \"/proc/self/maps\": %s.", strerror(errno));
+    *is_changed = size < sizeof(*info) || info->adds != _upf_state.modules_adds || info->subs != _upf_state.modules_subs;
+    // The counters are the same for all modules, so the first one is enough.
+    return 1;
+}
+
+static int _upf_add_module_callback(struct dl_phdr_info *dl_info, size_t size, void *data) {
+    const struct _upf_dl_phdr_info *info = (const struct _upf_dl_phdr_info *) dl_info;
+    _upf_module_vec *loaded = (_upf_module_vec *) data;
+
+    if (size >= sizeof(*info)) {
+        _upf_state.modules_adds = info->adds;
+        _upf_state.modules_subs = info->subs;
+    }
+
+    uint64_t start = UINT64_MAX, end = 0;
+    for (size_t i = 0; i < info->phnum; i++) {
+        const Elf64_Phdr *segment = &info->phdr[i];
+        if (segment->p_type != PT_LOAD) continue;
+        if (info->addr + segment->p_vaddr < start) start = info->addr + segment->p_vaddr;
+        if (info->addr + segment->p_vaddr + segment->p_memsz > end) end = info->addr + segment->p_vaddr + segment->p_memsz;
+    }
+    if (start >= end) return 0;
+
+    // The executable itself has an empty name.
+    const char *path = info->name == NULL || *info->name == '\0' ? "/proc/self/exe" : info->name;
+    uint8_t *base = (uint8_t *) info->addr;
+
+    _upf_module *module = NULL;
+    for (size_t i = 0; i < _upf_state.modules.length; i++) {
+        _upf_module *old = _upf_state.modules.data[i];
+        if (old->base == base && old->start == start && old->end == end && strcmp(old->path, path) == 0) {
+            module = old;
+            break;
+        }
+    }
+
+    if (module == NULL) {
+        _upf_arena arena;
+        _upf_arena_init(&arena, _UPF_INITIAL_MODULE_ARENA_SIZE);
+        module = (_upf_module *) _upf_arena_alloc(&arena, sizeof(*module));
+        memset(module, 0, sizeof(*module));
+        module->arena = arena;
+        module->path = _upf_arena_string(&module->arena, path, path + strlen(path));
+        module->base = base;
+        module->start = start;
+        module->end = end;
+        _UPF_VECTOR_INIT(&module->dwarf.mappings, &module->arena);
+        _UPF_VECTOR_PUSH(&_upf_state.modules, module);
+    }
+
+    _UPF_VECTOR_PUSH(loaded, module);
+    return 0;
+}
+
+static int _upf_module_compare(const void *a, const void *b) {
+    const _upf_module *module_a = *((const _upf_module **) a);
+    const _upf_module *module_b = *((const _upf_module **) b);
+    if (module_a->start < module_b->start) return -1;
+    if (module_a->start > module_b->start) return 1;
+    return 0;
+}
+
+// Unmaps the files of the module and frees its arenas, including the module itself.
+static void _upf_free_module(_upf_module *module) {
+    _UPF_ASSERT(module != NULL);
+
+    if (module->dwarf.file != NULL) munmap(module->dwarf.file, module->dwarf.file_size);
+    for (size_t i = 0; i < module->dwarf.mappings.length; i++) {
+        munmap(module->dwarf.mappings.data[i].data, module->dwarf.mappings.data[i].size);
+    }
+    if (module->cache != NULL) munmap((void *) module->cache, module->cache_size);
+#if UPRINTF_INIT_THREADS > 1
+    if (module->thread_arenas != NULL) {
+        for (size_t i = 0; i < UPRINTF_INIT_THREADS; i++) _upf_arena_free(&module->thread_arenas[i]);
+    }
+#endif
+
+    // The arena can't free itself from within the module.
+    _upf_arena arena = module->arena;
+    _upf_arena_free(&arena);
+}
+
+static size_t _upf_evict_units(size_t usage, size_t limit, uint64_t epoch);
+
+// Frees the modules which were unloaded with dlclose. Their units are
+// referenced by the list of parsed units, and their DIEs by the types, so all
+// of the CUs and types are dropped beforehand, and are parsed again on demand.
+static void _upf_free_unloaded_modules(void) {
+    _upf_module_vec *modules = &_upf_state.modules;
 
-    uint64_t address = _UPF_INVALID;
     size_t length = 0;
-    char *line = NULL;
-    while ((read = getline(&line, &length, file)) != -1) {
-        if (read == 0) continue;
-        if (line[read - 1] == '\n') line[read - 1] = '\0';
+    bool is_evicted = false;
+    for (size_t i = 0; i < modules->length; i++) {
+        _upf_module *module = modules->data[i];
 
-        int path_offset;
-        if (sscanf(line, "%lx-%*x %*s %*x %*x:%*x %*u %n", &address, &path_offset) != 1) {
-            _UPF_ERROR("Unable to parse \"/proc/self/maps\": invalid format.");
+        bool is_loaded = false;
+        for (size_t j = 0; j < _upf_state.loaded_modules.length && !is_loaded; j++) {
+            is_loaded = _upf_state.loaded_modules.data[j] == module;
+        }
+        if (is_loaded) {
+            modules->data[length++] = module;
+            continue;
         }
 
-        if (strcmp(this_path, line + path_offset) == 0) break;
+        if (!is_evicted) {
+            _upf_evict_units(SIZE_MAX, 0, UINT64_MAX);
+            _upf_arena_free(&_upf_state.types_arena);
+            is_evicted = true;
+        }
+        if (_upf_state.module == module) _upf_state.module = NULL;
+        _upf_free_module(module);
     }
-    if (line) free(line);
-    fclose(file);
+    modules->length = length;
+}
+
+static void _upf_update_modules(void) {
+    bool is_changed = true;
+    if (_upf_state.loaded_modules.length > 0) dl_iterate_phdr(_upf_check_modules_callback, &is_changed);
+    if (!is_changed) return;
+
+    _upf_state.loaded_modules.length = 0;
+    dl_iterate_phdr(_upf_add_module_callback, &_upf_state.loaded_modules);
+    qsort(_upf_state.loaded_modules.data, _upf_state.loaded_modules.length, sizeof(*_upf_state.loaded_modules.data), _upf_module_compare);
+    _upf_free_unloaded_modules();
+}
+
+static void _upf_init_module(_upf_module *module) {
+    _UPF_ASSERT(module != NULL);
+
+    // Initialization is attempted only once, like in _upf_init.
+    module->is_init_attempted = true;
+
+    _UPF_VECTOR_INIT(&module->units, &_upf_state.module->arena);
+    _UPF_VECTOR_INIT(&module->unit_ranges, &_upf_state.module->arena);
+    _UPF_VECTOR_INIT(&module->inferred_unit_ranges, &_upf_state.module->arena);
+    _upf_map_init(&module->abbrev_tables, &_upf_state.module->arena);
+    _UPF_VECTOR_INIT(&module->type_units, &_upf_state.module->arena);
+    _upf_map_init(&module->type_signatures, &_upf_state.module->arena);
+    _upf_map_init(&module->type_unit_dies, &_upf_state.module->arena);
+    _UPF_VECTOR_INIT(&module->partial_units, &_upf_state.module->arena);
+
+    if (!_upf_parse_elf()) return;
+    bool has_dwarf = module->dwarf.die != NULL;
+    if (has_dwarf) {
+        _upf_load_sup_file();
+
+        // Headers of the units are walked from start to end during initialization,
+        // while afterwards only the DIEs of the printed arguments are read.
+        _upf_advise_units(_UPF_MADV_SEQUENTIAL);
+        _upf_parse_referenced_units();
+        if (!_upf_load_cache()) {
+            _upf_parse_dwarf();
+            _upf_save_cache();
+        }
+        _upf_advise_units(_UPF_MADV_RANDOM);
+    }
+    if (!_upf_parse_ctf() && !has_dwarf) return;
 
-    _UPF_ASSERT(address != _UPF_INVALID);
-    return (void *) address;
+    module->is_init = true;
 }
 
-__attribute__((noinline)) static uint64_t _upf_get_pc(void) {
-    return (uint64_t) __builtin_extract_return_addr(__builtin_return_address(0));
+// Finds the module which contains the address and makes it the current one,
+// parsing its debugging information on the first call. Returns NULL if there
+// is no such module or it doesn't have debugging information.
+static _upf_module *_upf_get_module(const void *address) {
+    uint64_t value = (uint64_t) address;
+    const _upf_module_vec *modules = &_upf_state.loaded_modules;
+
+    size_t low = 0, high = modules->length;
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+        if (modules->data[mid]->start <= value) low = mid + 1;
+        else high = mid;
+    }
+    if (low == 0 || value >= modules->data[low - 1]->end) return NULL;
+
+    _upf_module *module = modules->data[low - 1];
+    _upf_state.module = module;
+    if (!module->is_init_attempted) _upf_init_module(module);
+    return module->is_init ? module : NULL;
 }
 
 // ================== /proc/pid/maps ======================
@@ -3130,7 +7912,7 @@ static _upf_range_vec _upf_get_address_ranges(void) {
     FILE *file = fopen("/proc/self/maps", "r");
     if (file == NULL) _UPF_ERROR("Unable to open \"/proc/self/maps\": %s.", strerror(errno));
 
-    _upf_range_vec ranges = _UPF_VECTOR_NEW(&_upf_state.arena);
+    _upf_range_vec ranges = _UPF_VECTOR_NEW(&_upf_state.scratch_arena);
     _upf_range range = {
         .start = _UPF_INVALID,
         .end = _UPF_INVALID,
@@ -3148,6 +7930,7 @@ static _upf_range_vec _upf_get_address_ranges(void) {
 
         _UPF_VECTOR_PUSH(&ranges, range);
     }
+    // Allocated by libc, regardless of UPRINTF_MALLOC.
     if (line) free(line);
     fclose(file);
 
@@ -3178,7 +7961,7 @@ static const void *_upf_get_memory_region_end(const void *ptr) {
         if ((size_t) bytes >= _upf_state.free) {                                                  \
             size_t used = _upf_state.size - _upf_state.free;                                      \
             _upf_state.size *= 2;                                                                 \
-            _upf_state.buffer = (char *) realloc(_upf_state.buffer, _upf_state.size);             \
+            _upf_state.buffer = (char *) UPRINTF_REALLOC(_upf_state.buffer, _upf_state.size);     \
             if (_upf_state.buffer == NULL) _UPF_OUT_OF_MEMORY();                                  \
             _upf_state.ptr = _upf_state.buffer + used;                                            \
             _upf_state.free = _upf_state.size - used;                                             \
@@ -3222,13 +8005,13 @@ static void _upf_print_typename(const _upf_type *type, bool print_trailing_white
     _UPF_ASSERT(type != NULL);
     switch (type->kind) {
         case _UPF_TK_POINTER: {
-            if (type->as.pointer.type == _UPF_INVALID) {
+            if (type->type == _UPF_NO_TYPE) {
                 _upf_bprintf("void *");
                 _upf_print_modifiers(type->modifiers);
                 break;
             }
 
-            const _upf_type *pointer_type = _upf_get_type(type->as.pointer.type);
+            const _upf_type *pointer_type = _upf_get_type(type->type);
             if (pointer_type->kind == _UPF_TK_FUNCTION) {
                 _upf_print_typename(pointer_type, print_trailing_whitespace);
                 break;
@@ -3239,24 +8022,24 @@ static void _upf_print_typename(const _upf_type *type, bool print_trailing_white
             _upf_print_modifiers(type->modifiers);
         } break;
         case _UPF_TK_FUNCTION:
-            if (type->as.function.return_type == _UPF_INVALID) {
+            if (type->type == _UPF_NO_TYPE) {
                 _upf_bprintf("void");
             } else {
-                _upf_print_typename(_upf_get_type(type->as.function.return_type), false);
+                _upf_print_typename(_upf_get_type(type->type), false);
             }
 
             _upf_bprintf("(");
-            for (size_t i = 0; i < type->as.function.arg_types.length; i++) {
+            for (uint32_t i = 0; i < type->count; i++) {
                 if (i > 0) _upf_bprintf(", ");
-                _upf_print_typename(_upf_get_type(type->as.function.arg_types.data[i]), false);
+                _upf_print_typename(_upf_get_type(_upf_get_function_arg_type(type, i)), false);
             }
             _upf_bprintf(")");
             if (print_trailing_whitespace) _upf_bprintf(" ");
             break;
         default:
             _upf_print_modifiers(type->modifiers);
-            if (type->name) {
-                _upf_bprintf("%s", type->name);
+            if (type->name != 0) {
+                _upf_bprintf("%s", _upf_get_name(type->name));
             } else {
                 _upf_bprintf("<unnamed>");
             }
@@ -3309,9 +8092,9 @@ static void _upf_collect_circular_structs(_upf_indexed_struct_vec *seen, _upf_in
     if (type->kind == _UPF_TK_POINTER) {
         void *ptr;
         memcpy(&ptr, data, sizeof(ptr));
-        if (ptr == NULL || type->as.pointer.type == _UPF_INVALID) return;
+        if (ptr == NULL || type->type == _UPF_NO_TYPE) return;
 
-        const _upf_type *pointed_type = _upf_get_type(type->as.pointer.type);
+        const _upf_type *pointed_type = _upf_get_type(type->type);
 
         _upf_collect_circular_structs(seen, circular, ptr, pointed_type, depth);
         return;
@@ -3340,9 +8123,8 @@ static void _upf_collect_circular_structs(_upf_indexed_struct_vec *seen, _upf_in
     };
     _UPF_VECTOR_PUSH(seen, indexed_struct);
 
-    _upf_member_vec members = type->as.cstruct.members;
-    for (size_t i = 0; i < members.length; i++) {
-        const _upf_member *member = &members.data[i];
+    for (uint32_t i = 0; i < type->count; i++) {
+        const _upf_member *member = _upf_get_member(type, i);
         if (member->bit_size != 0) continue;
 
         _upf_collect_circular_structs(seen, circular, data + member->offset, _upf_get_type(member->type), depth + 1);
@@ -3384,15 +8166,13 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             __attribute__((fallthrough));  // Handle union as struct
         case _UPF_TK_STRUCT: {
 #if UPRINTF_IGNORE_STDIO_FILE
-            if (strcmp(type->name, "FILE") == 0) {
+            if (strcmp(_upf_get_name(type->name), "FILE") == 0) {
                 _upf_bprintf("<ignored>");
                 return;
             }
 #endif
 
-            _upf_member_vec members = type->as.cstruct.members;
-
-            if (members.length == 0) {
+            if (type->count == 0) {
                 _upf_bprintf("{}");
                 return;
             }
@@ -3411,13 +8191,13 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             }
 
             _upf_bprintf("{\n");
-            for (size_t i = 0; i < members.length; i++) {
-                const _upf_member *member = &members.data[i];
+            for (uint32_t i = 0; i < type->count; i++) {
+                const _upf_member *member = _upf_get_member(type, i);
                 const _upf_type *member_type = _upf_get_type(member->type);
 
                 _upf_bprintf("%*s", UPRINTF_INDENTATION_WIDTH * (depth + 1), "");
                 _upf_print_typename(member_type, true);
-                _upf_bprintf("%s = ", member->name);
+                _upf_bprintf("%s = ", _upf_get_name(member->name));
                 if (member->bit_size == 0) {
                     _upf_print_type(circular, data + member->offset, member_type, depth + 1);
                 } else {
@@ -3428,8 +8208,7 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             _upf_bprintf("%*s}", UPRINTF_INDENTATION_WIDTH * depth, "");
         } break;
         case _UPF_TK_ENUM: {
-            _upf_enum_vec enums = type->as.cenum.enums;
-            const _upf_type *underlying_type = _upf_get_type(type->as.cenum.underlying_type);
+            const _upf_type *underlying_type = _upf_get_type(type->type);
 
             int64_t enum_value;
             if (underlying_type->kind == _UPF_TK_U4) {
@@ -3447,9 +8226,10 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             }
 
             const char *name = NULL;
-            for (size_t i = 0; i < enums.length; i++) {
-                if (enum_value == enums.data[i].value) {
-                    name = enums.data[i].name;
+            for (uint32_t i = 0; i < type->count; i++) {
+                const _upf_enum *cenum = _upf_get_enum(type, i);
+                if (enum_value == cenum->value) {
+                    name = _upf_get_name(cenum->name);
                     break;
                 }
             }
@@ -3459,7 +8239,7 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             _upf_bprintf(")");
         } break;
         case _UPF_TK_ARRAY: {
-            const _upf_type *element_type = _upf_get_type(type->as.array.element_type);
+            const _upf_type *element_type = _upf_get_type(type->type);
             size_t element_size = element_type->size;
 
             if (element_size == _UPF_INVALID) {
@@ -3467,24 +8247,25 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
                 return;
             }
 
-            if (type->as.array.lengths.length == 0) {
+            if (type->count == 0) {
                 _upf_bprintf("<non-static array>");
                 return;
             }
 
             _upf_type subarray;
-            if (type->as.array.lengths.length > 1) {
+            if (type->count > 1) {
                 subarray = _upf_get_subarray(type, 1);
                 element_type = &subarray;
 
-                for (size_t i = 0; i < subarray.as.array.lengths.length; i++) {
-                    element_size *= subarray.as.array.lengths.data[i];
+                for (uint32_t i = 0; i < subarray.count; i++) {
+                    element_size *= _upf_get_length(&subarray, i);
                 }
             }
 
+            size_t length = _upf_get_length(type, 0);
             bool is_primitive = _upf_is_primitive(element_type);
             _upf_bprintf(is_primitive ? "[" : "[\n");
-            for (size_t i = 0; i < type->as.array.lengths.data[0]; i++) {
+            for (size_t i = 0; i < length; i++) {
                 if (i > 0) _upf_bprintf(is_primitive ? ", " : ",\n");
                 if (!is_primitive) _upf_bprintf("%*s", UPRINTF_INDENTATION_WIDTH * (depth + 1), "");
 
@@ -3493,7 +8274,7 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
 
 #if UPRINTF_ARRAY_COMPRESSION_THRESHOLD > 0
                 size_t j = i;
-                while (j < type->as.array.lengths.data[0] && memcmp(current, data + element_size * j, element_size) == 0) j++;
+                while (j < length && memcmp(current, data + element_size * j, element_size) == 0) j++;
 
                 int count = j - i;
                 if (j - i >= UPRINTF_ARRAY_COMPRESSION_THRESHOLD) {
@@ -3517,12 +8298,12 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
                 return;
             }
 
-            if (type->as.pointer.type == _UPF_INVALID) {
+            if (type->type == _UPF_NO_TYPE) {
                 _upf_bprintf("%p", ptr);
                 return;
             }
 
-            const _upf_type *pointed_type = _upf_get_type(type->as.pointer.type);
+            const _upf_type *pointed_type = _upf_get_type(type->type);
             if (pointed_type->kind == _UPF_TK_POINTER || pointed_type->kind == _UPF_TK_VOID) {
                 _upf_bprintf("%p", ptr);
                 return;
@@ -3543,33 +8324,34 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
             _upf_bprintf(")");
         } break;
         case _UPF_TK_FUNCTION: {
-            _upf_function *function = NULL;
-            _upf_cu *cu = NULL;
-            uint64_t function_pc = data - _upf_state.pc_base;
-            for (uint32_t i = 0; i < _upf_state.cus.length; i++) {
-                cu = &_upf_state.cus.data[i];
-                for (uint32_t j = 0; j < cu->functions.length; j++) {
-                    if (function_pc == cu->functions.data[j].low_pc) {
-                        function = &cu->functions.data[j];
-                        break;
-                    }
-                }
-                if (function) break;
-            }
+            const _upf_function *function = NULL;
+            // Function may belong to another module, e.g. a callback from a shared library.
+            const _upf_module *module = _upf_get_module(data);
+            uint64_t function_pc = module == NULL ? 0 : (uint64_t) (data - module->base);
+            _upf_cu *cu = module == NULL ? NULL : _upf_get_cu(function_pc);
+            const _upf_function_range *function_range = cu == NULL ? NULL : _upf_find_function_range(cu, function_pc);
+            if (function_range != NULL) function = &cu->functions.data[function_range->function_idx];
 
             _upf_bprintf("%p", (void *) data);
-            if (function != NULL) {
+            if (function != NULL && function_pc != function->low_pc) {
+                // Pointer into the middle of the function, e.g. a return address.
+                uint64_t start = function_pc > function->low_pc ? function->low_pc : function_range->start;
+                _upf_bprintf(" <%s+0x%lx>", function->name, function_pc - start);
+            } else if (function != NULL) {
                 _UPF_ASSERT(cu != NULL);
 
                 _upf_bprintf(" <");
 
-                size_t return_type_idx;
+                uint32_t return_type_idx;
                 if (function->return_type == NULL) {
                     _upf_type type = {
-                        .name = "void",
                         .kind = _UPF_TK_VOID,
                         .modifiers = 0,
+                        .first = 0,
                         .size = _UPF_INVALID,
+                        .count = 0,
+                        .type = _UPF_NO_TYPE,
+                        .name = _upf_intern_type_name("void"),
                     };
                     return_type_idx = _upf_add_type(NULL, type);
                 } else {
@@ -3579,7 +8361,7 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
                 _upf_bprintf("%s(", function->name);
                 for (uint32_t i = 0; i < function->args.length; i++) {
                     if (i > 0) _upf_bprintf(", ");
-                    size_t arg_type_idx = _upf_parse_type(cu, function->args.data[i].die);
+                    uint32_t arg_type_idx = _upf_parse_type(cu, function->args.data[i].die);
                     bool has_name = function->args.data[i].name != NULL;
                     _upf_print_typename(_upf_get_type(arg_type_idx), has_name);
                     if (has_name) _upf_bprintf("%s", function->args.data[i].name);
@@ -3661,69 +8443,201 @@ static void _upf_print_type(_upf_indexed_struct_vec *circular, const uint8_t *da
     }
 }
 
+// ====================== MEMORY ==========================
+
+// Types are allocated in their own arena, so that they can be dropped all at
+// once and set up again on the next call.
+static void _upf_init_types(void) {
+    _upf_arena_init(&_upf_state.types_arena, _UPF_INITIAL_ARENA_SIZE);
+    _UPF_VECTOR_INIT(&_upf_state.types, &_upf_state.types_arena);
+    _upf_map_init(&_upf_state.type_idxs, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.members, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.enums, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.lengths, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.arg_types, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.member_stack, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.arg_type_stack, &_upf_state.types_arena);
+    _UPF_VECTOR_INIT(&_upf_state.names, &_upf_state.types_arena);
+    _upf_map_init(&_upf_state.synthetic_types, &_upf_state.types_arena);
+    _upf_map_init(&_upf_state.synthetic_names, &_upf_state.types_arena);
+    // Offset 0 stands for the absence of name.
+    _UPF_VECTOR_PUSH(&_upf_state.names, '\0');
+}
+
+// Sums the measure over all of the arenas.
+static size_t _upf_sum_arenas(size_t (*measure)(const _upf_arena *)) {
+    size_t size = measure(&_upf_state.arena) + measure(&_upf_state.types_arena) + measure(&_upf_state.scratch_arena);
+    for (size_t i = 0; i < _upf_state.parsed_units.length; i++) size += measure(&_upf_state.parsed_units.data[i]->arena);
+    for (size_t i = 0; i < _upf_state.modules.length; i++) {
+        const _upf_module *module = _upf_state.modules.data[i];
+        size += measure(&module->arena);
+#if UPRINTF_INIT_THREADS > 1
+        if (module->thread_arenas == NULL) continue;
+        for (size_t j = 0; j < UPRINTF_INIT_THREADS; j++) size += measure(&module->thread_arenas[j]);
+#endif
+    }
+    return size;
+}
+
+// Returns the number of bytes allocated by uprintf, not counting the mapped files.
+static size_t _upf_get_memory_usage(void) {
+    size_t size = _upf_sum_arenas(_upf_arena_size);
+    if (_upf_state.buffer != NULL) size += _upf_state.size;
+    return size;
+}
+
+#ifdef UPRINTF_TEST
+// Returns the number of allocated bytes which can't be used anymore.
+__attribute__((unused)) static size_t _upf_get_memory_waste(void) { return _upf_sum_arenas(_upf_arena_waste); }
+#endif
+
+static int _upf_unit_last_use_compare(const void *a, const void *b) {
+    const _upf_unit *unit_a = *((const _upf_unit **) a);
+    const _upf_unit *unit_b = *((const _upf_unit **) b);
+    if (unit_a->last_use < unit_b->last_use) return -1;
+    if (unit_a->last_use > unit_b->last_use) return 1;
+    return 0;
+}
+
+// Evicts CUs which were last used before the epoch, starting with the least
+// recently used ones, until the memory usage drops to the limit. They are parsed
+// again once they are needed. Returns the memory usage after the eviction.
+static size_t _upf_evict_units(size_t usage, size_t limit, uint64_t epoch) {
+    _upf_unit_ref_vec *units = &_upf_state.parsed_units;
+    if (units->length > 0) qsort(units->data, units->length, sizeof(*units->data), _upf_unit_last_use_compare);
+
+    size_t evicted = 0;
+    while (evicted < units->length && usage > limit && units->data[evicted]->last_use < epoch) {
+        _upf_unit *unit = units->data[evicted++];
+        usage -= _upf_arena_size(&unit->arena);
+        _upf_arena_free(&unit->arena);
+        unit->cu = NULL;
+        unit->is_parsed = false;
+    }
+
+    if (evicted > 0) {
+        units->length -= evicted;
+        memmove(units->data, units->data + evicted, units->length * sizeof(*units->data));
+    }
+    return usage;
+}
+
+// Brings the memory usage down to the limit between the calls, when nothing points
+// into the evicted CUs and types. CUs which weren't used by the last call go
+// first, then the types, which reference each other and are thus dropped all at
+// once, and only then the CUs of the last call.
+static void _upf_limit_memory(size_t limit) {
+    if (!_upf_state.is_init) return;
+
+    size_t usage = _upf_get_memory_usage();
+    if (usage <= limit) return;
+
+    usage = _upf_evict_units(usage, limit, _upf_state.epoch);
+    if (usage <= limit) return;
+
+    usage -= _upf_arena_size(&_upf_state.types_arena);
+    _upf_arena_free(&_upf_state.types_arena);
+    if (usage <= limit) return;
+
+    _upf_evict_units(usage, limit, UINT64_MAX);
+}
+
 // =================== ENTRY POINTS =======================
 
-__attribute__((constructor)) void _upf_init(void) {
-    if (setjmp(_upf_state.jmp_buf) != 0) return;
+// Parsing is deferred until the first call instead of being done in a constructor,
+// so that programs which link uprintf but never call it don't pay for it at startup.
+// Modules are parsed even later, once some PC lands in them (see _upf_get_module).
+static void _upf_init(void) {
+    // Initialization is attempted only once: if it fails, the error has already
+    // been reported and all subsequent calls are ignored.
+    _upf_state.is_init_attempted = true;
 
-    if (access("/proc/self/exe", R_OK) != 0) _UPF_ERROR("Expected \"/proc/self/exe\" to be a valid path.");
     if (access("/proc/self/maps", R_OK) != 0) _UPF_ERROR("Expected \"/proc/self/maps\" to be a valid path.");
 
-    _upf_arena_init(&_upf_state.arena);
-    _UPF_VECTOR_INIT(&_upf_state.cus, &_upf_state.arena);
-    _UPF_VECTOR_INIT(&_upf_state.type_map, &_upf_state.arena);
-
-    _upf_parse_elf();
-    _upf_parse_dwarf();
+    _upf_arena_init(&_upf_state.arena, _UPF_INITIAL_ARENA_SIZE);
+    _UPF_VECTOR_INIT(&_upf_state.modules, &_upf_state.arena);
+    _UPF_VECTOR_INIT(&_upf_state.loaded_modules, &_upf_state.arena);
+    _UPF_VECTOR_INIT(&_upf_state.parsed_units, &_upf_state.arena);
+    _upf_arena_init(&_upf_state.scratch_arena, _UPF_INITIAL_ARENA_SIZE);
+    _upf_state.scratch_mark = _upf_arena_set_mark(&_upf_state.scratch_arena);
 
     _upf_state.is_init = true;
 }
 
 __attribute__((destructor)) void _upf_fini(void) {
+    // Units live in the modules, so their arenas are freed first.
+    for (size_t i = 0; i < _upf_state.parsed_units.length; i++) _upf_arena_free(&_upf_state.parsed_units.data[i]->arena);
     // Must be unloaded at the end of the program because many variables point
-    // into the _upf_state.dwarf.file to avoid unnecessarily copying date.
-    if (_upf_state.dwarf.file != NULL) munmap(_upf_state.dwarf.file, _upf_state.dwarf.file_size);
-    if (_upf_state.buffer != NULL) free(_upf_state.buffer);
+    // into the module->dwarf.file to avoid unnecessarily copying date.
+    for (size_t i = 0; i < _upf_state.modules.length; i++) _upf_free_module(_upf_state.modules.data[i]);
+    if (_upf_state.buffer != NULL) UPRINTF_FREE(_upf_state.buffer);
+    _upf_arena_free(&_upf_state.scratch_arena);
+    _upf_arena_free(&_upf_state.types_arena);
     _upf_arena_free(&_upf_state.arena);
 }
 
+void uprintf_trim(void) {
+    if (!_upf_state.is_init) return;
+
+    _upf_evict_units(_upf_get_memory_usage(), 0, UINT64_MAX);
+    _upf_arena_free(&_upf_state.types_arena);
+    if (_upf_state.buffer != NULL) {
+        UPRINTF_FREE(_upf_state.buffer);
+        _upf_state.buffer = NULL;
+    }
+
+    // Pages of the mapped files are read again from the page cache once they are needed.
+    for (size_t i = 0; i < _upf_state.modules.length; i++) {
+        const _upf_module *module = _upf_state.modules.data[i];
+        _upf_advise(module->dwarf.file, module->dwarf.file_size, _UPF_MADV_DONTNEED);
+        _upf_advise(module->cache, module->cache_size, _UPF_MADV_DONTNEED);
+    }
+}
+
 __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const char *fmt, const char *args_string, ...) {
     _UPF_ASSERT(file != NULL && line > 0 && fmt != NULL && args_string != NULL);
 
-    if (!_upf_state.is_init) return;
-    if (setjmp(_upf_state.jmp_buf) != 0) return;
+    if (setjmp(_upf_state.jmp_buf) != 0) {
+        if (_upf_state.is_init) _upf_arena_rollback(&_upf_state.scratch_arena, _upf_state.scratch_mark);
+        if (UPRINTF_MAX_MEMORY > 0) _upf_limit_memory(UPRINTF_MAX_MEMORY);
+        return;
+    }
+    if (!_upf_state.is_init) {
+        if (_upf_state.is_init_attempted) return;
+        _upf_init();
+    }
+    // Types are dropped if some modules were unloaded.
+    _upf_update_modules();
+    if (_upf_state.types_arena.head == NULL) _upf_init_types();
+    _upf_state.epoch++;
 
     if (_upf_state.buffer == NULL) {
         _upf_state.size = _UPF_INITIAL_BUFFER_SIZE;
-        _upf_state.buffer = (char *) malloc(_upf_state.size * sizeof(*_upf_state.buffer));
+        _upf_state.buffer = (char *) UPRINTF_MALLOC(_upf_state.size * sizeof(*_upf_state.buffer));
         if (_upf_state.buffer == NULL) _UPF_OUT_OF_MEMORY();
     }
     _upf_state.ptr = _upf_state.buffer;
     _upf_state.free = _upf_state.size;
     _upf_state.addresses = _upf_get_address_ranges();
     _upf_state.circular_id = 0;
+    // Parsing may have been interrupted by an error in the previous call.
+    _upf_state.member_stack.length = 0;
+    _upf_state.arg_type_stack.length = 0;
     _upf_state.file = file;
     _upf_state.line = line;
 
-    if (!_upf_state.init_pc) {
-        _upf_state.init_pc = true;
-
-        _UPF_ASSERT(_upf_state.uprintf_ranges.length > 0);
-        bool is_pc_absolute = _upf_is_in_range(_upf_get_pc(), _upf_state.uprintf_ranges);
-        if (is_pc_absolute) {
-            _upf_state.pc_base = NULL;
-        } else {
-            _upf_state.pc_base = _upf_get_this_file_address();
-        }
-    }
-
     uint8_t *pc_ptr = __builtin_extract_return_addr(__builtin_return_address(0));
     _UPF_ASSERT(pc_ptr != NULL);
-    uint64_t pc = pc_ptr - _upf_state.pc_base;
 
-    _upf_indexed_struct_vec seen = _UPF_VECTOR_NEW(&_upf_state.arena);
-    _upf_indexed_struct_vec circular = _UPF_VECTOR_NEW(&_upf_state.arena);
-    char *args_string_copy = _upf_arena_string(&_upf_state.arena, args_string, args_string + strlen(args_string));
+    _upf_module *module = _upf_get_module(pc_ptr);
+    if (module == NULL) {
+        _UPF_ERROR(
+            "Unable to find debugging information. Ensure that the executable contains it by using -g2, -g3 or -gctf, "
+            "or that its separate debug file can be found.");
+    }
+    uint64_t pc = pc_ptr - module->base;
+
+    char *args_string_copy = _upf_arena_string(&_upf_state.scratch_arena, args_string, args_string + strlen(args_string));
     _upf_cstr_vec args = _upf_get_args(args_string_copy);
     size_t arg_idx = 0;
 
@@ -3744,11 +8658,16 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
             if (arg_idx >= args.length) _UPF_ERROR("There are more format specifiers than arguments provided at %s:%d.", file, line);
 
             const void *ptr = va_arg(va_args, void *);
+            // Printing of the previous argument could have switched to another module.
+            _upf_state.module = module;
+            // Data of each argument is dropped once it is printed.
+            _upf_arena_mark arg_mark = _upf_arena_set_mark(&_upf_state.scratch_arena);
             const _upf_type *type = _upf_get_arg_type(args.data[arg_idx++], pc);
-            seen.length = 0;
-            circular.length = 0;
+            _upf_indexed_struct_vec seen = _UPF_VECTOR_NEW(&_upf_state.scratch_arena);
+            _upf_indexed_struct_vec circular = _UPF_VECTOR_NEW(&_upf_state.scratch_arena);
             _upf_collect_circular_structs(&seen, &circular, ptr, type, 0);
             _upf_print_type(&circular, ptr, type, 0);
+            _upf_arena_rollback(&_upf_state.scratch_arena, arg_mark);
         } else if (*ch == '\n' || *ch == '\0') {
             _UPF_ERROR("Unfinished format specifier at the end of the line at %s:%d.", file, line);
         } else {
@@ -3763,11 +8682,19 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 
     printf("%s", _upf_state.buffer);
     fflush(stdout);
+
+    _upf_arena_rollback(&_upf_state.scratch_arena, _upf_state.scratch_mark);
+    if (UPRINTF_MAX_MEMORY > 0) _upf_limit_memory(UPRINTF_MAX_MEMORY);
 }
 
 // ====================== UNDEF ===========================
 
 #undef _UPF_DW_UT_compile
+#undef _UPF_DW_UT_type
+#undef _UPF_DW_UT_partial
+#undef _UPF_DW_UT_skeleton
+#undef _UPF_DW_UT_split_compile
+#undef _UPF_DW_UT_split_type
 #undef _UPF_DW_TAG_array_type
 #undef _UPF_DW_TAG_enumeration_type
 #undef _UPF_DW_TAG_formal_parameter
@@ -3789,9 +8716,12 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_TAG_variable
 #undef _UPF_DW_TAG_volatile_type
 #undef _UPF_DW_TAG_restrict_type
+#undef _UPF_DW_TAG_partial_unit
+#undef _UPF_DW_TAG_type_unit
 #undef _UPF_DW_TAG_atomic_type
 #undef _UPF_DW_TAG_call_site
 #undef _UPF_DW_TAG_call_site_parameter
+#undef _UPF_DW_TAG_skeleton_unit
 #undef _UPF_DW_FORM_addr
 #undef _UPF_DW_FORM_block2
 #undef _UPF_DW_FORM_block4
@@ -3835,6 +8765,9 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_FORM_addrx2
 #undef _UPF_DW_FORM_addrx3
 #undef _UPF_DW_FORM_addrx4
+#undef _UPF_DW_FORM_GNU_ref_alt
+#undef _UPF_DW_FORM_GNU_strp_alt
+#undef _UPF_DW_AT_sibling
 #undef _UPF_DW_AT_name
 #undef _UPF_DW_AT_byte_size
 #undef _UPF_DW_AT_bit_offset
@@ -3842,6 +8775,7 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_AT_low_pc
 #undef _UPF_DW_AT_high_pc
 #undef _UPF_DW_AT_language
+#undef _UPF_DW_AT_comp_dir
 #undef _UPF_DW_AT_const_value
 #undef _UPF_DW_AT_upper_bound
 #undef _UPF_DW_AT_abstract_origin
@@ -3850,10 +8784,12 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_AT_encoding
 #undef _UPF_DW_AT_type
 #undef _UPF_DW_AT_ranges
+#undef _UPF_DW_AT_signature
 #undef _UPF_DW_AT_data_bit_offset
 #undef _UPF_DW_AT_str_offsets_base
 #undef _UPF_DW_AT_addr_base
 #undef _UPF_DW_AT_rnglists_base
+#undef _UPF_DW_AT_dwo_name
 #undef _UPF_DW_ATE_address
 #undef _UPF_DW_ATE_boolean
 #undef _UPF_DW_ATE_complex_float
@@ -3872,6 +8808,13 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_ATE_UTF
 #undef _UPF_DW_ATE_UCS
 #undef _UPF_DW_ATE_ASCII
+#undef _UPF_DW_IDX_compile_unit
+#undef _UPF_DW_IDX_type_unit
+#undef _UPF_DW_IDX_die_offset
+#undef _UPF_DW_SECT_info
+#undef _UPF_DW_SECT_abbrev
+#undef _UPF_DW_SECT_str_offsets
+#undef _UPF_DW_SECT_rnglists
 #undef _UPF_DW_RLE_end_of_list
 #undef _UPF_DW_RLE_base_addressx
 #undef _UPF_DW_RLE_startx_endx
@@ -3886,26 +8829,87 @@ __attribute__((noinline)) void _upf_uprintf(const char *file, int line, const ch
 #undef _UPF_DW_LANG_C11
 #undef _UPF_DW_LANG_C17
 #undef _UPF_SET_TEST_STATUS
+#undef _UPF_COUNT_TEST_CACHE_LOAD
 #undef _UPF_INVALID
 #undef _UPF_LOG
+#undef _UPF_JMP_BUF
 #undef _UPF_ERROR
 #undef _UPF_WARN
 #undef _UPF_ASSERT
 #undef _UPF_OUT_OF_MEMORY
 #undef _UPF_UNREACHABLE
 #undef _UPF_INITIAL_VECTOR_CAPACITY
+#undef _UPF_MAX_VECTOR_CAPACITY
 #undef _UPF_VECTOR_TYPEDEF
 #undef _UPF_VECTOR_NEW
 #undef _UPF_VECTOR_INIT
 #undef _UPF_VECTOR_PUSH
 #undef _UPF_VECTOR_COPY
+#undef _UPF_VECTOR_RESERVE
 #undef _UPF_VECTOR_TOP
 #undef _UPF_VECTOR_POP
 #undef _UPF_MOD_CONST
 #undef _UPF_MOD_VOLATILE
 #undef _UPF_MOD_RESTRICT
 #undef _UPF_MOD_ATOMIC
+#undef _UPF_NO_TYPE
 #undef _UPF_INITIAL_ARENA_SIZE
+#undef _UPF_INITIAL_UNIT_ARENA_SIZE
+#undef _UPF_INITIAL_MODULE_ARENA_SIZE
+#undef _UPF_MAPPED_REGION_SIZE
+#undef _UPF_HUGE_PAGE_SIZE
+#undef _UPF_MAX_REGION_SIZE
+#undef _UPF_INITIAL_MAP_CAPACITY
+#undef _UPF_CACHE_VERSION
+#undef _UPF_CACHE_MAX_BUILD_ID_SIZE
+#undef _UPF_CACHE_STRING_FLAG
+#undef _UPF_INFLATE_FAST_BITS
+#undef _UPF_INFLATE_MAX_BITS
+#undef _UPF_INFLATE_ERROR
+#undef _UPF_MAP_ANONYMOUS
+#undef _UPF_MADV_RANDOM
+#undef _UPF_MADV_SEQUENTIAL
+#undef _UPF_MADV_WILLNEED
+#undef _UPF_MADV_DONTNEED
+#undef _UPF_MADV_HUGEPAGE
+#undef _UPF_HAS_CUSTOM_ALLOCATOR
+#undef _UPF_NO_PARENT
+#undef _UPF_SCOPE_VAR_NAMES_THRESHOLD
+#undef _UPF_CTF_MAGIC
+#undef _UPF_CTF_VERSION_3
+#undef _UPF_CTF_F_COMPRESS
+#undef _UPF_CTF_F_DYNSTR
+#undef _UPF_CTF_ARCHIVE_MAGIC
+#undef _UPF_CTF_CHILD_FLAG
+#undef _UPF_CTF_EXTERNAL_FLAG
+#undef _UPF_CTF_LSIZE_SENT
+#undef _UPF_CTF_LSTRUCT_THRESH
+#undef _UPF_CTF_K_INTEGER
+#undef _UPF_CTF_K_FLOAT
+#undef _UPF_CTF_K_POINTER
+#undef _UPF_CTF_K_ARRAY
+#undef _UPF_CTF_K_FUNCTION
+#undef _UPF_CTF_K_STRUCT
+#undef _UPF_CTF_K_UNION
+#undef _UPF_CTF_K_ENUM
+#undef _UPF_CTF_K_FORWARD
+#undef _UPF_CTF_K_TYPEDEF
+#undef _UPF_CTF_K_VOLATILE
+#undef _UPF_CTF_K_CONST
+#undef _UPF_CTF_K_RESTRICT
+#undef _UPF_CTF_K_SLICE
+#undef _UPF_CTF_INT_SIGNED
+#undef _UPF_CTF_INT_CHAR
+#undef _UPF_CTF_INT_BOOL
+#undef _UPF_CTF_FP_SINGLE
+#undef _UPF_CTF_FP_DOUBLE
+#undef _UPF_CTF_FP_CPLX
+#undef _UPF_CTF_FP_DCPLX
+#undef _UPF_CTF_FP_LDCPLX
+#undef _UPF_CTF_FP_LDOUBLE
+#undef _UPF_CTF_FP_IMAGRY
+#undef _UPF_CTF_FP_DIMAGRY
+#undef _UPF_CTF_FP_LDIMAGRY
 #undef _upf_arena_concat
 #undef _upf_consume
 #undef _UPF_INITIAL_BUFFER_SIZE